@@ -29,11 +29,27 @@
 #include <sys/ioctl.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <termios.h>
 #include <asm/types.h>
 
-#include <linux/fb.h>
-#include "sunxi_disp_ioctl.h"
-#define MODE_COUNT DISP_TV_MODE_NUM
+#include "backend.h"
+#include "hotplug.h"
+#include "fbconvert.h"
+#include "fbbench.h"
+#include "membench.h"
+#include "trace.h"
+#include "record.h"
+#include "edid.h"
+#include "liba10disp.h"
 /*
 You can add new modes support to kernel by editing files in drivers/video/sunxi/:
 	hdmi/hdmi_core.h:
@@ -56,9 +72,42 @@ Change DISP_TV_MODE_NUM in include/video/sunxi_disp_ioctl.h, add mode to this fi
 // selected mode fits into the framebuffer.
 // You can change this to 1 if you don't use Mali or video acceleration and
 // want to be able set larger modes with a small framebuffer.
-// This can also be changed with the --nodoublebuffer option.
+// This can also be changed with the --nodoublebuffer and --buffers options.
 #define DEFAULT_NUMBER_OF_FRAMEBUFFER_BUFFERS 2
 
+// The DRAM bandwidth in MB/s that the scanout bandwidth is compared against by the bandwidth
+// command. This is the theoretical bandwidth of DDR3 at 432 MHz with a 32-bit bus, as used by
+// most A10 and A20 boards. It can be changed with the --drambandwidth option.
+#define DEFAULT_DRAM_BANDWIDTH 3456
+
+// The refresh rate assumed for LCD panels, which the display driver doesn't report.
+#define LCD_REFRESH_RATE 60
+
+// File used to cache the HDMI modes supported by the display, so that they don't have to be
+// probed with DISP_CMD_HDMI_SUPPORT_MODE every time. Can be changed with the --modecache
+// option ("--modecache none" disables the cache).
+#define DEFAULT_MODE_CACHE_FILE "/var/cache/a10disp-modes"
+
+// Display state files written by the save command.
+#define STATE_FILE_MAGIC "a10disp-state"
+#define STATE_FILE_VERSION 1
+
+// EDID of the connected display, used to identify the display for the mode cache when it exists.
+#define DEFAULT_EDID_FILE "/sys/class/hdmi/hdmi/attr/edid"
+// Custom modes of a kernel built with extra modes (see above), loaded at startup when the file
+// exists. Another file can be given with the --modes option.
+#define DEFAULT_MODES_FILE "/etc/a10disp-modes"
+#define DEFAULT_SOCKET_FILE "/run/a10dispd.sock"
+// Maximum size and number of arguments of a request to the daemon.
+#define DAEMON_REQUEST_SIZE 4096
+#define DAEMON_MAX_ARGS 64
+
+// Maximum number of display configurations of the membench command, and the number of doubles
+// per array and thread (three arrays of 16 MB, well beyond the caches) and trials per kernel.
+#define MEMBENCH_MAX_CONFIGS 16
+#define MEMBENCH_ELEMENTS (2 * 1024 * 1024)
+#define MEMBENCH_TRIALS 5
+
 #define COMMAND_SWITCH_TO_HDMI			0
 #define COMMAND_SWITCH_TO_HDMI_FORCE	1
 #define COMMAND_SWITCH_TO_LCD			2
@@ -72,70 +121,499 @@ Change DISP_TV_MODE_NUM in include/video/sunxi_disp_ioctl.h, add mode to this fi
 #define COMMAND_DISABLE_SCALER 			10
 #define COMMAND_ENABLE_HDMI 			11
 #define COMMAND_ENABLE_HDMI_FORCE 		12
+#define COMMAND_BANDWIDTH				13
+#define COMMAND_AUTO_MODE				14
+#define COMMAND_APPLY					15
+#define COMMAND_DAEMON					16
+#define COMMAND_MONITOR					17
+#define COMMAND_CONVERT_BENCH			18
+#define COMMAND_FB_BENCH				19
+#define COMMAND_MEM_BENCH				20
+#define COMMAND_FLIP_BENCH				21
+#define COMMAND_CONSOLE_BENCH			22
+#define COMMAND_RECORD_DIFF				23
+#define COMMAND_EDID					24
+#define COMMAND_PLAN_MEM				25
+#define COMMAND_SAVE					26
+#define COMMAND_RESTORE					27
+
+#define AUTO_MODE_MAX_RESOLUTION		0
+#define AUTO_MODE_MIN_BANDWIDTH			1
+#define AUTO_MODE_REFRESH				2
+#define AUTO_MODE_NATIVE				3
+static struct disp_backend *backend;
+static int nu_framebuffer_buffers = DEFAULT_NUMBER_OF_FRAMEBUFFER_BUFFERS;
+static int use_scaler_for_large_32bpp_modes = 1;
+static int dram_bandwidth = DEFAULT_DRAM_BANDWIDTH;
+// When set (--buffers), the virtual height of the console framebuffer is set to
+// nu_framebuffer_buffers times its height, so that the buffers can be flipped by panning.
+static int set_virtual_buffers = 0;
+// When set (--panscroll), the virtual height of the console framebuffer is set to all lines that
+// fit into the framebuffer memory, so that fbcon scrolls by panning (or wrapping) the display
+// instead of copying the screen contents.
+static int pan_scroll = 0;
+// When set, the console framebuffer is changed by running fbset instead of using
+// FBIOPUT_VSCREENINFO directly.
+static int use_fbset = 0;
+static int compare_with_fbset = 0;
+// When set, the contents of the console framebuffer are converted to the new pixel depth when
+// only the pixel depth changes, optionally with ordered dithering when reducing it to 16bpp.
+static int preserve_contents = 0;
+static int dither_contents = 0;
+static int use_simd = 1;
+// CPU the fbbench command is pinned to (-1 if not pinned).
+static int bench_cpu = - 1;
+// Ratio of the console framebuffer size to the display size for HDMI modes (0 if not used). A
+// smaller framebuffer is upscaled to the display by the scaler.
+static double render_scale = 0;
+// Unix socket of the daemon. With --socket or --client, commands are sent to the daemon.
+static const char *socket_file = DEFAULT_SOCKET_FILE;
+static int use_daemon = 0;
+// When set, the number of display driver ioctls is shown after each command (-v).
+static int verbose = 0;
+// File the display driver calls are traced to (--trace), or NULL.
+static const char *trace_file_name = NULL;
+// File the display driver calls are recorded to (--record), or NULL.
+static const char *record_file_name = NULL;
+// Source of HDMI hot plug events for the monitor command, <name>[:<argument>].
+static const char *hotplug_source_spec = "netlink";
+// How the apply command changes two screens that both need a display off/on cycle: interleaved in
+// one thread with a single blackout (the default, --interleaved), one screen after the other
+// (--sequential), or at the same time in two threads so that the blackouts overlap (--concurrent).
+// The threads have only been tested with the simulated driver, so they must be asked for; with
+// --trace, --record and --replay, which need the calls in order, the screens are interleaved.
+#define SCREENS_INTERLEAVED	0
+#define SCREENS_SEQUENTIAL	1
+#define SCREENS_CONCURRENT	2
+static int screen_sequencing = SCREENS_INTERLEAVED;
+
+// Target state of a screen for the apply command. Settings that are not given are -1, or 0 for
+// the pixel depth and window sizes, and are derived from the current state and the other settings.
+struct screen_target {
+	int given;
+	int output_type;
+	int mode;
+	int bytes_per_pixel;
+	int src_width, src_height;
+	int scn_width, scn_height;
+	int scaler;
+	// Virtual height of the console framebuffer, 0 for the default (see --buffers and --panscroll).
+	int virtual_height;
+};
+
+// A parsed command with its arguments.
+struct command_args {
+	int command;
+	int screen;
+	int mode;
+	int bytes_per_pixel;
+	int sc_source_width, sc_source_height, sc_width, sc_height;
+	// For automode: the policy and its argument (minimum number of pixels or refresh rate).
+	int auto_mode_policy;
+	int auto_mode_parameter;
+	// For apply: the target state of screens 0 and 1, and whether modes the display reports as not
+	// supported are set anyway (a force command given with --screen all).
+	struct screen_target target[2];
+	int force;
+	// Number of benchmark runs (--bench) and the name of the command.
+	int bench_iterations;
+	const char *name;
+	// For convertbench: the frame size and the number of runs. For fbbench: the number of frames
+	// and the frame size of a file-backed buffer (bytes_per_pixel is its pixel depth).
+	int width, height;
+	int iterations;
+	// For fbbench: framebuffer device or file to benchmark instead of the screen's framebuffer.
+	const char *bench_file;
+	// For recorddiff: the recordings (the second one may be NULL).
+	const char *record_file[2];
+	// For save and restore: the display state file.
+	const char *state_file;
+	// For edid: the EDID files to show (none for the EDID of the connected display).
+	int nu_edid_files;
+	char **edid_files;
+	// For flipbench: whether to fill each buffer before flipping to it.
+	int fill;
+	// For membench: the maximum number of threads. For membench and planmem: the display
+	// configurations, given as the targets of both screens like for apply, and for planmem the
+	// number of buffers of each screen (0 if not given).
+	int nu_threads;
+	int nu_configs;
+	const char *config_name[MEMBENCH_MAX_CONFIGS];
+	struct screen_target config_target[MEMBENCH_MAX_CONFIGS][2];
+	int config_buffers[MEMBENCH_MAX_CONFIGS][2];
+};
+
+// The modes of the display driver, indexed by mode number. PAL_M is a 525-line system like NTSC.
+struct mode_timing mode_timing[MAX_MODES] = {
+	[DISP_TV_MOD_480I] =			{ "480i", 720, 480, 60, 1, 13500 },
+	[DISP_TV_MOD_576I] =			{ "576i", 720, 576, 50, 1, 13500 },
+	[DISP_TV_MOD_480P] =			{ "480p", 720, 480, 60, 0, 27000 },
+	[DISP_TV_MOD_576P] =			{ "576p", 720, 576, 50, 0, 27000 },
+	[DISP_TV_MOD_720P_50HZ] =		{ "720p 50Hz", 1280, 720, 50, 0, 74250 },
+	[DISP_TV_MOD_720P_60HZ] =		{ "720p 60Hz", 1280, 720, 60, 0, 74250 },
+	[DISP_TV_MOD_1080I_50HZ] =		{ "1080i 50 Hz", 1920, 1080, 50, 1, 74250 },
+	[DISP_TV_MOD_1080I_60HZ] =		{ "1080i 60 Hz", 1920, 1080, 60, 1, 74250 },
+	[DISP_TV_MOD_1080P_24HZ] =		{ "1080p 24 Hz", 1920, 1080, 24, 0, 74250 },
+	[DISP_TV_MOD_1080P_50HZ] =		{ "1080p 50 Hz", 1920, 1080, 50, 0, 148500 },
+	[DISP_TV_MOD_1080P_60HZ] =		{ "1080p 60 Hz", 1920, 1080, 60, 0, 148500 },
+	[DISP_TV_MOD_PAL] =				{ "PAL", 720, 576, 50, 1, 13500 },
+	[DISP_TV_MOD_PAL_SVIDEO] =		{ "PAL SVIDEO", 720, 576, 50, 1, 13500 },
+	[DISP_TV_MOD_NTSC] =			{ "NTSC", 720, 480, 60, 1, 13500 },
+	[DISP_TV_MOD_NTSC_SVIDEO] =		{ "NTSC SVIDEO", 720, 480, 60, 1, 13500 },
+	[DISP_TV_MOD_PAL_M] =			{ "PAL_M", 720, 480, 60, 1, 13500 },
+	[DISP_TV_MOD_PAL_M_SVIDEO] =	{ "PAL_M SVIDEO", 720, 480, 60, 1, 13500 },
+	[DISP_TV_MOD_PAL_NC] =			{ "PAL_NC", 720, 576, 50, 1, 13500 },
+	[DISP_TV_MOD_PAL_NC_SVIDEO] =	{ "PAL_NC SVIDEO", 720, 576, 50, 1, 13500 },
+	[DISP_TV_MOD_1080P_24HZ_3D_FP] =	{ "1080p 24 Hz 3D", 1920, 1080, 24, 0, 148500 },
+	[DISP_TV_MOD_720P_50HZ_3D_FP] =	{ "720p 50 Hz 3D", 1280, 720, 50, 0, 148500 },
+	[DISP_TV_MOD_720P_60HZ_3D_FP] =	{ "720p 60 Hz 3D", 1280, 720, 60, 0, 148500 },
+	// Non-CEA modes of kernels patched as described above. The header of such a kernel only
+	// raises DISP_TV_MODE_NUM, so these have no names there; with a standard header they are
+	// beyond MODE_COUNT, and a modes file can add them.
+	[26] =							{ "1360x768 60 Hz", 1360, 768, 60, 0, 85500 },
+	[27] =							{ "1280x1024 60 Hz", 1280, 1024, 60, 0, 108000 },
+	[28] =							{ "1680x1050 60 Hz", 1680, 1050, 60, 0, 146000 }
+};
+
+// The mode numbers of the display driver header must fit into the table, and the header must have
+// at least the standard modes. Modes of a patched kernel that are not in the table need a modes
+// file (see --modes).
+typedef char check_mode_table[DISP_TV_MODE_NUM <= MAX_MODES &&
+	DISP_TV_MOD_720P_60HZ_3D_FP < DISP_TV_MODE_NUM ? 1 : - 1];
+
+int nu_modes = MODE_COUNT;
+
+// Returns whether a mode number has a mode.
+
+static int mode_valid(int mode) {
+	return mode >= 0 && mode < nu_modes && mode_timing[mode].width > 0;
+}
+
+// Returns the number of pixels of a mode.
+
+static int mode_size(int mode) {
+	return mode_timing[mode].width * mode_timing[mode].height;
+}
+
+// Load custom modes from a file. Each line is
+//	<number> <width>x<height> <refresh>[i] <pixel clock in MHz> <name>
+// for example "29 1440x900 60 106.5 1440x900 60 Hz", with "i" after the refresh rate for an
+// interlaced mode. A mode number that already has a mode replaces it. Empty lines and lines
+// starting with '#' are skipped. Returns -1 if the file has an invalid line or can't be read,
+// unless it doesn't exist and must_exist is zero.
+
+static int load_modes_file(const char *file, int must_exist) {
+	char line[256], refresh[16];
+	FILE *f;
+	int line_number = 0;
+	f = fopen(file, "r");
+	if (f == NULL) {
+		if (errno == ENOENT && !must_exist)
+			return 0;
+		fprintf(stderr, "Error: could not open modes file %s: %s\n", file, strerror(errno));
+		return - 1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		struct mode_timing *m;
+		char *name, *end;
+		double pixel_clock;
+		int mode, width, height, name_offset = 0;
+		line_number++;
+		end = line + strcspn(line, "\r\n");
+		*end = '\0';
+		name = line + strspn(line, " \t");
+		if (*name == '\0' || *name == '#')
+			continue;
+		if (sscanf(line, "%d %dx%d %15s %lf %n", &mode, &width, &height, refresh, &pixel_clock,
+		&name_offset) != 5 || name_offset == 0 || line[name_offset] == '\0' || mode < 0 ||
+		mode >= MAX_MODES || width <= 0 || height <= 0 || atoi(refresh) <= 0 || pixel_clock <= 0) {
+			fprintf(stderr, "Error: invalid mode on line %d of %s.\n", line_number, file);
+			fclose(f);
+			return - 1;
+		}
+		m = &mode_timing[mode];
+		m->name = strdup(line + name_offset);
+		m->width = width;
+		m->height = height;
+		m->refresh = atoi(refresh);
+		m->interlaced = refresh[strlen(refresh) - 1] == 'i';
+		m->pixel_clock = pixel_clock * 1000 + 0.5;
+		if (mode >= nu_modes)
+			nu_modes = mode + 1;
+	}
+	fclose(f);
+	return 0;
+}
+
+#ifndef A10DISP_SIM_ONLY
+
+// The real backend, which uses the sunxi display driver ioctls on /dev/disp and /dev/fb0-1.
+
 static int fd_disp;
 static int fd_fb[2];
-static int nu_framebuffer_buffers = DEFAULT_NUMBER_OF_FRAMEBUFFER_BUFFERS;
 
-static const char *mode_str[MODE_COUNT] = {
-	"480i",
-	"576i",
-	"480p",
-	"576p",
-	"720p 50Hz",
-	"720p 60Hz",
- 	"1080i 50 Hz",
-	"1080i 60 Hz",
-	"1080p 24 Hz",
-	"1080p 50 Hz",
-	"1080p 60 Hz",
-	"PAL",
-	"PAL SVIDEO",
-	"",
-	"NTSC",
-	"NTSC SVIDEO",
-	"",
-	"PAL_M",
-	"PAL_M SVIDEO",
-	"",
-	"PAL_NC",
-	"PAL_NC SVIDEO",
-	"",
-	"1080p 24 Hz 3D",
-	"720p 50 Hz 3D",
-	"720p 60 Hz 3D",
-	"1360x768 60 Hz",
-	"1280x1024 60 Hz",
-	"1680x1050 60 Hz"
+static int sunxi_open(void) {
+	int i;
+	fd_disp = open("/dev/disp", O_RDWR);
+	if (fd_disp == -1) {
+		fprintf(stderr, "Error: Failed to open /dev/disp: %s\n",
+			strerror(errno));
+		fprintf(stderr, "Are you root?\n");
+		return - 1;
+	}
+	for (i = 0; i < 2; i++) {
+		char s[16];
+		sprintf(s, "/dev/fb%d", i);
+		fd_fb[i] = open(s, O_RDWR);
+		if (fd_fb[i] == -1) {
+			fprintf(stderr, "Error: Failed to open /dev/fb%d: %s\n", i, strerror(errno));
+			return - 1;
+		}
+	}
+	return 0;
+}
+
+static void sunxi_close(void) {
+	close(fd_fb[1]);
+	close(fd_fb[0]);
+	close(fd_disp);
+}
+
+static int sunxi_disp_ioctl(unsigned int cmd, unsigned long *args) {
+	return ioctl(fd_disp, cmd, args);
+}
+
+static int sunxi_fb_ioctl(int fb, unsigned long cmd, void *arg) {
+	return ioctl(fd_fb[fb], cmd, arg);
+}
+
+static int sunxi_fbset(int fb, const char *command, int width, int height, int bytes_per_pixel) {
+	return system(command);
+}
+
+static void *sunxi_fb_mmap(int fb, size_t length) {
+	return mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd_fb[fb], 0);
+}
+
+static void sunxi_fb_munmap(int fb, void *address, size_t length) {
+	munmap(address, length);
+}
+
+static struct disp_backend sunxi_backend = {
+	"sunxi",
+	sunxi_open,
+	sunxi_close,
+	sunxi_disp_ioctl,
+	sunxi_fb_ioctl,
+	sunxi_fbset,
+	NULL,
+	sunxi_fb_mmap,
+	sunxi_fb_munmap
 };
 
-static int mode_size[MODE_COUNT] = {
-	640 * 480, 720 * 576, 640 * 480, 720 * 576, 1280 * 720, 1280 * 720, 1920 * 1080, 1920 * 1080, 1920 * 1080, 1920 * 1080, 1920 * 1080,
-	720 * 576, 720 * 576, 0, 640 * 480, 640 * 480, 0, 720 * 576, 720 * 576, 0, 720 * 576, 720 * 576, 0, 1920 * 1080, 1280 * 720, 1280 * 720,
-	1360 * 768, 1280 * 1024, 1680 * 1050
+#endif
+
+// The framebuffer layer of each screen, cached for the duration of a command: the layer handle,
+// the layer parameters and the layer framebuffer are each fetched from the driver once. Changes
+// are made to a copy of the parameters and written back with a single LAYER_SET_PARA, which is
+// skipped when nothing changed. Calls that change the layer geometry (HDMI_SET_MODE,
+// FBIOPUT_VSCREENINFO, FBIOPAN_DISPLAY and fbset) invalidate the cached parameters.
+struct layer_cache {
+	int handle_valid;
+	int info_valid;
+	int fb_valid;
+	int handle;
+	__disp_layer_info_t info;
+	__disp_fb_t fb;
 };
 
-static int mode_width[MODE_COUNT] = { 640, 720, 640, 720, 1280, 1280, 1920, 1920, 1920, 1920, 1920, 720, 720, 0, 640, 640, 720, 720, 0, 720, 720, 0, 1920, 1280,
-	1280, 1360, 1280, 1680 };
+static struct layer_cache layer_cache[2];
+// Number of display driver and framebuffer ioctls of the current command, and the number of
+// ioctls saved by the layer cache (shown with -v). They are updated atomically because both screens
+// may be changed at the same time by different threads.
+static int nu_disp_ioctls, nu_fb_ioctls, nu_saved_ioctls;
+
+static void count_saved_ioctls(int n) {
+	__sync_fetch_and_add(&nu_saved_ioctls, n);
+}
+
+// Invalidate the cached layer parameters of a screen (-1 for both screens). With handle set, the
+// layer handle is fetched again too.
+
+static void invalidate_layer_cache(int screen, int handle) {
+	int s;
+	for (s = 0; s <= 1; s++)
+		if (screen < 0 || s == screen) {
+			layer_cache[s].info_valid = 0;
+			layer_cache[s].fb_valid = 0;
+			if (handle)
+				layer_cache[s].handle_valid = 0;
+		}
+}
+
+static int disp_ioctl(unsigned int cmd, unsigned long *args) {
+	int screen = args[0];
+	int ret = backend->disp_ioctl(cmd, args);
+	__sync_fetch_and_add(&nu_disp_ioctls, 1);
+	if (cmd == DISP_CMD_HDMI_SET_MODE)
+		invalidate_layer_cache(screen, 0);
+	return ret;
+}
+
+static int fb_ioctl(int fb, unsigned long cmd, void *arg) {
+	int ret = backend->fb_ioctl(fb, cmd, arg);
+	__sync_fetch_and_add(&nu_fb_ioctls, 1);
+	if (cmd == FBIOPUT_VSCREENINFO || cmd == FBIOPAN_DISPLAY)
+		invalidate_layer_cache(fb, 0);
+	return ret;
+}
+
+// Start counting the ioctls of a command, with an empty layer cache.
+
+static void begin_command_ioctls(void) {
+	invalidate_layer_cache(- 1, 1);
+	nu_disp_ioctls = 0;
+	nu_fb_ioctls = 0;
+	nu_saved_ioctls = 0;
+}
+
+static void show_command_ioctls(void) {
+	if (verbose)
+		printf("%d ioctls (%d display driver, %d framebuffer), %d saved by the layer cache.\n",
+			nu_disp_ioctls + nu_fb_ioctls, nu_disp_ioctls, nu_fb_ioctls, nu_saved_ioctls);
+}
+
+static void close_backend(void) {
+	backend->close();
+}
+
+// When running as daemon, a command that fails jumps back to the request handler instead of
+// exiting the process. These are per thread, so that a failure while changing a screen in its own
+// thread returns to that thread.
+static __thread jmp_buf *command_jmp_buf;
+static __thread int command_exit_code;
+// Library error code (A10DISP_ERROR_*) of the reason a command failed, or 0.
+static int command_error;
+
+// Set by SIGINT and SIGTERM in the daemon and monitor commands.
+static volatile sig_atomic_t stop_requested = 0;
 
-static int mode_height[MODE_COUNT] = { 480, 576, 480, 576, 720, 720, 1080, 1080, 1080, 1080, 1080, 576, 576, 0, 480, 480, 576, 576, 0, 576, 576, 0, 1080, 720,
-	720, 1360, 1024, 1050 };
+static void stop_signal_handler(int sig) {
+	stop_requested = 1;
+}
+
+// Terminate the current command with the given exit code.
+
+static void exit_command(int exit_code) {
+	if (exit_code != 0 && command_error == 0)
+		command_error = A10DISP_ERROR_DRIVER;
+	if (command_jmp_buf == NULL)
+		exit(exit_code);
+	command_exit_code = exit_code;
+	longjmp(*command_jmp_buf, 1);
+}
 
 static void usage(int argc, char *argv[]) {
 	int i;
-	printf("a10disp v0.6\n");
+	printf("a10disp v0.7\n");
 	printf("Usage: %s <options> <command>\n"
 		"Options:\n"
-		"--screen <number>\n"
-		"	Screen number to operate on. Must be 0 or 1. Default is 0.\n"
+		"--screen <number>|all\n"
+		"	Screen number to operate on. Must be 0 or 1. Default is 0. With all, the apply\n"
+		"	settings without a screen prefix apply to both screens, and switchtohdmi,\n"
+		"	changehdmimode, enablehdmi (and their force variants), changepixeldepth and\n"
+		"	displayoff change both screens like apply does.\n"
+		"--interleaved, --sequential, --concurrent\n"
+		"	How apply changes two screens that both need a display off/on cycle: both off, then\n"
+		"	both configured and on again in one thread (--interleaved, the default), one screen\n"
+		"	after the other (--sequential), or each screen in its own thread at the same time\n"
+		"	(--concurrent, experimental: only tested with --sim; interleaved with --trace,\n"
+		"	--record and --replay).\n"
 		"--nodoublebuffer\n"
 		"	When checking the framebuffer size, assume no double buffering will be used.\n"
 		"	Use this only if double buffering won't be required (you don't use Mali).\n"
+		"--buffers <n>\n"
+		"	Set the virtual height of the console framebuffer to n times its height when changing\n"
+		"	it (for example 3 for triple buffering), and check that n buffers fit into the\n"
+		"	framebuffer memory. Also sets the number of buffers of the framebuffer size check.\n"
+		"--panscroll\n"
+		"	When changing the console framebuffer, set its virtual height to all lines that fit\n"
+		"	into the framebuffer memory, so that the console scrolls by panning (or wrapping when\n"
+		"	the driver supports it) instead of copying the screen.\n"
 		"--noscaler\n"
 		"	Do not enable scaler mode when setting 32bpp modes larges than size 1280x1024.\n"
 		"	While scaler mode can help reduce some artifacts related to scanout buffer underrun\n"
 		"	(for example wavy screen during Mali operation) on systems with a limited number of\n"
 		"	scaler layers (such as those with an A13 chip), using scaler mode may make other\n"
 		"	applications using scaler mode, such as accelerated video or video overlay impossible.\n"
+		"--sim <spec>\n"
+		"	Use a simulated display driver instead of /dev/disp and /dev/fb0-1. <spec> is a\n"
+		"	comma-separated list of settings, or \"default\". See README for details.\n"
+		"--drambandwidth <MB/s>\n"
+		"	DRAM bandwidth used by the bandwidth command. Default is %d MB/s.\n"
+		"--modes <file>\n"
+		"	Load custom modes of a kernel built with extra modes from file instead of\n"
+		"	" DEFAULT_MODES_FILE ". Each line is <number> <width>x<height> <refresh>[i]\n"
+		"	<pixel clock in MHz> <name>. See README.\n"
+		"--modecache <file>\n"
+		"	File used to cache the HDMI modes supported by the display. Default is\n"
+		"	" DEFAULT_MODE_CACHE_FILE ". Use \"none\" to always probe the modes.\n"
+		"--refresh-modes\n"
+		"	Probe the supported HDMI modes again instead of using the mode cache.\n"
+		"--edid <file>\n"
+		"	EDID of the connected display, used to recognize the display for the mode cache,\n"
+		"	for automode native and for the refresh rate and size of the EDID mode.\n"
+		"	Default is " DEFAULT_EDID_FILE ".\n"
+		"--bench <n>\n"
+		"	Run the command n times and show the minimum, median and 99th percentile time of\n"
+		"	each phase (mode support check, framebuffer check, scaler setup, HDMI_SET_MODE,\n"
+		"	console resize, time the display is blank, total). Mainly useful with --sim, which\n"
+		"	restores the initial state before each run.\n"
+		"--fbset\n"
+		"	Change the console framebuffer size and pixel depth by running fbset instead of\n"
+		"	using FBIOPUT_VSCREENINFO directly.\n"
+		"--comparefbset\n"
+		"	After changing the console framebuffer, apply the same change with fbset and report\n"
+		"	the time saved by not using fbset.\n"
+		"--hotplug <source>\n"
+		"	Source of HDMI hot plug events for the monitor command: netlink (kernel uevents,\n"
+		"	the default), sysfs[:<file>] (poll the HDMI switch state, by default\n"
+		"	/sys/class/switch/hdmi/state) or feeder[:<file>] (read \"connect\" and\n"
+		"	\"disconnect\" lines from a file, FIFO or standard input).\n"
+		"--renderscale <factor>\n"
+		"	With the HDMI commands (switchtohdmi, changehdmimode, enablehdmi, automode, apply),\n"
+		"	use a console framebuffer that is smaller than the display by factor (for example\n"
+		"	0.67 or 2/3; 1.5 is taken as 2/3), upscaled to the display by the scaler. The width is\n"
+		"	aligned to a multiple of 16. Saves framebuffer memory and scanout bandwidth.\n"
+		"--preserve\n"
+		"	When only the pixel depth of the console framebuffer changes, convert its contents\n"
+		"	to the new pixel depth so that they are preserved.\n"
+		"--dither\n"
+		"	Like --preserve, and use ordered dithering when converting to 16bpp.\n"
+		"--nosimd\n"
+		"	Use the scalar conversion code instead of the SSE2 or NEON code.\n"
+		"-v, --verbose\n"
+		"	Show the number of display driver and framebuffer ioctls made by the command, and\n"
+		"	the number saved by caching the layer parameters.\n"
+		"--trace <file>\n"
+		"	Record every display driver and framebuffer call (ioctls, fbset, mmap) with its\n"
+		"	arguments, return value and duration in file, in Chrome trace event format (open it\n"
+		"	with chrome://tracing or Perfetto), and print the number of calls and the time taken\n"
+		"	per call after each command.\n"
+		"--record <file>\n"
+		"	Record every display driver and framebuffer call with its arguments, result,\n"
+		"	duration and the data returned by the driver in file (compact binary format).\n"
+		"--replay <file>\n"
+		"	Instead of /dev/disp and /dev/fb0-1, serve the display driver calls from a recording\n"
+		"	made with --record, with the original results and timings. Use the same command and\n"
+		"	options (for example --modecache none) as the recorded run.\n"
+		"--cpu <n>\n"
+		"	Pin the fbbench command to CPU n.\n"
+		"--client\n"
+		"	Send the command to the a10disp daemon instead of executing it directly.\n"
+		"--socket <file>\n"
+		"	Unix socket of the daemon, used by the daemon command and implying --client for\n"
+		"	other commands. Default is " DEFAULT_SOCKET_FILE ".\n"
 		"Commands:\n"
 		"info\n"
 		"	Show information about the current mode on screens 0 and 1.\n"
@@ -148,7 +626,8 @@ static void usage(int argc, char *argv[]) {
 		"switchtolcd\n"
 		"	Switch output from HDMI to LCD. This changes the pixel depth to 32bpp.\n"
 		"changehdmimode mode_number [pixel_depth]\n"
-		"	Change HDMI mode to mode number. Pixel depth is optional.\n"
+		"	Change HDMI mode to mode number. Pixel depth is optional. Does nothing if the\n"
+		"	screen is already in this mode.\n"
 		"changehdmimodeforce mode_number [pixel_depth]\n"
 		"	Change HDMI mode to mode number even if the display driver reports the mode is not supported.\n"
 		"changepixeldepth [pixel_depth]\n"
@@ -163,12 +642,93 @@ static void usage(int argc, char *argv[]) {
 		"	Enable hardware scaler layer. Can be used with overscaned HDMI or non-square pixel lcd matrix.\n"
 		"	May cause VDPAU problems if resolution not devided by 16\n"
 		"disablescaler\n"
-		"	Disable hardware scaler layer.\n",
-		argv[0]);
+		"	Disable hardware scaler layer.\n"
+		"automode maxres [pixel_depth]\n"
+		"automode minbandwidth <width>x<height> [pixel_depth]\n"
+		"automode refresh <hz> [pixel_depth]\n"
+		"automode native [pixel_depth]\n"
+		"	Select the best supported HDMI mode that fits into the framebuffer and switch to it\n"
+		"	(from LCD, HDMI or disabled output). maxres selects the mode with the highest\n"
+		"	resolution, minbandwidth the mode with the lowest scanout bandwidth that has at least\n"
+		"	width x height pixels, refresh the highest resolution mode with the given refresh rate.\n"
+		"	native selects the native mode of the display from its EDID (see --edid) without\n"
+		"	probing the modes, and falls back to maxres when the EDID has no native HDMI mode.\n"
+		"	If pixel_depth is not given, 32bpp is preferred when it fits for maxres and refresh,\n"
+		"	and 16bpp is used for minbandwidth.\n"
+		"apply [<screen>:]<setting>=<value> ...\n"
+		"	Bring one or both screens into the given state with a single display off/on cycle and a\n"
+		"	single console framebuffer change per screen. Settings are output=hdmi|lcd|off,\n"
+		"	mode=<mode_number>|edid, depth=16|32, src=<width>x<height> (framebuffer size),\n"
+		"	scn=<width>x<height> (scaled size on the display), scaler=on|off and virtual=<height>\n"
+		"	(virtual height of the console framebuffer). Settings apply to the screen given with\n"
+		"	--screen unless prefixed with the screen number (0: or 1:). Steps that don't change\n"
+		"	anything are skipped.\n"
+		"monitor [mode_number|auto] [pixel_depth]\n"
+		"	Wait for HDMI hot plug events. When a display is connected, switch from LCD to HDMI\n"
+		"	with the given mode, or the native mode of the display from its EDID (auto, the\n"
+		"	default; the highest resolution mode that fits if the native mode doesn't).\n"
+		"	When it is disconnected, switch back to LCD.\n"
+		"daemon [socket_file]\n"
+		"	Run as daemon (also done when started as a10dispd), keeping the display driver\n"
+		"	open and executing the commands sent with --client or --socket.\n"
+		"convertbench [<width>x<height>] [runs]\n"
+		"	Time the framebuffer content conversion kernels (scalar and SIMD) on a frame of the\n"
+		"	given size (default 1920x1080). Doesn't need the display driver.\n"
+		"fbbench [frames] [<device>|<file>[:<width>x<height>x<bpp>]]\n"
+		"	Measure the sequential write, read, blit (copy from system memory) and fill\n"
+		"	throughput of the framebuffer in MB/s and frames/s at the current mode, with the\n"
+		"	scalar and the SIMD code, over the given number of frames (default 20). Overwrites\n"
+		"	the console contents. Instead of the screen's framebuffer, any framebuffer device or\n"
+		"	a file-backed buffer (default 1920x1080x32) can be given, which doesn't need the\n"
+		"	display driver and gives a baseline for system memory.\n"
+		"membench [threads] [<setting>[,<setting>...]|current] ...\n"
+		"	Measure the memory bandwidth left to applications (STREAM copy, scale, add and triad\n"
+		"	on 1 up to threads threads, default the number of CPUs) in each of the given display\n"
+		"	configurations, which are applied like the settings of apply (for example\n"
+		"	mode=10,depth=32,scaler=on). The output and mode default to the initial ones. Without\n"
+		"	configurations, output=off, depth=16,scaler=off, depth=32,scaler=off and\n"
+		"	depth=32,scaler=on are measured. The initial state is restored afterwards.\n"
+		"flipbench [flips] [fill]\n"
+		"	Flip between the buffers of the console framebuffer (see --buffers) with\n"
+		"	FBIOPAN_DISPLAY, waiting for the vertical sync after each flip, and report the pan\n"
+		"	time, the flip latency and the number of missed vsyncs (default 300 flips). With\n"
+		"	fill, each buffer is filled before it is shown.\n"
+		"consolebench [lines] [tty|file]\n"
+		"	Write the given number of full-width text lines (default 2000) to a terminal (default\n"
+		"	/dev/tty0, the current virtual console) and report the console throughput in lines/s.\n"
+		"	A file outside /dev is created or truncated and gives a baseline without the console.\n"
+		"	Doesn't need the display driver.\n"
+		"recorddiff <file> [<file2>]\n"
+		"	Show the number of calls and the total and mean time per call of a recording made\n"
+		"	with --record, side by side with a second recording when given.\n"
+		"edid [<file> ...]\n"
+		"	Show the display information, the timings and refresh rates, the HDMI modes they\n"
+		"	correspond to and the native mode of an EDID (binary or hexadecimal text) for each\n"
+		"	file, or the EDID of the connected display (see --edid). Doesn't need the display driver.\n"
+		"save <file>\n"
+		"	Save the state of both screens (output, HDMI mode, pixel depth, console framebuffer\n"
+		"	size and virtual height, scaler and layer windows) to a versioned text file.\n"
+		"restore <file>\n"
+		"	Restore a state saved with save, like apply without checking mode support: only the\n"
+		"	steps that change something are performed and nothing is done when the display is\n"
+		"	already in the saved state.\n"
+		"planmem [<setting>[,<setting>...]] ...\n"
+		"	Compute the smallest framebuffer memory reservation (sunxi_fb_mem_reserve) that\n"
+		"	covers all the given configurations of screens 0 and 1, given like the settings of\n"
+		"	apply plus buffers=<n> (default 2, see --buffers), for example\n"
+		"	mode=10,depth=32 mode=5,depth=32,buffers=3 1:output=lcd,1:src=800x480. The\n"
+		"	console size of a screen without configurations or with the output off is kept. Also\n"
+		"	shows the framebuffer memory of each /dev/fbN unused in the current configuration.\n"
+		"bandwidth\n"
+		"	Show the memory bandwidth used for scanout by screens 0 and 1 and the fraction of the\n"
+		"	DRAM bandwidth it takes, and rank the supported HDMI modes and pixel depths by\n"
+		"	scanout bandwidth.\n",
+		argv[0], DEFAULT_DRAM_BANDWIDTH);
 	printf("\nHDMI/TV mode numbers:\n");
-	for (i = 0; i < MODE_COUNT; i++)
-		if (strlen(mode_str[i]) > 0)
-			printf("%2d      %s\n", i, mode_str[i]);
+	for (i = 0; i < nu_modes; i++)
+		if (mode_valid(i))
+			printf("%2d      %-20s %4d x %-4d %6.2f MHz\n", i, mode_timing[i].name, mode_timing[i].width,
+				mode_timing[i].height, mode_timing[i].pixel_clock / 1000.0);
 }
 
 
@@ -206,265 +766,1068 @@ static char *layer_mode_str(__disp_layer_work_mode_t mode) {
 	}
 }
 
+static double get_time_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Time spent in each phase of a command, used by the --bench option. Phases can occur more
+// than once during a command (for example when the console is changed twice), in which case
+// the times are added.
+
+#define PHASE_SUPPORT_CHECK		0
+#define PHASE_FRAMEBUFFER_CHECK	1
+#define PHASE_SCALER			2
+#define PHASE_SET_MODE			3
+#define PHASE_CONSOLE			4
+#define PHASE_CONVERT			5
+#define PHASE_BLACKOUT			6
+#define PHASE_TOTAL				7
+#define NU_PHASES				8
+
+static const char *phase_str[NU_PHASES] = {
+	"support check",
+	"framebuffer check",
+	"scaler setup",
+	"HDMI_SET_MODE",
+	"console resize",
+	"content conversion",
+	"blackout",
+	"total"
+};
+
+static double phase_time[NU_PHASES];
+static __thread double phase_start_time[NU_PHASES];
+static pthread_mutex_t phase_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int phase_seen[NU_PHASES];
+
+static void reset_phases(void) {
+	memset(phase_time, 0, sizeof(phase_time));
+	memset(phase_seen, 0, sizeof(phase_seen));
+}
+
+static void phase_begin(int phase) {
+	phase_start_time[phase] = get_time_ms();
+}
+
+static void phase_end(int phase) {
+	double t = get_time_ms() - phase_start_time[phase];
+	pthread_mutex_lock(&phase_mutex);
+	phase_time[phase] += t;
+	phase_seen[phase] = 1;
+	pthread_mutex_unlock(&phase_mutex);
+	trace_event(phase_str[phase], "phase", phase_start_time[phase], t);
+}
+
+// Cache of supported HDMI modes. For each screen, the cache holds a fingerprint of the display
+// driver and connected display and a bitmap of the modes that have been probed and the modes that
+// are supported. The fingerprint is a hash of the backend, the driver version, the HDMI hot plug
+// state and the EDID if available. The cache is read with a single read() and replaced atomically
+// by writing a temporary file and renaming it.
+
+#define MODE_CACHE_MAGIC	0x4D303141
+#define MODE_CACHE_VERSION	1
+
+struct mode_cache {
+	uint32_t magic;
+	uint32_t version;
+	struct {
+		uint64_t fingerprint;
+		uint64_t probed;
+		uint64_t supported;
+	} screen[2];
+};
+
+static const char *mode_cache_file = DEFAULT_MODE_CACHE_FILE;
+static const char *edid_file = DEFAULT_EDID_FILE;
+static int refresh_modes = 0;
+static int driver_version;
+static struct mode_cache mode_cache;
+static int mode_cache_loaded = 0;
+static int mode_cache_dirty = 0;
+// For each screen: 0 if the fingerprint hasn't been checked yet, 1 if the cache is used and
+// -1 if it isn't (no display connected).
+static int mode_cache_screen_state[2];
+
+static uint64_t fnv1a_hash(uint64_t hash, const void *data, size_t size) {
+	const unsigned char *p = data;
+	size_t i;
+	for (i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+static void save_mode_cache(void) {
+	char tmp_file[256];
+	int fd;
+	if (!mode_cache_dirty)
+		return;
+	snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", mode_cache_file);
+	fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return;
+	if (write(fd, &mode_cache, sizeof(mode_cache)) != sizeof(mode_cache) || fsync(fd) < 0) {
+		close(fd);
+		unlink(tmp_file);
+		return;
+	}
+	close(fd);
+	if (rename(tmp_file, mode_cache_file) < 0)
+		unlink(tmp_file);
+	mode_cache_dirty = 0;
+}
+
+static void load_mode_cache(void) {
+	int fd;
+	mode_cache_loaded = 1;
+	memset(&mode_cache, 0, sizeof(mode_cache));
+	if (!refresh_modes) {
+		fd = open(mode_cache_file, O_RDONLY);
+		if (fd >= 0) {
+			if (read(fd, &mode_cache, sizeof(mode_cache)) != sizeof(mode_cache) ||
+			mode_cache.magic != MODE_CACHE_MAGIC || mode_cache.version != MODE_CACHE_VERSION)
+				memset(&mode_cache, 0, sizeof(mode_cache));
+			close(fd);
+		}
+	}
+	mode_cache.magic = MODE_CACHE_MAGIC;
+	mode_cache.version = MODE_CACHE_VERSION;
+	// With --refresh-modes, the probed modes are always written back.
+	mode_cache_dirty = refresh_modes;
+	atexit(save_mode_cache);
+}
+
+static void check_mode_cache_fingerprint(int screen) {
+	unsigned long args[4] = { 0 };
+	unsigned char edid[512];
+	uint64_t fingerprint = 0xCBF29CE484222325ULL;
+	int hpd, mode_count = nu_modes;
+	int fd, n;
+	if (!mode_cache_loaded)
+		load_mode_cache();
+	args[0] = screen;
+	hpd = disp_ioctl(DISP_CMD_HDMI_GET_HPD_STATUS, args);
+	if (hpd == 0) {
+		// Nothing is connected, the modes reported now say nothing about the next display.
+		mode_cache_screen_state[screen] = - 1;
+		return;
+	}
+	fingerprint = fnv1a_hash(fingerprint, backend->name, strlen(backend->name));
+	fingerprint = fnv1a_hash(fingerprint, &driver_version, sizeof(driver_version));
+	fingerprint = fnv1a_hash(fingerprint, &mode_count, sizeof(mode_count));
+	fd = open(edid_file, O_RDONLY);
+	if (fd >= 0) {
+		n = read(fd, edid, sizeof(edid));
+		if (n > 0)
+			fingerprint = fnv1a_hash(fingerprint, edid, n);
+		close(fd);
+	}
+	if (mode_cache.screen[screen].fingerprint != fingerprint) {
+		mode_cache.screen[screen].fingerprint = fingerprint;
+		mode_cache.screen[screen].probed = 0;
+		mode_cache.screen[screen].supported = 0;
+		mode_cache_dirty = 1;
+	}
+	mode_cache_screen_state[screen] = 1;
+}
+
+// Returns the result of DISP_CMD_HDMI_SUPPORT_MODE: 1 if the mode is supported by the display,
+// 0 if not. The result is taken from the mode cache when possible.
+
+static int hdmi_mode_supported(int screen, int mode) {
+	unsigned long args[4] = { 0 };
+	uint64_t bit = 1ULL << (mode & 63);
+	int use_cache;
+	int ret;
+	phase_begin(PHASE_SUPPORT_CHECK);
+	use_cache = mode_cache_file != NULL && mode < 64;
+	if (use_cache) {
+		if (mode_cache_screen_state[screen] == 0)
+			check_mode_cache_fingerprint(screen);
+		use_cache = mode_cache_screen_state[screen] == 1;
+	}
+	if (use_cache && (mode_cache.screen[screen].probed & bit)) {
+		phase_end(PHASE_SUPPORT_CHECK);
+		return (mode_cache.screen[screen].supported & bit) != 0;
+	}
+	args[0] = screen;
+	args[1] = mode;
+	ret = disp_ioctl(DISP_CMD_HDMI_SUPPORT_MODE, args);
+	if (use_cache && ret >= 0) {
+		mode_cache.screen[screen].probed |= bit;
+		if (ret == 1)
+			mode_cache.screen[screen].supported |= bit;
+		mode_cache_dirty = 1;
+	}
+	phase_end(PHASE_SUPPORT_CHECK);
+	return ret;
+}
+
+// The EDID of the connected display (edid_file), parsed when first needed. edid_state is 0 if it
+// hasn't been read yet, 1 if it has been parsed and -1 if it isn't available.
+static struct edid_info edid_info;
+static int edid_state = 0;
+
+static struct edid_info *get_edid_info(void) {
+	unsigned char data[EDID_MAX_SIZE];
+	int size;
+	if (edid_state == 0) {
+		edid_state = - 1;
+		size = edid_read(edid_file, data, sizeof(data));
+		if (size > 0 && edid_parse(data, size, &edid_info) == 0)
+			edid_state = 1;
+	}
+	return edid_state == 1 ? &edid_info : NULL;
+}
+
+// Returns the HDMI mode of an EDID timing, or -1 if the display driver has no such mode. The TV
+// and 3D modes are not considered. Interlaced timings with pixel repetition (480i and 576i in
+// a detailed timing) are twice as wide as the mode.
+
+static int edid_timing_mode(const struct edid_timing *t) {
+	int mode;
+	for (mode = 0; mode < nu_modes; mode++) {
+		if (!mode_valid(mode))
+			continue;
+		if (mode >= DISP_TV_MOD_PAL && mode <= DISP_TV_MOD_720P_60HZ_3D_FP)
+			continue;
+		if (mode_timing[mode].height != t->height || mode_timing[mode].refresh != t->refresh ||
+		mode_timing[mode].interlaced != t->interlaced)
+			continue;
+		if (mode_timing[mode].width == t->width ||
+		(t->interlaced && mode_timing[mode].width * 2 == t->width))
+			return mode;
+	}
+	return - 1;
+}
+
+// Returns the HDMI mode of the native timing of an EDID: the preferred timing, or a CTA video
+// format marked native when the preferred timing has no HDMI mode. Returns -1 if there is none.
+
+static int edid_native_mode(const struct edid_info *info) {
+	int i, mode;
+	for (i = 0; i < info->nu_timings; i++)
+		if (info->timing[i].preferred) {
+			mode = edid_timing_mode(&info->timing[i]);
+			if (mode >= 0)
+				return mode;
+		}
+	for (i = 0; i < info->nu_timings; i++)
+		if (info->timing[i].native) {
+			mode = edid_timing_mode(&info->timing[i]);
+			if (mode >= 0)
+				return mode;
+		}
+	return - 1;
+}
+
+// Returns the preferred timing of the connected display, or NULL if the EDID isn't available.
+
+static const struct edid_timing *get_edid_preferred_timing(void) {
+	struct edid_info *info = get_edid_info();
+	int i;
+	if (info == NULL)
+		return NULL;
+	for (i = 0; i < info->nu_timings; i++)
+		if (info->timing[i].preferred)
+			return &info->timing[i];
+	return NULL;
+}
+
+// Show the contents of an EDID file and the HDMI modes its timings correspond to. Doesn't need
+// the display driver.
+
+static int show_edid(const char *file) {
+	unsigned char data[EDID_MAX_SIZE];
+	struct edid_info parsed_info;
+	struct edid_info *info = &parsed_info;
+	int refresh_seen[256];
+	int size, i, mode;
+	size = edid_read(file, data, sizeof(data));
+	if (size < 0) {
+		fprintf(stderr, "Error: could not read %s: %s\n", file, strerror(errno));
+		return 1;
+	}
+	if (edid_parse(data, size, info) < 0) {
+		printf("%s: not a valid EDID (%d bytes).\n", file, size);
+		return 1;
+	}
+	printf("%s: EDID version %d.%d, %d bytes, %d extension block(s), %d CTA-861.\n", file,
+		info->version, info->revision, size, info->nu_extensions, info->nu_cta_blocks);
+	if (info->checksum_errors > 0)
+		printf("Warning: %d block(s) with a wrong checksum.\n", info->checksum_errors);
+	if ((info->nu_extensions + 1) * 128 > size)
+		printf("Warning: %d extension block(s) missing.\n", info->nu_extensions + 1 - size / 128);
+	printf("Display: %s \"%s\", product 0x%04X, serial %u, %d, ", info->manufacturer, info->name,
+		info->product, info->serial, info->year);
+	if (info->width_cm > 0 && info->height_cm > 0)
+		printf("%d x %d cm, ", info->width_cm, info->height_cm);
+	printf("%s.\n", info->hdmi ? "HDMI" : "DVI");
+	if (info->max_vrate > 0)
+		printf("Range limits: %d-%d Hz vertical, %d-%d kHz horizontal, pixel clock up to %d MHz.\n",
+			info->min_vrate, info->max_vrate, info->min_hrate, info->max_hrate, info->max_pixel_clock);
+	printf("Timings:\n");
+	printf("Source        Size         Refresh  Pixel clock  Mode\n");
+	for (i = 0; i < info->nu_timings; i++) {
+		const struct edid_timing *t = &info->timing[i];
+		char size_str[24];
+		snprintf(size_str, sizeof(size_str), "%dx%d%s", t->width, t->height, t->interlaced ? "i" : "");
+		printf("%-12s  %-12s %4d Hz  ", edid_source_name(t->source), size_str, t->refresh);
+		if (t->pixel_clock > 0)
+			printf("%7.2f MHz  ", t->pixel_clock / 1000.0);
+		else
+			printf("             ");
+		mode = edid_timing_mode(t);
+		if (mode >= 0)
+			printf("%2d (%s)", mode, mode_timing[mode].name);
+		else
+			printf("-");
+		if (t->vic > 0)
+			printf(", VIC %d", t->vic);
+		if (t->preferred)
+			printf(", preferred");
+		if (t->native)
+			printf(", native");
+		printf("\n");
+	}
+	memset(refresh_seen, 0, sizeof(refresh_seen));
+	printf("Refresh rates:");
+	for (i = 0; i < info->nu_timings; i++)
+		if (!info->timing[i].interlaced && info->timing[i].refresh < 256 &&
+		!refresh_seen[info->timing[i].refresh]) {
+			refresh_seen[info->timing[i].refresh] = 1;
+			printf(" %d", info->timing[i].refresh);
+		}
+	printf(" Hz.\n");
+	printf("HDMI modes:");
+	for (mode = 0; mode < nu_modes; mode++)
+		for (i = 0; i < info->nu_timings; i++)
+			if (edid_timing_mode(&info->timing[i]) == mode) {
+				printf(" %d", mode);
+				break;
+			}
+	printf("\n");
+	mode = edid_native_mode(info);
+	if (mode >= 0)
+		printf("Native mode: %d (%s).\n", mode, mode_timing[mode].name);
+	else
+		printf("Native mode: none of the HDMI modes.\n");
+	return 0;
+}
+
+static int show_edid_files(int nu_files, char **files) {
+	int i, ret = 0;
+	if (nu_files == 0)
+		return show_edid(edid_file);
+	for (i = 0; i < nu_files; i++) {
+		if (i > 0)
+			printf("\n");
+		if (show_edid(files[i]) != 0)
+			ret = 1;
+	}
+	return ret;
+}
+
+// Set the color layout of the console framebuffer for the given pixel depth, equivalent
+// to the -depth and -rgba arguments passed to fbset.
+
+static void set_var_screeninfo_pixel_depth(struct fb_var_screeninfo *var, int bytes_per_pixel) {
+	memset(&var->red, 0, sizeof(var->red));
+	memset(&var->green, 0, sizeof(var->green));
+	memset(&var->blue, 0, sizeof(var->blue));
+	memset(&var->transp, 0, sizeof(var->transp));
+	var->bits_per_pixel = bytes_per_pixel * 8;
+	if (bytes_per_pixel == 2) {
+		var->red.offset = 11;
+		var->red.length = 5;
+		var->green.offset = 5;
+		var->green.length = 6;
+		var->blue.length = 5;
+		return;
+	}
+	var->red.offset = 16;
+	var->red.length = 8;
+	var->green.offset = 8;
+	var->green.length = 8;
+	var->blue.length = 8;
+	if (bytes_per_pixel == 4) {
+		var->transp.offset = 24;
+		var->transp.length = 8;
+	}
+}
+
+// Returns the virtual height of the console framebuffer for the given size and pixel depth: the
+// height itself, nu_framebuffer_buffers times it with --buffers, or as many lines as fit into the
+// framebuffer memory with --panscroll.
+
+static int console_virtual_height(int smem_len, int width, int height, int bytes_per_pixel) {
+	int virtual_height = height;
+	if (set_virtual_buffers)
+		virtual_height = height * nu_framebuffer_buffers;
+	if (pan_scroll && smem_len / (width * bytes_per_pixel) > virtual_height)
+		virtual_height = smem_len / (width * bytes_per_pixel);
+	return virtual_height;
+}
+
+// Run fbset to change the console framebuffer. This is the method used by earlier versions
+// of a10disp; it is used when the --fbset option is given. virtual_height is as for
+// set_framebuffer_console_virtual.
+
+static void run_fbset(int screen, int width, int height, int bytes_per_pixel, int virtual_height) {
+	char s[128];
+	int n;
+	n = sprintf(s, "fbset --all -fb /dev/fb%d", screen);
+	if (width > 0 && height > 0)
+		n += sprintf(s + n, " -xres %d -yres %d", width, height);
+	if (virtual_height > 0)
+		n += sprintf(s + n, " -vyres %d", virtual_height);
+	else
+	if (set_virtual_buffers || pan_scroll) {
+		struct fb_var_screeninfo var_screeninfo;
+		struct fb_fix_screeninfo fix_screeninfo;
+		fb_ioctl(screen, FBIOGET_VSCREENINFO, &var_screeninfo);
+		fb_ioctl(screen, FBIOGET_FSCREENINFO, &fix_screeninfo);
+		n += sprintf(s + n, " -vyres %d", console_virtual_height(fix_screeninfo.smem_len,
+			width > 0 ? width : var_screeninfo.xres_virtual, height > 0 ? height : var_screeninfo.yres,
+			bytes_per_pixel > 0 ? bytes_per_pixel : (var_screeninfo.bits_per_pixel + 7) / 8));
+	}
+	if (bytes_per_pixel == 4)
+		sprintf(s + n, " -depth 32 -rgba 8,8,8,8");
+	else
+	if (bytes_per_pixel == 3)
+		sprintf(s + n, " -depth 24 -rgba 8,8,8,0");
+	else
+	if (bytes_per_pixel == 2)
+		sprintf(s + n, " -depth 16 -rgba 5,6,5,0");
+	backend->fbset(screen, s, width, height, bytes_per_pixel);
+	invalidate_layer_cache(screen, 0);
+}
+
+// Convert the contents of the console framebuffer of the given screen to a new pixel depth, so
+// that they are still shown correctly after the pixel depth has been changed. This is only
+// done when the resolution doesn't change. The visible area and everything above it in the
+// virtual framebuffer is converted in place.
+
+static void convert_console_contents(int screen, int width, int height, int bytes_per_pixel) {
+	struct fb_var_screeninfo var_screeninfo;
+	struct fb_fix_screeninfo fix_screeninfo;
+	int previous_bytes_per_pixel, rows;
+	size_t length;
+	double start_time;
+	void *buffer;
+	if (fb_ioctl(screen, FBIOGET_VSCREENINFO, &var_screeninfo) < 0 ||
+	fb_ioctl(screen, FBIOGET_FSCREENINFO, &fix_screeninfo) < 0)
+		return;
+	previous_bytes_per_pixel = (var_screeninfo.bits_per_pixel + 7) / 8;
+	if (previous_bytes_per_pixel == bytes_per_pixel)
+		return;
+	if (width > 0 && height > 0 && (width != var_screeninfo.xres || height != var_screeninfo.yres ||
+	width != var_screeninfo.xres_virtual))
+		return;
+	rows = var_screeninfo.yoffset + var_screeninfo.yres;
+	length = (size_t)var_screeninfo.xres_virtual * rows * (bytes_per_pixel > previous_bytes_per_pixel ?
+		bytes_per_pixel : previous_bytes_per_pixel);
+	if (fix_screeninfo.line_length != var_screeninfo.xres_virtual * previous_bytes_per_pixel ||
+	length > fix_screeninfo.smem_len) {
+		printf("Console contents can't be converted to the new pixel depth.\n");
+		return;
+	}
+	buffer = backend->fb_mmap(screen, length);
+	if (buffer == MAP_FAILED) {
+		printf("Console contents can't be converted, mmap of /dev/fb%d failed: %s\n", screen,
+			strerror(errno));
+		return;
+	}
+	phase_begin(PHASE_CONVERT);
+	start_time = get_time_ms();
+	fbconvert_frame(buffer, var_screeninfo.xres_virtual, rows, previous_bytes_per_pixel, bytes_per_pixel,
+		dither_contents && bytes_per_pixel == 2, use_simd);
+	phase_end(PHASE_CONVERT);
+	printf("Console contents converted from %dbpp to %dbpp in %.2f ms (%s%s).\n", previous_bytes_per_pixel * 8,
+		bytes_per_pixel * 8, get_time_ms() - start_time,
+		use_simd && fbconvert_has_simd(previous_bytes_per_pixel, bytes_per_pixel) ? fbconvert_simd_name() :
+		"scalar",
+		dither_contents && bytes_per_pixel == 2 ? ", dithered" : "");
+	backend->fb_munmap(screen, buffer, length);
+}
+
+// Change the console framebuffer resolution and/or pixel depth of the given screen. If width or
+// height is zero, the resolution is not changed; if bytes_per_pixel is zero, the pixel depth is
+// not changed. If virtual_height is not zero, it is the virtual height of the console
+// framebuffer instead of the one given by console_virtual_height. Like "fbset --all", the change
+// is applied to all consoles using the framebuffer.
+
+static void set_framebuffer_console_virtual(int screen, int width, int height, int bytes_per_pixel,
+int virtual_height) {
+	struct fb_var_screeninfo var_screeninfo;
+	double start_time, native_time, fbset_time;
+	int ret;
+	if (preserve_contents && bytes_per_pixel > 0)
+		convert_console_contents(screen, width, height, bytes_per_pixel);
+	phase_begin(PHASE_CONSOLE);
+	start_time = get_time_ms();
+	if (use_fbset) {
+		run_fbset(screen, width, height, bytes_per_pixel, virtual_height);
+		phase_end(PHASE_CONSOLE);
+		return;
+	}
+	ret = fb_ioctl(screen, FBIOGET_VSCREENINFO, &var_screeninfo);
+	if (ret < 0) {
+		fprintf(stderr, "Error: ioctl(FBIOGET_VSCREENINFO) failed for /dev/fb%d: %s\n", screen, strerror(errno));
+		exit_command(ret);
+	}
+	if (width > 0 && height > 0) {
+		var_screeninfo.xres = width;
+		var_screeninfo.yres = height;
+		var_screeninfo.xres_virtual = width;
+		var_screeninfo.yres_virtual = height;
+		var_screeninfo.xoffset = 0;
+		var_screeninfo.yoffset = 0;
+	}
+	if (bytes_per_pixel > 0)
+		set_var_screeninfo_pixel_depth(&var_screeninfo, bytes_per_pixel);
+	if (virtual_height > 0) {
+		var_screeninfo.yres_virtual = virtual_height;
+		var_screeninfo.yoffset = 0;
+	}
+	else
+	if (set_virtual_buffers || pan_scroll) {
+		struct fb_fix_screeninfo fix_screeninfo;
+		fb_ioctl(screen, FBIOGET_FSCREENINFO, &fix_screeninfo);
+		var_screeninfo.yres_virtual = console_virtual_height(fix_screeninfo.smem_len,
+			var_screeninfo.xres_virtual, var_screeninfo.yres, (var_screeninfo.bits_per_pixel + 7) / 8);
+		var_screeninfo.yoffset = 0;
+		// Let fbcon wrap around instead of moving the screen back when the driver supports it.
+		if (pan_scroll && fix_screeninfo.ywrapstep > 0)
+			var_screeninfo.vmode |= FB_VMODE_YWRAP;
+	}
+	var_screeninfo.activate = FB_ACTIVATE_NOW | FB_ACTIVATE_ALL;
+	ret = fb_ioctl(screen, FBIOPUT_VSCREENINFO, &var_screeninfo);
+	if (ret < 0) {
+		fprintf(stderr, "Error: ioctl(FBIOPUT_VSCREENINFO) failed for /dev/fb%d: %s\n", screen, strerror(errno));
+		exit_command(ret);
+	}
+	native_time = get_time_ms() - start_time;
+	phase_end(PHASE_CONSOLE);
+	if (pan_scroll) {
+		if (var_screeninfo.yres_virtual > var_screeninfo.yres)
+			printf("Console framebuffer virtual size is %d x %d (%.1f screens) for scrolling by %s.\n",
+				var_screeninfo.xres_virtual, var_screeninfo.yres_virtual,
+				(double)var_screeninfo.yres_virtual / var_screeninfo.yres,
+				(var_screeninfo.vmode & FB_VMODE_YWRAP) ? "wrapping" : "panning");
+		else
+			printf("No framebuffer memory left for panning console scrolling.\n");
+	}
+	else
+	if (set_virtual_buffers)
+		printf("Console framebuffer has %d buffers (virtual size %d x %d).\n", nu_framebuffer_buffers,
+			var_screeninfo.xres_virtual, var_screeninfo.yres_virtual);
+	if (!compare_with_fbset) {
+		printf("Console framebuffer reconfigured in %.2f ms.\n", native_time);
+		return;
+	}
+	// Apply the same change with fbset. Since the framebuffer is already configured this way,
+	// this does not change anything, but it shows the time taken by the fbset method.
+	start_time = get_time_ms();
+	run_fbset(screen, width, height, bytes_per_pixel, virtual_height);
+	fbset_time = get_time_ms() - start_time;
+	printf("Console framebuffer reconfigured in %.2f ms (fbset takes %.2f ms, %.2f ms saved).\n",
+		native_time, fbset_time, fbset_time - native_time);
+}
+
+static void set_framebuffer_console(int screen, int width, int height, int bytes_per_pixel) {
+	set_framebuffer_console_virtual(screen, width, height, bytes_per_pixel, 0);
+}
+
 static void set_framebuffer_console_size_to_screen_size(int screen) {
-	int tmp;
+	unsigned long args[4] = { 0 };
 	int ret;
 	int width, height;
-	char s[80];
-	tmp = screen;
-	ret = ioctl(fd_disp, DISP_CMD_SCN_GET_WIDTH, &tmp);
+	args[0] = screen;
+	ret = disp_ioctl(DISP_CMD_SCN_GET_WIDTH, args);
 	if (ret < 0) {
 		fprintf(stderr, "Error: ioctl(SCN_GET_WIDTH) failed: %s\n",
 			strerror(-ret));
-		exit(ret);
+		exit_command(ret);
 	}
 	width = ret;
-	tmp = screen;
-	ret = ioctl(fd_disp, DISP_CMD_SCN_GET_HEIGHT, &tmp);
+	args[0] = screen;
+	ret = disp_ioctl(DISP_CMD_SCN_GET_HEIGHT, args);
 	if (ret < 0) {
 		fprintf(stderr, "Error: ioctl(SCN_GET_HEIGHT) failed: %s\n",
 				strerror(-ret));
-		exit(ret);
+		exit_command(ret);
 	}
 	height = ret;
-	if(width==65536||height==65536)exit(0);
-	sprintf(s, "fbset --all -fb /dev/fb%d -xres %d -yres %d", screen, width, height);
+	if(width==65536||height==65536)exit_command(0);
 	printf("Setting console framebuffer resolution to %d x %d.\n", width, height);
-	system(s);
+	set_framebuffer_console(screen, width, height, 0);
 }
 
 static void set_framebuffer_console_size_to_screen_size_and_set_pixel_depth(int screen, int bytes_per_pixel) {
-	int tmp;
+	unsigned long args[4] = { 0 };
 	int ret;
 	int width, height;
-	char s[80];
-	tmp = screen;
-       	ret = ioctl(fd_disp, DISP_CMD_SCN_GET_WIDTH, &tmp);
+	args[0] = screen;
+       	ret = disp_ioctl(DISP_CMD_SCN_GET_WIDTH, args);
 	if (ret < 0) {
 		fprintf(stderr, "Error: ioctl(SCN_GET_WIDTH) failed: %s\n",
 			strerror(-ret));
-		exit(ret);
+		exit_command(ret);
 	}
 	width = ret;
-	tmp = screen;
-	ret = ioctl(fd_disp, DISP_CMD_SCN_GET_HEIGHT, &tmp);
+	args[0] = screen;
+	ret = disp_ioctl(DISP_CMD_SCN_GET_HEIGHT, args);
 	if (ret < 0) {
        		fprintf(stderr, "Error: ioctl(SCN_GET_HEIGHT) failed: %s\n",
 	       		strerror(-ret));
-		exit(ret);
+		exit_command(ret);
 	}
 	height = ret;
-	if(width==65536||height==65536)exit(0);
-	if (bytes_per_pixel == 4)
-		sprintf(s, "fbset --all -fb /dev/fb%d -xres %d -yres %d -depth 32 -rgba 8,8,8,8", screen, width, height);
-	else
-		sprintf(s, "fbset --all -fb /dev/fb%d -xres %d -yres %d -depth 16 -rgba 5,6,5,0", screen, width, height);
+	if(width==65536||height==65536)exit_command(0);
 	printf("Setting console framebuffer resolution to %d x %d and pixel depth to %dbpp.\n", width, height, bytes_per_pixel * 8);
-	system(s);
+	set_framebuffer_console(screen, width, height, bytes_per_pixel);
 }
 
 static void set_framebuffer_console_size_and_depth(int screen, int mode, int bytes_per_pixel) {
-	char s[80];
-	if (bytes_per_pixel == 4)
-		sprintf(s, "fbset --all -fb /dev/fb%d -xres %d -yres %d -depth 32 -rgba 8,8,8,8", screen, mode_width[mode], mode_height[mode]);
-	else
-		sprintf(s, "fbset --all -fb /dev/fb%d -xres %d -yres %d -depth 16 -rgba 5,6,5,0", screen, mode_width[mode], mode_height[mode]);
-	printf("Setting console framebuffer resolution to %d x %d and pixel depth to %dbpp.\n", mode_width[mode],
-		mode_height[mode], bytes_per_pixel * 8);
-	system(s);
+	printf("Setting console framebuffer resolution to %d x %d and pixel depth to %dbpp.\n", mode_timing[mode].width,
+		mode_timing[mode].height, bytes_per_pixel * 8);
+	set_framebuffer_console(screen, mode_timing[mode].width, mode_timing[mode].height, bytes_per_pixel);
 }
 
-void set_framebuffer_console_pixel_depth(int screen, int bytes_per_pixel) {
-	char *fbset_str;
-	if (bytes_per_pixel == 4)
-		fbset_str = "fbset --all -depth 32 -rgba 8,8,8,8";
-	else
-	if (bytes_per_pixel == 3)
-		fbset_str = "fbset --all -depth 24 -rgba 8,8,8,0";
-	else
-		fbset_str = "fbset --all -depth 16 -rgba 5,6,5,0";
-	fbset_str[23]=(char)((int)'0'+screen);
+static void set_framebuffer_console_pixel_depth(int screen, int bytes_per_pixel) {
 	printf("Setting console framebuffer pixel depth to %d bpp.\n", bytes_per_pixel * 8);
-	system(fbset_str);
+	set_framebuffer_console(screen, 0, 0, bytes_per_pixel);
 }
 
-static void disable_scaler(int screen) {
+// Returns the layer handle of the framebuffer of a screen.
+
+static int get_layer_handle(int screen) {
+	struct layer_cache *l = &layer_cache[screen];
+	unsigned long args[4] = { 0 };
 	int ret;
-	int layer_handle;
-	__disp_layer_info_t layer_info;
-	unsigned int args[4];
-	if (screen == 0)
-		ret = ioctl(fd_fb[0], FBIOGET_LAYER_HDL_0, args);
-	else
-		ret = ioctl(fd_fb[1], FBIOGET_LAYER_HDL_1, args);
+	if (l->handle_valid) {
+		count_saved_ioctls(1);
+		return l->handle;
+	}
+	ret = fb_ioctl(screen, screen == 0 ? FBIOGET_LAYER_HDL_0 : FBIOGET_LAYER_HDL_1, args);
 	if (ret < 0) {
 		fprintf(stderr, "Error: ioctl(FBIOGET_LAYER_HDL_%d) failed: %s\n", screen, strerror(- ret));
-		exit(ret);
+		exit_command(ret);
 	}
-	layer_handle = args[0];
+	l->handle = args[0];
+	l->handle_valid = 1;
+	return l->handle;
+}
 
+// Get the layer parameters of the framebuffer layer of a screen.
+
+static void get_layer_para(int screen, __disp_layer_info_t *layer_info) {
+	struct layer_cache *l = &layer_cache[screen];
+	unsigned long args[4] = { 0 };
+	int ret;
+	if (l->info_valid) {
+		count_saved_ioctls(2);
+		*layer_info = l->info;
+		return;
+	}
 	args[0] = screen;
-	args[1] = layer_handle;
-	args[2] = &layer_info;
-	ret = ioctl(fd_disp, DISP_CMD_LAYER_GET_PARA, args);
+	args[1] = get_layer_handle(screen);
+	args[2] = (unsigned long)&l->info;
+	ret = disp_ioctl(DISP_CMD_LAYER_GET_PARA, args);
 	if (ret < 0) {
 		fprintf(stderr, "Error: ioctl(DISP_CMD_LAYER_GET_PARA) failed: %s\n", strerror(- ret));
-		exit(ret);
-	}
-	layer_info.mode = DISP_LAYER_WORK_MODE_NORMAL;
-	args[0] = screen;
-	args[1] = layer_handle;
-	args[2] = &layer_info;
-	ret = ioctl(fd_disp, DISP_CMD_LAYER_SET_PARA, args);
-	if (ret < 0) {
-		fprintf(stderr, "Error: ioctl(DISP_CMD_LAYER_SET_PARA) failed: %s\n", strerror(- ret));
-		exit(ret);
+		exit_command(ret);
 	}
+	l->info_valid = 1;
+	*layer_info = l->info;
 }
 
-static void enable_scaler_for_mode(int screen, int mode) {
-	int ret;
-	int layer_handle;
-	__disp_layer_info_t layer_info;
-	unsigned int args[4];
-	if (screen == 0)
-		ret = ioctl(fd_fb[0], FBIOGET_LAYER_HDL_0, args);
-	else
-		ret = ioctl(fd_fb[1], FBIOGET_LAYER_HDL_1, args);
-	if (ret < 0) {
-		fprintf(stderr, "Error: ioctl(FBIOGET_LAYER_HDL_%d) failed: %s\n", screen, strerror(- ret));
-		exit(ret);
-	}
-	layer_handle = args[0];
+// Set the layer parameters of the framebuffer layer of a screen, unless they are unchanged.
 
-	args[0] = screen;
-	args[1] = layer_handle;
-	args[2] = &layer_info;
-	ret = ioctl(fd_disp, DISP_CMD_LAYER_GET_PARA, args);
-	if (ret < 0) {
-		fprintf(stderr, "Error: ioctl(DISP_CMD_LAYER_GET_PARA) failed: %s\n", strerror(- ret));
-		exit(ret);
+static void set_layer_para(int screen, const __disp_layer_info_t *layer_info) {
+	struct layer_cache *l = &layer_cache[screen];
+	unsigned long args[4] = { 0 };
+	int ret;
+	if (l->info_valid && memcmp(layer_info, &l->info, sizeof(l->info)) == 0) {
+		count_saved_ioctls(1);
+		return;
 	}
-	layer_info.mode = DISP_LAYER_WORK_MODE_SCALER;
-	layer_info.src_win.width = mode_width[mode];
-	layer_info.src_win.height = mode_height[mode];
-	layer_info.scn_win.width = mode_width[mode];
-	layer_info.scn_win.height = mode_height[mode];
 	args[0] = screen;
-	args[1] = layer_handle;
-	args[2] = &layer_info;
-	ret = ioctl(fd_disp, DISP_CMD_LAYER_SET_PARA, args);
+	args[1] = get_layer_handle(screen);
+	args[2] = (unsigned long)layer_info;
+	ret = disp_ioctl(DISP_CMD_LAYER_SET_PARA, args);
 	if (ret < 0) {
+		l->info_valid = 0;
 		fprintf(stderr, "Error: ioctl(DISP_CMD_LAYER_SET_PARA) failed: %s\n", strerror(- ret));
-		exit(ret);
+		exit_command(ret);
 	}
+	l->info = *layer_info;
+	l->info_valid = 1;
+	// The layer framebuffer is part of the parameters.
+	l->fb = layer_info->fb;
+	l->fb_valid = 1;
 }
-static void enable_scaler_for_size(int screen, int sw,int sh,int w,int h) {
+
+// Get the framebuffer of the framebuffer layer of a screen.
+
+static void get_layer_fb(int screen, __disp_fb_t *fb_info) {
+	struct layer_cache *l = &layer_cache[screen];
+	unsigned long args[4] = { 0 };
 	int ret;
-	int layer_handle;
-	__disp_layer_info_t layer_info;
-	unsigned int args[4];
-	if (screen == 0)
-		ret = ioctl(fd_fb[0], FBIOGET_LAYER_HDL_0, args);
-	else
-		ret = ioctl(fd_fb[1], FBIOGET_LAYER_HDL_1, args);
-	if (ret < 0) {
-		fprintf(stderr, "Error: ioctl(FBIOGET_LAYER_HDL_%d) failed: %s\n", screen, strerror(- ret));
-		exit(ret);
+	if (l->fb_valid || l->info_valid) {
+		count_saved_ioctls(1);
+		*fb_info = l->fb_valid ? l->fb : l->info.fb;
+		return;
 	}
-	layer_handle = args[0];
-
 	args[0] = screen;
-	args[1] = layer_handle;
-	args[2] = &layer_info;
-	ret = ioctl(fd_disp, DISP_CMD_LAYER_GET_PARA, args);
+	args[1] = get_layer_handle(screen);
+	args[2] = (unsigned long)&l->fb;
+	ret = disp_ioctl(DISP_CMD_LAYER_GET_FB, args);
 	if (ret < 0) {
-		fprintf(stderr, "Error: ioctl(DISP_CMD_LAYER_GET_PARA) failed: %s\n", strerror(- ret));
-		exit(ret);
+		fprintf(stderr, "Error: ioctl(DISP_CMD_LAYER_GET_FB) failed: %s\n", strerror(- ret));
+		exit_command(ret);
 	}
+	l->fb_valid = 1;
+	*fb_info = l->fb;
+}
+
+static void disable_scaler(int screen) {
+	__disp_layer_info_t layer_info;
+	phase_begin(PHASE_SCALER);
+	get_layer_para(screen, &layer_info);
+	layer_info.mode = DISP_LAYER_WORK_MODE_NORMAL;
+	set_layer_para(screen, &layer_info);
+	phase_end(PHASE_SCALER);
+}
+
+static void enable_scaler_for_size(int screen, int sw,int sh,int w,int h) {
+	__disp_layer_info_t layer_info;
+	phase_begin(PHASE_SCALER);
+	get_layer_para(screen, &layer_info);
 	layer_info.mode = DISP_LAYER_WORK_MODE_SCALER;
 	layer_info.src_win.width = sw;
 	layer_info.src_win.height = sh;
 	layer_info.scn_win.width = w;
 	layer_info.scn_win.height = h;
-	args[0] = screen;
-	args[1] = layer_handle;
-	args[2] = &layer_info;
-	ret = ioctl(fd_disp, DISP_CMD_LAYER_SET_PARA, args);
-	if (ret < 0) {
-		fprintf(stderr, "Error: ioctl(DISP_CMD_LAYER_SET_PARA) failed: %s\n", strerror(- ret));
-		exit(ret);
-	}
+	set_layer_para(screen, &layer_info);
+	phase_end(PHASE_SCALER);
+}
+
+static void enable_scaler_for_mode(int screen, int mode) {
+	enable_scaler_for_size(screen, mode_timing[mode].width, mode_timing[mode].height, mode_timing[mode].width, mode_timing[mode].height);
 }
+
 // Returns framebuffer size in bytes. If there are multiple buffers, it returns the combined size.
 
 static int get_framebuffer_size(int screen) {
 	int ret;
 	struct fb_fix_screeninfo fix_screeninfo;
-	ioctl(fd_fb[screen], FBIOGET_FSCREENINFO, &fix_screeninfo);
+	fb_ioctl(screen, FBIOGET_FSCREENINFO, &fix_screeninfo);
 	return fix_screeninfo.smem_len;
 }
 
+// Returns the number of bytes per pixel of a display driver framebuffer format.
+
+static int format_bytes_per_pixel(__disp_pixel_fmt_t format) {
+	if (format >= DISP_FORMAT_RGB655 && format <= DISP_FORMAT_RGBA5551)
+		return 2;
+	if (format == DISP_FORMAT_ARGB888 || format == DISP_FORMAT_ARGB8888)
+		return 4;
+	if (format == DISP_FORMAT_RGB888)
+		return 3;
+	if (format == DISP_FORMAT_ARGB4444)
+		return 2;
+	return 1;
+}
+
+// Returns the memory bandwidth in bytes per second needed to scan out a framebuffer window of the
+// given size. An interlaced mode only reads half of the lines for each field.
+
+static double scanout_bandwidth(int width, int height, int bytes_per_pixel, int refresh, int interlaced) {
+	double bandwidth = (double)width * height * bytes_per_pixel * refresh;
+	if (interlaced)
+		bandwidth /= 2;
+	return bandwidth;
+}
+
+// Like check_framebuffer_size, use mode_size for the number of pixels of a mode.
+
+static double mode_scanout_bandwidth(int mode, int bytes_per_pixel) {
+	return scanout_bandwidth(mode_size(mode), 1, bytes_per_pixel, mode_timing[mode].refresh, mode_timing[mode].interlaced);
+}
+
+struct mode_bandwidth {
+	int mode;
+	int bytes_per_pixel;
+	double bandwidth;
+};
+
+static int compare_mode_bandwidth(const void *a, const void *b) {
+	const struct mode_bandwidth *ma = a, *mb = b;
+	if (ma->bandwidth != mb->bandwidth)
+		return ma->bandwidth < mb->bandwidth ? - 1 : 1;
+	return ma->mode - mb->mode;
+}
+
+// The scanout of a screen: the layer source window, pixel depth and refresh rate, and the memory
+// bandwidth it takes (zero when the output is disabled).
+struct screen_scanout {
+	int output_type;
+	int width, height;
+	int bytes_per_pixel;
+	int refresh, interlaced;
+	double bandwidth;
+};
+
+static void get_screen_scanout(int screen, struct screen_scanout *scanout) {
+	unsigned long args[4] = { 0 };
+	__disp_layer_info_t layer_info;
+	args[0] = screen;
+	scanout->output_type = disp_ioctl(DISP_CMD_GET_OUTPUT_TYPE, args);
+	scanout->bandwidth = 0;
+	if (scanout->output_type == DISP_OUTPUT_TYPE_NONE)
+		return;
+	scanout->refresh = LCD_REFRESH_RATE;
+	scanout->interlaced = 0;
+	if (scanout->output_type == DISP_OUTPUT_TYPE_HDMI) {
+		int mode;
+		args[0] = screen;
+		mode = disp_ioctl(DISP_CMD_HDMI_GET_MODE, args);
+		// With EDID mode the driver uses the preferred timing of the display; assume 60 Hz if
+		// the EDID isn't available.
+		if (mode_valid(mode)) {
+			scanout->refresh = mode_timing[mode].refresh;
+			scanout->interlaced = mode_timing[mode].interlaced;
+		}
+		else
+		if (mode == DISP_TV_MODE_EDID && get_edid_preferred_timing() != NULL) {
+			scanout->refresh = get_edid_preferred_timing()->refresh;
+			scanout->interlaced = get_edid_preferred_timing()->interlaced;
+		}
+	}
+	get_layer_para(screen, &layer_info);
+	scanout->width = layer_info.src_win.width;
+	scanout->height = layer_info.src_win.height;
+	scanout->bytes_per_pixel = format_bytes_per_pixel(layer_info.fb.format);
+	scanout->bandwidth = scanout_bandwidth(scanout->width, scanout->height, scanout->bytes_per_pixel,
+		scanout->refresh, scanout->interlaced);
+}
+
+// Show the scanout bandwidth of both screens and rank the HDMI modes supported on the given
+// screen by scanout bandwidth. The bandwidth is determined by the layer source window, which is
+// smaller than the screen when the scaler is used to scale up.
+
+static int show_bandwidth(int screen) {
+	struct mode_bandwidth ranking[MAX_MODES * 2];
+	int nu_ranked = 0;
+	double total = 0;
+	int framebuffer_size = get_framebuffer_size(screen);
+	int s, i;
+	printf("Scanout memory bandwidth:\n");
+	for (s = 0; s <= 1; s++) {
+		struct screen_scanout scanout;
+		get_screen_scanout(s, &scanout);
+		if (scanout.output_type == DISP_OUTPUT_TYPE_NONE) {
+			printf("Screen %d: output disabled.\n", s);
+			continue;
+		}
+		total += scanout.bandwidth;
+		printf("Screen %d: %s, %d x %d at %dbpp, %d Hz%s: %.1f MB/s.\n", s, output_type_str(scanout.output_type),
+			scanout.width, scanout.height, scanout.bytes_per_pixel * 8, scanout.refresh,
+			scanout.interlaced ? " interlaced" : "", scanout.bandwidth / 1000000);
+	}
+	printf("Total: %.1f MB/s (%.1f%% of %d MB/s DRAM bandwidth).\n", total / 1000000,
+		total * 100 / ((double)dram_bandwidth * 1000000), dram_bandwidth);
+
+	for (i = 0; i < nu_modes; i++) {
+		if (!mode_valid(i) || hdmi_mode_supported(screen, i) != 1)
+			continue;
+		ranking[nu_ranked].mode = i;
+		ranking[nu_ranked].bytes_per_pixel = 2;
+		ranking[nu_ranked].bandwidth = mode_scanout_bandwidth(i, 2);
+		ranking[nu_ranked + 1].mode = i;
+		ranking[nu_ranked + 1].bytes_per_pixel = 4;
+		ranking[nu_ranked + 1].bandwidth = mode_scanout_bandwidth(i, 4);
+		nu_ranked += 2;
+	}
+	if (nu_ranked == 0) {
+		printf("No supported HDMI modes reported for screen %d.\n", screen);
+		return 0;
+	}
+	qsort(ranking, nu_ranked, sizeof(ranking[0]), compare_mode_bandwidth);
+	printf("Supported HDMI modes on screen %d by scanout bandwidth:\n", screen);
+	printf("mode  name                 depth      MB/s   DRAM  fits framebuffer\n");
+	for (i = 0; i < nu_ranked; i++) {
+		int mode = ranking[i].mode;
+		int fits = mode_size(mode) * ranking[i].bytes_per_pixel * nu_framebuffer_buffers <= framebuffer_size;
+		printf("%4d  %-20s %3dbpp %9.1f %5.1f%%  %s\n", mode, mode_timing[mode].name, ranking[i].bytes_per_pixel * 8,
+			ranking[i].bandwidth / 1000000, ranking[i].bandwidth * 100 / ((double)dram_bandwidth * 1000000),
+			fits ? "yes" : "no");
+	}
+	return 0;
+}
+
+// Select an HDMI mode and pixel depth according to the automode policy. Every mode is checked for
+// support once, modes that don't fit into the framebuffer with nu_framebuffer_buffers buffers are
+// skipped, as are the 3D modes. If bytes_per_pixel is zero, both 16bpp and 32bpp are considered.
+// The native policy selects the native mode from the EDID without checking support, and falls
+// back to the highest resolution. Returns the selected mode, or -1 if no mode qualifies.
+
+static int select_auto_mode(int screen, int policy, int parameter, int bytes_per_pixel,
+int *selected_bytes_per_pixel) {
+	int framebuffer_size = get_framebuffer_size(screen);
+	int best_mode = - 1, best_bytes_per_pixel = 0;
+	double best_bandwidth = 0;
+	int mode, i;
+	if (policy == AUTO_MODE_NATIVE) {
+		struct edid_info *info = get_edid_info();
+		mode = info != NULL ? edid_native_mode(info) : - 1;
+		if (mode >= 0) {
+			for (i = 0; i < 2; i++) {
+				int bpp = (i == 0) ? 4 : 2;
+				if (bytes_per_pixel != 0 && bpp != bytes_per_pixel)
+					continue;
+				if (mode_size(mode) * bpp * nu_framebuffer_buffers <= framebuffer_size) {
+					*selected_bytes_per_pixel = bpp;
+					return mode;
+				}
+			}
+			printf("The native mode of the display (%d, %s) doesn't fit into the framebuffer, "
+				"selecting the highest resolution mode.\n", mode, mode_timing[mode].name);
+		}
+		else
+		if (info == NULL)
+			printf("The EDID of the display (%s) is not available, selecting the highest resolution "
+				"mode.\n", edid_file);
+		else
+			printf("The EDID has no native mode that is an HDMI mode, selecting the highest resolution "
+				"mode.\n");
+		policy = AUTO_MODE_MAX_RESOLUTION;
+	}
+	for (mode = 0; mode < nu_modes; mode++) {
+		if (!mode_valid(mode))
+			continue;
+		if (mode >= DISP_TV_MOD_1080P_24HZ_3D_FP && mode <= DISP_TV_MOD_720P_60HZ_3D_FP)
+			continue;
+		if (policy == AUTO_MODE_MIN_BANDWIDTH && mode_size(mode) < parameter)
+			continue;
+		if (policy == AUTO_MODE_REFRESH && mode_timing[mode].refresh != parameter)
+			continue;
+		if (hdmi_mode_supported(screen, mode) != 1)
+			continue;
+		for (i = 0; i < 2; i++) {
+			// Try 32bpp first, so that it is preferred over 16bpp when otherwise equal.
+			int bpp = (i == 0) ? 4 : 2;
+			double bandwidth;
+			int better;
+			if (bytes_per_pixel != 0 && bpp != bytes_per_pixel)
+				continue;
+			if (mode_size(mode) * bpp * nu_framebuffer_buffers > framebuffer_size)
+				continue;
+			bandwidth = mode_scanout_bandwidth(mode, bpp);
+			if (best_mode < 0)
+				better = 1;
+			else
+			if (policy == AUTO_MODE_MIN_BANDWIDTH)
+				better = bandwidth < best_bandwidth;
+			else
+			if (mode_size(mode) != mode_size(best_mode))
+				better = mode_size(mode) > mode_size(best_mode);
+			else
+			if (mode_timing[mode].interlaced != mode_timing[best_mode].interlaced)
+				better = !mode_timing[mode].interlaced;
+			else
+				better = mode_timing[mode].refresh > mode_timing[best_mode].refresh;
+			if (better) {
+				best_mode = mode;
+				best_bytes_per_pixel = bpp;
+				best_bandwidth = bandwidth;
+			}
+		}
+	}
+	*selected_bytes_per_pixel = best_bytes_per_pixel;
+	return best_mode;
+}
+
+// Check whether a framebuffer with the given size in bytes fits into the framebuffer memory of the
+// screen with the number of buffers defined by nu_framebuffer_buffers. Exits if it doesn't.
+
+static void check_framebuffer_fits(int screen, int size_in_bytes) {
+	int framebuffer_size_in_bytes = get_framebuffer_size(screen);
+	if (size_in_bytes * nu_framebuffer_buffers > framebuffer_size_in_bytes) {
+		printf("Reported framebuffer size is too small to fit mode (%.2f MB available; %.2f MB required).\n",
+			(float)framebuffer_size_in_bytes / (1024 * 1024),
+			(float)size_in_bytes * nu_framebuffer_buffers / (1024 * 1024));
+		if (nu_framebuffer_buffers == 1)
+			printf("Increase the default framebuffer size allocated at boot.\n");
+		else
+		if (set_virtual_buffers)
+			printf("Increase the default framebuffer size allocated at boot, or use fewer buffers "
+				"with the --buffers option.\n");
+		else
+			printf("Increase the default framebuffer size allocated at boot, or if you "
+				"don't need double buffering (used by Mali and video acceleration) "
+				"use the --nodoublebuffer option.\n");
+		command_error = A10DISP_ERROR_FRAMEBUFFER;
+		exit_command(- 1);
+	}
+}
+
 // Check whether the framebuffer size is sufficient for the given mode, with the number of buffers
 // defined by nu_framebuffer_buffers. If bytes per pixel is zero, the bytes per pixel of the
 // current screen is used. If mode == DISP_TV_MODE_EDID, get the dimensions from the display driver.
 
 static void check_framebuffer_size(int screen, int mode, int bytes_per_pixel) {
 	struct fb_var_screeninfo var_screeninfo;
-	int framebuffer_size_in_bytes = get_framebuffer_size(screen);
+	phase_begin(PHASE_FRAMEBUFFER_CHECK);
 	if (bytes_per_pixel == 0) {
-		ioctl(fd_fb[screen], FBIOGET_VSCREENINFO, &var_screeninfo);
+		fb_ioctl(screen, FBIOGET_VSCREENINFO, &var_screeninfo);
 		bytes_per_pixel = (var_screeninfo.bits_per_pixel + 7) / 8;
 	}
 	int mode_size_in_bytes;
 	if (mode == DISP_TV_MODE_EDID) {
-		int tmp, width, height;
-		tmp = screen;
-		width = ioctl(fd_disp, DISP_CMD_SCN_GET_WIDTH, &tmp);
-		tmp = screen;
-		height = ioctl(fd_disp, DISP_CMD_SCN_GET_HEIGHT, &tmp);
+		unsigned long args[4] = { 0 };
+		int width, height;
+		args[0] = screen;
+		width = disp_ioctl(DISP_CMD_SCN_GET_WIDTH, args);
+		args[0] = screen;
+		height = disp_ioctl(DISP_CMD_SCN_GET_HEIGHT, args);
 		mode_size_in_bytes = width * height * bytes_per_pixel;
 	}
 	else
-		mode_size_in_bytes = mode_size[mode] * bytes_per_pixel;
-	if (mode_size_in_bytes * nu_framebuffer_buffers > framebuffer_size_in_bytes) {
-		printf("Reported framebuffer size is too small to fit mode (%.2f MB available; %.2f MB required).\n",
-			(float)framebuffer_size_in_bytes / (1024 * 1024),
-			(float)mode_size_in_bytes * nu_framebuffer_buffers / (1024 * 1024));
-		if (nu_framebuffer_buffers == 1)
-			printf("Increase the default framebuffer size allocated at boot.\n");
-		else
-			printf("Increase the default framebuffer size allocated at boot, or if you "
-				"don't need double buffering (used by Mali and video acceleration) "
-				"use the --nodoublebuffer option.\n");
-		exit(- 1);
-	}
+		mode_size_in_bytes = mode_size(mode) * bytes_per_pixel;
+	check_framebuffer_fits(screen, mode_size_in_bytes);
+	phase_end(PHASE_FRAMEBUFFER_CHECK);
 }
 
 #if 0
-// Currently not used, pixel depth is changed with fbset.
+// Currently not used, pixel depth is changed with FBIOPUT_VSCREENINFO.
 static void set_pixel_depth(int screen, int bytes_per_pixel) {
 	int ret;
 	int layer_handle;
 	__disp_layer_info_t layer_info;
-	unsigned int args[4];
+	unsigned long args[4] = { 0 };
 	if (screen == 0)
-		ret = ioctl(fd_fb[0], FBIOGET_LAYER_HDL_0, args);
+		ret = fb_ioctl(0, FBIOGET_LAYER_HDL_0, args);
 	else
-		ret = ioctl(fd_fb[1], FBIOGET_LAYER_HDL_1, args);
+		ret = fb_ioctl(1, FBIOGET_LAYER_HDL_1, args);
 	if (ret < 0) {
 		fprintf(stderr, "Error: ioctl(FBIOGET_LAYER_HDL_%d) failed: %s\n", screen, strerror(- ret));
-		exit(ret);
+		exit_command(ret);
 	}
 	layer_handle = args[0];
 
 	args[0] = screen;
 	args[1] = layer_handle;
-	args[2] = &layer_info;
-	ret = ioctl(fd_disp, DISP_CMD_LAYER_GET_PARA, args);
+	args[2] = (unsigned long)&layer_info;
+	ret = disp_ioctl(DISP_CMD_LAYER_GET_PARA, args);
 	if (ret < 0) {
 		fprintf(stderr, "Error: ioctl(DISP_CMD_LAYER_GET_PARA) failed: %s\n", strerror(- ret));
-		exit(ret);
+		exit_command(ret);
 	}
 	printf("format = %d, seq = %d, br_swap = %d.\n", layer_info.fb.format, layer_info.fb.seq, layer_info.fb.br_swap);
 #if 1
@@ -482,128 +1845,2274 @@ static void set_pixel_depth(int screen, int bytes_per_pixel) {
 #endif
 	args[0] = screen;
 	args[1] = layer_handle;
-	args[2] = &layer_info;
-	ret = ioctl(fd_disp, DISP_CMD_LAYER_SET_PARA, args);
+	args[2] = (unsigned long)&layer_info;
+	ret = disp_ioctl(DISP_CMD_LAYER_SET_PARA, args);
 	if (ret < 0) {
 		fprintf(stderr, "Error: ioctl(DISP_CMD_LAYER_SET_PARA) failed: %s\n", strerror(- ret));
-		exit(ret);
+		exit_command(ret);
 	}
 }
 #endif
 
-int main(int argc, char *argv[]) {
-	unsigned int args[4] = { 0 };
-	int command;
-	int mode;
-	int bytes_per_pixel;
-	int ret, tmp, width, height;
-	int i;
-	struct fb_var_screeninfo var_screeninfo;
-	int previous_bytes_per_pixel;
-	int previous_width, previous_height;
-	int screen = 0;
-	int use_scaler_for_large_32bpp_modes = 1;
-	int sc_source_width, sc_source_height, sc_width, sc_height; //Scaler args
-	int argi = 1;
-	if (argc == 1) {
-		usage(argc, argv);
-		return 0;
-	}
+// Get the current display dimensions of a screen from the display driver.
 
-	/* Process options. */
-	for (;;) {
-		if (argi >= argc)
-			break;
-		if (strcasecmp(argv[argi], "--screen") == 0 && argi + 1 < argc) {
-			screen = atoi(argv[argi + 1]);
-			if (screen < 0 || screen > 1) {
-				fprintf(stderr, "Screen must be 0 or 1.\n");
-				return 1;
-			}
-			argi += 2;
-			continue;
-		}
-		if (strcasecmp(argv[argi], "--nodoublebuffer") == 0) {
-			nu_framebuffer_buffers = 1;
-			argi++;
-			continue;
-		}
-		if (strcasecmp(argv[argi], "--noscaler") == 0) {
-			use_scaler_for_large_32bpp_modes = 0;
-			argi++;
-			continue;
-		}
-		break;
+static void get_screen_size(int screen, int *width, int *height) {
+	unsigned long args[4] = { 0 };
+	int ret;
+	args[0] = screen;
+	ret = disp_ioctl(DISP_CMD_SCN_GET_WIDTH, args);
+	if (ret < 0) {
+		fprintf(stderr, "Error: ioctl(SCN_GET_WIDTH) failed: %s\n", strerror(-ret));
+		exit_command(ret);
 	}
-
-	if (argi >= argc) {
-		fprintf(stderr, "No command given.\n");
-		return 1;
+	*width = ret;
+	args[0] = screen;
+	ret = disp_ioctl(DISP_CMD_SCN_GET_HEIGHT, args);
+	if (ret < 0) {
+		fprintf(stderr, "Error: ioctl(SCN_GET_HEIGHT) failed: %s\n", strerror(-ret));
+		exit_command(ret);
 	}
+	*height = ret;
+}
 
-	/* Process commands. */
-	if (strcasecmp(argv[argi], "info") == 0) {
-		command = COMMAND_INFO;
+static void output_off(int screen, int output_type) {
+	unsigned long args[4] = { 0 };
+	args[0] = screen;
+	if (output_type == DISP_OUTPUT_TYPE_HDMI)
+		disp_ioctl(DISP_CMD_HDMI_OFF, args);
+	else
+	if (output_type == DISP_OUTPUT_TYPE_LCD)
+		disp_ioctl(DISP_CMD_LCD_OFF, args);
+	else
+	if (output_type == DISP_OUTPUT_TYPE_VGA)
+		disp_ioctl(DISP_CMD_VGA_OFF, args);
+	else
+	if (output_type == DISP_OUTPUT_TYPE_TV)
+		disp_ioctl(DISP_CMD_TV_OFF, args);
+}
+
+static void output_on(int screen, int output_type) {
+	unsigned long args[4] = { 0 };
+	args[0] = screen;
+	if (output_type == DISP_OUTPUT_TYPE_HDMI)
+		disp_ioctl(DISP_CMD_HDMI_ON, args);
+	else
+	if (output_type == DISP_OUTPUT_TYPE_LCD)
+		disp_ioctl(DISP_CMD_LCD_ON, args);
+}
+
+// Parse a setting of the apply command, of the form [<screen>:]<key>=<value>. Returns 0 on success
+// and -1 if the setting is not valid.
+
+static int parse_screen_target(const char *setting, int default_screen, struct screen_target *target) {
+	struct screen_target *t;
+	const char *value;
+	int screen = default_screen;
+	if ((setting[0] == '0' || setting[0] == '1') && setting[1] == ':') {
+		screen = setting[0] - '0';
+		setting += 2;
+	}
+	value = strchr(setting, '=');
+	if (value == NULL)
+		return - 1;
+	value++;
+	t = &target[screen];
+	t->given = 1;
+	if (strncasecmp(setting, "output=", 7) == 0) {
+		if (strcasecmp(value, "hdmi") == 0)
+			t->output_type = DISP_OUTPUT_TYPE_HDMI;
+		else
+		if (strcasecmp(value, "lcd") == 0)
+			t->output_type = DISP_OUTPUT_TYPE_LCD;
+		else
+		if (strcasecmp(value, "off") == 0)
+			t->output_type = DISP_OUTPUT_TYPE_NONE;
+		else
+			return - 1;
 	}
 	else
-	if (strcasecmp(argv[argi], "switchtohdmi") == 0) {
-		if (argi + 1 >= argc) {
-			usage(argc, argv);
-			return 1;
-		}
-		command = COMMAND_SWITCH_TO_HDMI;
-		mode = atoi(argv[argi + 1]);
-		bytes_per_pixel = 0;
-		if (argi + 2 < argc) {
-			int bits_per_pixel = atoi(argv[argi + 2]);
-			if (bits_per_pixel != 16 && bits_per_pixel != 32) {
-				printf("Bits per pixel must be 16 or 32.\n");
-				return 1;
-			}
-			bytes_per_pixel = bits_per_pixel / 8;
+	if (strncasecmp(setting, "mode=", 5) == 0) {
+		if (strcasecmp(value, "edid") == 0)
+			t->mode = DISP_TV_MODE_EDID;
+		else {
+			t->mode = atoi(value);
+			if (!mode_valid(t->mode))
+				return - 1;
 		}
 	}
 	else
-	if (strcasecmp(argv[argi], "switchtohdmiforce") == 0) {
-		if (argi + 1 >= argc) {
-			usage(argc, argv);
-			return 1;
-		}
-		command = COMMAND_SWITCH_TO_HDMI_FORCE;
-		mode = atoi(argv[argi + 1]);
-		bytes_per_pixel = 0;
-		if (argi + 2 < argc) {
-			int bits_per_pixel = atoi(argv[argi + 2]);
-			if (bits_per_pixel != 16 && bits_per_pixel != 32) {
-				printf("Bits per pixel must be 16 or 32.\n");
-				return 1;
-			}
-			bytes_per_pixel = bits_per_pixel / 8;
-		}
+	if (strncasecmp(setting, "depth=", 6) == 0) {
+		int bits_per_pixel = atoi(value);
+		if (bits_per_pixel != 16 && bits_per_pixel != 32)
+			return - 1;
+		t->bytes_per_pixel = bits_per_pixel / 8;
 	}
 	else
-	if (strcasecmp(argv[argi], "switchtolcd") == 0) {
-		command = COMMAND_SWITCH_TO_LCD;
+	if (strncasecmp(setting, "src=", 4) == 0) {
+		if (sscanf(value, "%dx%d", &t->src_width, &t->src_height) != 2 || t->src_width <= 0 ||
+		t->src_height <= 0)
+			return - 1;
 	}
 	else
-	if (strcasecmp(argv[argi], "changehdmimode") == 0) {
-		if (argi + 1 >= argc) {
-			usage(argc, argv);
-			return 1;
-		}
-		command = COMMAND_CHANGE_HDMI_MODE;
-		mode = atoi(argv[argi + 1]);
-		if (mode < 0 || mode >= MODE_COUNT) {
-			printf("Mode out of range.\n");
-			return 1;
-		}
-		bytes_per_pixel = 0;
-		if (argi + 2 < argc) {
-			int bits_per_pixel = atoi(argv[argi + 2]);
-			if (bits_per_pixel != 16 && bits_per_pixel != 32) {
-				printf("Bits per pixel must be 16 or 32.\n");
-				return 1;
-			}
+	if (strncasecmp(setting, "scn=", 4) == 0) {
+		if (sscanf(value, "%dx%d", &t->scn_width, &t->scn_height) != 2 || t->scn_width <= 0 ||
+		t->scn_height <= 0)
+			return - 1;
+	}
+	else
+	if (strncasecmp(setting, "virtual=", 8) == 0) {
+		t->virtual_height = atoi(value);
+		if (t->virtual_height <= 0)
+			return - 1;
+	}
+	else
+	if (strncasecmp(setting, "scaler=", 7) == 0) {
+		if (strcasecmp(value, "on") == 0)
+			t->scaler = 1;
+		else
+		if (strcasecmp(value, "off") == 0)
+			t->scaler = 0;
+		else
+			return - 1;
+	}
+	else
+		return - 1;
+	return 0;
+}
+
+// The current state of a screen, as far as it is relevant for the apply command.
+struct screen_state {
+	int output_type;
+	// The HDMI mode, or -1 if the output is not HDMI.
+	int mode;
+	int console_width, console_height;
+	int console_height_virtual;
+	int bytes_per_pixel;
+	int smem_len;
+	int layer_mode;
+	int src_width, src_height, scn_width, scn_height;
+};
+
+static int read_screen_state(int screen, struct screen_state *state) {
+	struct fb_var_screeninfo var_screeninfo;
+	__disp_layer_info_t layer_info;
+	unsigned long args[4] = { 0 };
+	int ret;
+	args[0] = screen;
+	state->output_type = disp_ioctl(DISP_CMD_GET_OUTPUT_TYPE, args);
+	state->mode = - 1;
+	if (state->output_type == DISP_OUTPUT_TYPE_HDMI) {
+		args[0] = screen;
+		state->mode = disp_ioctl(DISP_CMD_HDMI_GET_MODE, args);
+	}
+	ret = fb_ioctl(screen, FBIOGET_VSCREENINFO, &var_screeninfo);
+	if (ret < 0) {
+		fprintf(stderr, "Error: ioctl(FBIOGET_VSCREENINFO) failed for /dev/fb%d: %s\n", screen, strerror(-ret));
+		return ret;
+	}
+	state->console_width = var_screeninfo.xres;
+	state->console_height = var_screeninfo.yres;
+	state->console_height_virtual = var_screeninfo.yres_virtual;
+	state->smem_len = get_framebuffer_size(screen);
+	state->bytes_per_pixel = (var_screeninfo.bits_per_pixel + 7) / 8;
+	get_layer_para(screen, &layer_info);
+	state->layer_mode = layer_info.mode;
+	state->src_width = layer_info.src_win.width;
+	state->src_height = layer_info.src_win.height;
+	state->scn_width = layer_info.scn_win.width;
+	state->scn_height = layer_info.scn_win.height;
+	return 0;
+}
+
+// The plan for one screen of the apply command, resolved from the target and the current state.
+// Only the steps that change something are performed.
+struct screen_plan {
+	struct screen_state current;
+	int output_type;
+	int mode;
+	int bytes_per_pixel;
+	// Zero when the display dimensions are only known after the output has been enabled.
+	int width, height;
+	int scaler;
+	int src_width, src_height, scn_width, scn_height;
+	// Whether the source window was reduced by the render scale.
+	int render_scaled;
+	// Virtual height of the console framebuffer if given, otherwise 0.
+	int virtual_height;
+	const struct screen_target *target;
+	// Whether the output has to be turned off and on (output type, HDMI mode or pixel depth change).
+	int cycle_output;
+	int set_console;
+	int set_layer;
+};
+
+// The console framebuffer size for a display of the given size with --renderscale. The width is
+// aligned to a multiple of 16 (as required for VDPAU) and the height to 2.
+
+static void render_scaled_size(int width, int height, int *src_width, int *src_height) {
+	*src_width = ((int)(width * render_scale + 8) & ~15);
+	*src_height = ((int)(height * render_scale + 1) & ~1);
+	if (*src_width < 16)
+		*src_width = 16;
+	if (*src_height < 2)
+		*src_height = 2;
+}
+
+// Resolve the layer windows and scaler use of a plan once the display dimensions are known, and
+// determine whether the console framebuffer and the layer have to be changed.
+
+static void resolve_screen_plan_windows(struct screen_plan *plan, const struct screen_target *t) {
+	const struct screen_state *current = &plan->current;
+	plan->src_width = t->src_width > 0 ? t->src_width : plan->width;
+	plan->src_height = t->src_height > 0 ? t->src_height : plan->height;
+	plan->render_scaled = 0;
+	if (t->src_width == 0 && render_scale > 0 && render_scale < 1 &&
+	plan->output_type == DISP_OUTPUT_TYPE_HDMI) {
+		render_scaled_size(plan->width, plan->height, &plan->src_width, &plan->src_height);
+		plan->render_scaled = plan->src_width < plan->width;
+	}
+	plan->scn_width = t->scn_width > 0 ? t->scn_width : plan->width;
+	plan->scn_height = t->scn_height > 0 ? t->scn_height : plan->height;
+	plan->scaler = t->scaler;
+	if (plan->scaler < 0) {
+		if (plan->src_width != plan->scn_width || plan->src_height != plan->scn_height)
+			plan->scaler = 1;
+		else
+			// Enable scaler for bigger HDMI modes at 32bpp, like the other commands.
+			plan->scaler = use_scaler_for_large_32bpp_modes && plan->output_type == DISP_OUTPUT_TYPE_HDMI &&
+				plan->bytes_per_pixel == 4 && plan->width * plan->height > 1280 * 1024;
+	}
+	plan->virtual_height = 0;
+	if (t->virtual_height > 0)
+		plan->virtual_height = t->virtual_height > plan->src_height ? t->virtual_height : plan->src_height;
+	plan->set_console = current->console_width != plan->src_width ||
+		current->console_height != plan->src_height || current->bytes_per_pixel != plan->bytes_per_pixel ||
+		(plan->virtual_height > 0 && current->console_height_virtual != plan->virtual_height) ||
+		(plan->virtual_height == 0 && (set_virtual_buffers || pan_scroll) && current->console_height_virtual !=
+		console_virtual_height(current->smem_len, plan->src_width, plan->src_height, plan->bytes_per_pixel));
+	// Changing the console framebuffer sets the source window of the layer to the new size, and
+	// the screen window too unless the layer is in scaler mode.
+	if (plan->scaler)
+		plan->set_layer = current->layer_mode != DISP_LAYER_WORK_MODE_SCALER ||
+			current->scn_width != plan->scn_width || current->scn_height != plan->scn_height ||
+			(!plan->set_console && (current->src_width != plan->src_width ||
+			current->src_height != plan->src_height));
+	else
+		plan->set_layer = current->layer_mode != DISP_LAYER_WORK_MODE_NORMAL;
+}
+
+// Configure the console framebuffer and the layer of a screen according to the plan, skipping
+// what is unchanged. The console framebuffer is the size of the source window, and is
+// reconfigured with a single call.
+
+static void configure_screen_plan(int screen, const struct screen_plan *plan) {
+	if (plan->set_console) {
+		printf("Setting console framebuffer resolution of screen %d to %d x %d and pixel depth to %dbpp.\n",
+			screen, plan->src_width, plan->src_height, plan->bytes_per_pixel * 8);
+		set_framebuffer_console_virtual(screen, plan->src_width, plan->src_height, plan->bytes_per_pixel,
+			plan->virtual_height);
+	}
+	if (!plan->set_layer)
+		return;
+	if (plan->scaler)
+		enable_scaler_for_size(screen, plan->src_width, plan->src_height, plan->scn_width, plan->scn_height);
+	else
+		disable_scaler(screen);
+}
+
+// Check that the console framebuffer of a plan fits into the framebuffer memory: a given virtual
+// size as it is, otherwise with nu_framebuffer_buffers buffers. Exits if it doesn't.
+
+static void check_screen_plan_fits(int screen, const struct screen_plan *p) {
+	if (p->virtual_height > 0 &&
+	p->src_width * p->virtual_height * p->bytes_per_pixel <= get_framebuffer_size(screen))
+		return;
+	check_framebuffer_fits(screen, p->src_width * p->src_height * p->bytes_per_pixel);
+}
+
+// Set the HDMI mode of a plan if it changes. Returns 0 or a negative error code.
+
+static int set_screen_plan_mode(int screen, const struct screen_plan *p) {
+	unsigned long args[4] = { 0 };
+	int ret;
+	if (p->output_type != DISP_OUTPUT_TYPE_HDMI || p->mode == p->current.mode)
+		return 0;
+	args[0] = screen;
+	args[1] = p->mode;
+	phase_begin(PHASE_SET_MODE);
+	ret = disp_ioctl(DISP_CMD_HDMI_SET_MODE, args);
+	phase_end(PHASE_SET_MODE);
+	if (ret < 0) {
+		fprintf(stderr, "Error: ioctl(DISP_CMD_HDMI_SET_MODE) failed: %s\n", strerror(-ret));
+		return ret;
+	}
+	return 0;
+}
+
+// Configure a screen whose dimensions were not known before its output was enabled.
+
+static void configure_screen_plan_late(int screen, struct screen_plan *p) {
+	if (p->output_type == DISP_OUTPUT_TYPE_NONE || p->width > 0)
+		return;
+	get_screen_size(screen, &p->width, &p->height);
+	resolve_screen_plan_windows(p, p->target);
+	if (p->set_console)
+		check_screen_plan_fits(screen, p);
+	configure_screen_plan(screen, p);
+}
+
+// Perform all steps of the plan of one screen: turn the output off, set the HDMI mode, configure
+// the console framebuffer and the layer, and turn the output on again. Returns 0 or a negative
+// error code.
+
+static int apply_screen_plan(int screen, struct screen_plan *p) {
+	int ret;
+	if (p->cycle_output)
+		output_off(screen, p->current.output_type);
+	if (p->output_type != DISP_OUTPUT_TYPE_NONE) {
+		ret = set_screen_plan_mode(screen, p);
+		if (ret < 0)
+			return ret;
+		if (p->width > 0)
+			configure_screen_plan(screen, p);
+	}
+	if (p->cycle_output)
+		output_on(screen, p->output_type);
+	configure_screen_plan_late(screen, p);
+	return 0;
+}
+
+// Thread that performs the plan of one screen while the other screen is changed by another
+// thread. A failing command jumps back here instead of to the command handler.
+struct screen_thread {
+	pthread_t thread;
+	int screen;
+	struct screen_plan *plan;
+	int ret;
+};
+
+static void *apply_screen_plan_thread(void *arg) {
+	struct screen_thread *t = arg;
+	jmp_buf jmp;
+	if (setjmp(jmp) == 0) {
+		command_jmp_buf = &jmp;
+		t->ret = apply_screen_plan(t->screen, t->plan);
+	}
+	else
+		t->ret = command_exit_code;
+	command_jmp_buf = NULL;
+	return NULL;
+}
+
+// Bring the screens for which a target is given into the target state, performing only the steps
+// that change something. The outputs that need it are turned off once, the modes are set and the
+// console framebuffers and layers are configured while the outputs are off, and the outputs are
+// turned on again. A scaler-only change doesn't turn the output off, and nothing is done when a
+// screen is already in the target state. When both screens need an off/on cycle, screen_sequencing
+// selects how they are changed. If check_support is zero, a HDMI mode is set even if the display
+// driver reports it is not supported. Returns the exit code.
+
+static int apply_screen_targets(const struct screen_target *target, int check_support) {
+	struct screen_plan plan[2];
+	int screen, ret;
+	int cycle_output = 0, nu_cycled;
+
+	// Resolve and validate the plan for each screen before touching the display.
+	for (screen = 0; screen < 2; screen++) {
+		const struct screen_target *t = &target[screen];
+		struct screen_plan *p = &plan[screen];
+		if (!t->given)
+			continue;
+		ret = read_screen_state(screen, &p->current);
+		if (ret < 0)
+			return ret;
+		p->target = t;
+		p->output_type = t->output_type >= 0 ? t->output_type : p->current.output_type;
+		p->cycle_output = p->output_type != p->current.output_type;
+		p->set_console = p->set_layer = 0;
+		p->width = p->height = 0;
+		if (p->output_type == DISP_OUTPUT_TYPE_NONE) {
+			cycle_output |= p->cycle_output;
+			continue;
+		}
+		if (p->output_type != DISP_OUTPUT_TYPE_HDMI && p->output_type != DISP_OUTPUT_TYPE_LCD) {
+			printf("Cannot apply settings to screen %d because it has %s output.\n", screen,
+				output_type_str(p->output_type));
+			return 1;
+		}
+		p->bytes_per_pixel = t->bytes_per_pixel > 0 ? t->bytes_per_pixel : p->current.bytes_per_pixel;
+		if (p->bytes_per_pixel != p->current.bytes_per_pixel)
+			p->cycle_output = 1;
+		p->mode = t->mode;
+		if (p->output_type == DISP_OUTPUT_TYPE_HDMI) {
+			if (p->mode < 0) {
+				if (p->current.output_type != DISP_OUTPUT_TYPE_HDMI) {
+					printf("A mode must be given to enable HDMI on screen %d.\n", screen);
+					return 1;
+				}
+				p->mode = p->current.mode;
+			}
+			if (p->mode != p->current.mode) {
+				p->cycle_output = 1;
+				if (check_support && !hdmi_mode_supported(screen, p->mode)) {
+					printf("HDMI mode %d is not supported by the display on screen %d according to the "
+						"display driver.\n", p->mode, screen);
+					command_error = A10DISP_ERROR_UNSUPPORTED;
+					return - 1;
+				}
+			}
+			if (mode_valid(p->mode)) {
+				p->width = mode_timing[p->mode].width;
+				p->height = mode_timing[p->mode].height;
+			}
+		}
+		// When the output stays on, the driver reports the dimensions (LCD, EDID mode).
+		if (p->width == 0 && p->current.output_type == p->output_type)
+			get_screen_size(screen, &p->width, &p->height);
+		if (p->width > 0) {
+			resolve_screen_plan_windows(p, t);
+			if (p->set_console) {
+				phase_begin(PHASE_FRAMEBUFFER_CHECK);
+				check_screen_plan_fits(screen, p);
+				phase_end(PHASE_FRAMEBUFFER_CHECK);
+			}
+		}
+		cycle_output |= p->cycle_output;
+	}
+
+	nu_cycled = 0;
+	for (screen = 0; screen < 2; screen++)
+		nu_cycled += target[screen].given && plan[screen].cycle_output;
+	if (nu_cycled == 2 && screen_sequencing == SCREENS_SEQUENTIAL) {
+		// Each screen with its own off/on cycle.
+		for (screen = 0; screen < 2; screen++) {
+			phase_begin(PHASE_BLACKOUT);
+			ret = apply_screen_plan(screen, &plan[screen]);
+			phase_end(PHASE_BLACKOUT);
+			if (ret < 0)
+				return ret;
+		}
+	}
+	else
+	if (nu_cycled == 2 && screen_sequencing == SCREENS_CONCURRENT && trace_file_name == NULL &&
+	record_file_name == NULL && backend != &replay_backend) {
+		// Both screens at the same time, so that their blackouts overlap. Tracing and recording
+		// need the calls in order, so they are interleaved instead.
+		struct screen_thread thread[2];
+		phase_begin(PHASE_BLACKOUT);
+		for (screen = 0; screen < 2; screen++) {
+			thread[screen].screen = screen;
+			thread[screen].plan = &plan[screen];
+			thread[screen].ret = 0;
+			if (pthread_create(&thread[screen].thread, NULL, apply_screen_plan_thread, &thread[screen]) != 0) {
+				// Do it in this thread.
+				thread[screen].thread = pthread_self();
+				thread[screen].ret = apply_screen_plan(screen, &plan[screen]);
+			}
+		}
+		for (screen = 0; screen < 2; screen++)
+			if (!pthread_equal(thread[screen].thread, pthread_self()))
+				pthread_join(thread[screen].thread, NULL);
+		phase_end(PHASE_BLACKOUT);
+		for (screen = 0; screen < 2; screen++)
+			if (thread[screen].ret != 0)
+				return thread[screen].ret;
+	}
+	else {
+		// Turn off the outputs that change.
+		if (cycle_output) {
+			phase_begin(PHASE_BLACKOUT);
+			for (screen = 0; screen < 2; screen++)
+				if (target[screen].given && plan[screen].cycle_output)
+					output_off(screen, plan[screen].current.output_type);
+		}
+
+		// Set the HDMI modes and configure the screens whose dimensions are known.
+		for (screen = 0; screen < 2; screen++) {
+			struct screen_plan *p = &plan[screen];
+			if (!target[screen].given || p->output_type == DISP_OUTPUT_TYPE_NONE)
+				continue;
+			ret = set_screen_plan_mode(screen, p);
+			if (ret < 0)
+				return ret;
+			if (p->width > 0)
+				configure_screen_plan(screen, p);
+		}
+
+		// Turn the outputs on again.
+		if (cycle_output) {
+			for (screen = 0; screen < 2; screen++)
+				if (target[screen].given && plan[screen].cycle_output)
+					output_on(screen, plan[screen].output_type);
+			phase_end(PHASE_BLACKOUT);
+		}
+
+		// Screens whose dimensions are only reported by the driver once enabled (LCD, EDID mode).
+		for (screen = 0; screen < 2; screen++)
+			if (target[screen].given)
+				configure_screen_plan_late(screen, &plan[screen]);
+	}
+
+	for (screen = 0; screen < 2; screen++) {
+		struct screen_plan *p = &plan[screen];
+		char skipped[64];
+		if (!target[screen].given)
+			continue;
+		if (p->output_type == DISP_OUTPUT_TYPE_NONE) {
+			if (p->cycle_output)
+				printf("Screen %d: output disabled.\n", screen);
+			else
+				printf("Screen %d: output is already disabled.\n", screen);
+			continue;
+		}
+		if (!p->cycle_output && !p->set_console && !p->set_layer) {
+			printf("Screen %d is already in the requested state.\n", screen);
+			continue;
+		}
+		printf("Screen %d: %s output", screen, output_type_str(p->output_type));
+		if (p->output_type == DISP_OUTPUT_TYPE_HDMI) {
+			if (p->mode == DISP_TV_MODE_EDID)
+				printf(" (EDID mode)");
+			else
+				printf(" (mode %d, %s)", p->mode, mode_timing[p->mode].name);
+		}
+		printf(", %dbpp, %d x %d", p->bytes_per_pixel * 8, p->src_width, p->src_height);
+		if (p->scaler)
+			printf(" scaled to %d x %d", p->scn_width, p->scn_height);
+		printf(".\n");
+		if (p->render_scaled) {
+			int refresh = 60, interlaced = 0;
+			if (mode_valid(p->mode)) {
+				refresh = mode_timing[p->mode].refresh;
+				interlaced = mode_timing[p->mode].interlaced;
+			}
+			printf("Render scale %.2f: %.2f MB less framebuffer memory, %.1f MB/s less scanout bandwidth.\n",
+				(double)p->src_width / p->width,
+				(double)(p->width * p->height - p->src_width * p->src_height) * p->bytes_per_pixel *
+				nu_framebuffer_buffers / (1024 * 1024),
+				(scanout_bandwidth(p->width, p->height, p->bytes_per_pixel, refresh, interlaced) -
+				scanout_bandwidth(p->src_width, p->src_height, p->bytes_per_pixel, refresh, interlaced)) /
+				1000000);
+		}
+		skipped[0] = '\0';
+		if (!p->cycle_output)
+			strcat(skipped, ", display off/on");
+		if (!p->set_console)
+			strcat(skipped, ", console change");
+		if (!p->set_layer)
+			strcat(skipped, ", layer setup");
+		if (skipped[0] != '\0')
+			printf("Screen %d: skipped %s (unchanged).\n", screen, skipped + 2);
+	}
+	return 0;
+}
+
+static int compare_double(const void *a, const void *b) {
+	double da = *(const double *)a, db = *(const double *)b;
+	return da < db ? - 1 : (da > db ? 1 : 0);
+}
+
+// Micro-benchmark of the framebuffer content conversion kernels. Each conversion is run the given
+// number of times on a width x height frame with the scalar and the SIMD kernels, and the SIMD
+// result is checked against the scalar result.
+
+static int run_convert_benchmark(int width, int height, int iterations) {
+	static const int conversions[][3] = {
+		// Source and destination bytes per pixel, dither.
+		{ 4, 2, 0 }, { 4, 2, 1 }, { 2, 4, 0 }, { 4, 3, 0 }, { 3, 4, 0 }, { 3, 2, 0 }, { 2, 3, 0 }
+	};
+	size_t size = (size_t)width * height * 4;
+	unsigned char *source, *buffer, *reference;
+	unsigned int seed = 1;
+	int i, j, k, ret = 0;
+	size_t n;
+	source = malloc(size);
+	buffer = malloc(size);
+	reference = malloc(size);
+	if (source == NULL || buffer == NULL || reference == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+	for (n = 0; n < size; n++) {
+		seed = seed * 1103515245 + 12345;
+		source[n] = seed >> 16;
+	}
+	printf("Conversion of a %d x %d frame, best of %d runs:\n", width, height, iterations);
+	printf("%-22s %-8s %10s %12s\n", "conversion", "kernel", "ms/frame", "Mpixels/s");
+	for (i = 0; i < sizeof(conversions) / sizeof(conversions[0]); i++) {
+		int src_bpp = conversions[i][0], dst_bpp = conversions[i][1], dither = conversions[i][2];
+		char name[32];
+		snprintf(name, sizeof(name), "%dbpp -> %dbpp%s", src_bpp * 8, dst_bpp * 8, dither ? " dither" : "");
+		for (k = 0; k < 1 + fbconvert_has_simd(src_bpp, dst_bpp); k++) {
+			double best = 1E30;
+			for (j = 0; j < iterations; j++) {
+				double start_time, t;
+				memcpy(buffer, source, size);
+				start_time = get_time_ms();
+				fbconvert_frame(buffer, width, height, src_bpp, dst_bpp, dither, k);
+				t = get_time_ms() - start_time;
+				if (t < best)
+					best = t;
+			}
+			if (k == 0)
+				memcpy(reference, buffer, (size_t)width * height * dst_bpp);
+			printf("%-22s %-8s %10.3f %12.1f", name, k == 0 ? "scalar" : fbconvert_simd_name(), best,
+				width * height / (best * 1000));
+			if (k == 1 && memcmp(reference, buffer, (size_t)width * height * dst_bpp) != 0) {
+				printf("  (differs from scalar result)");
+				ret = 1;
+			}
+			printf("\n");
+		}
+	}
+	free(source);
+	free(buffer);
+	free(reference);
+	return ret;
+}
+
+// Framebuffer memory throughput benchmark. Without a file, the framebuffer of the screen is mapped
+// (smem_len bytes) and a frame is the current mode. Otherwise, the file is mapped; if it is a
+// framebuffer device, its own mode is used, else it is a regular file that is extended to the
+// frame size given with the command.
+
+static int run_fb_benchmark(const struct command_args *c) {
+	struct fb_var_screeninfo var_screeninfo;
+	struct fb_fix_screeninfo fix_screeninfo;
+	char name[64];
+	size_t frame_size, length;
+	void *buffer;
+	int width = c->width, height = c->height, bits_per_pixel = c->bytes_per_pixel * 8;
+	int fd = - 1;
+	if (bench_cpu >= 0 && fbbench_pin_cpu(bench_cpu) < 0) {
+		fprintf(stderr, "Error: could not pin to CPU %d: %s\n", bench_cpu, strerror(errno));
+		return 1;
+	}
+	if (c->bench_file == NULL) {
+		int ret = fb_ioctl(c->screen, FBIOGET_VSCREENINFO, &var_screeninfo);
+		if (ret < 0) {
+			fprintf(stderr, "Error: ioctl(FBIOGET_VSCREENINFO) failed for /dev/fb%d: %s\n", c->screen,
+				strerror(errno));
+			exit_command(ret);
+		}
+		ret = fb_ioctl(c->screen, FBIOGET_FSCREENINFO, &fix_screeninfo);
+		if (ret < 0) {
+			fprintf(stderr, "Error: ioctl(FBIOGET_FSCREENINFO) failed for /dev/fb%d: %s\n", c->screen,
+				strerror(errno));
+			exit_command(ret);
+		}
+		snprintf(name, sizeof(name), "/dev/fb%d", c->screen);
+		length = get_framebuffer_size(c->screen);
+	}
+	else {
+		struct stat st;
+		fd = open(c->bench_file, O_RDWR | O_CREAT, 0644);
+		if (fd < 0 || fstat(fd, &st) < 0) {
+			fprintf(stderr, "Error: could not open %s: %s\n", c->bench_file, strerror(errno));
+			return 1;
+		}
+		snprintf(name, sizeof(name), "%s", c->bench_file);
+		if (S_ISCHR(st.st_mode) && ioctl(fd, FBIOGET_VSCREENINFO, &var_screeninfo) == 0 &&
+		ioctl(fd, FBIOGET_FSCREENINFO, &fix_screeninfo) == 0)
+			length = fix_screeninfo.smem_len;
+		else {
+			memset(&var_screeninfo, 0, sizeof(var_screeninfo));
+			var_screeninfo.xres = width;
+			var_screeninfo.yres = height;
+			var_screeninfo.bits_per_pixel = bits_per_pixel;
+			fix_screeninfo.line_length = width * c->bytes_per_pixel;
+			length = (size_t)fix_screeninfo.line_length * height;
+			if (!S_ISCHR(st.st_mode) && st.st_size < length && ftruncate(fd, length) < 0) {
+				fprintf(stderr, "Error: could not extend %s: %s\n", c->bench_file, strerror(errno));
+				close(fd);
+				return 1;
+			}
+		}
+	}
+	width = var_screeninfo.xres;
+	height = var_screeninfo.yres;
+	bits_per_pixel = var_screeninfo.bits_per_pixel;
+	frame_size = (size_t)fix_screeninfo.line_length * height;
+	if (frame_size == 0 || frame_size > length) {
+		printf("The current mode doesn't fit into the %zu bytes of %s.\n", length, name);
+		if (fd >= 0)
+			close(fd);
+		return 1;
+	}
+	if (fd >= 0)
+		buffer = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	else
+		buffer = backend->fb_mmap(c->screen, length);
+	if (buffer == MAP_FAILED) {
+		fprintf(stderr, "Error: mmap of %s failed: %s\n", name, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return 1;
+	}
+	printf("Framebuffer benchmark of %s (%zu bytes mapped), %d x %d at %dbpp, %zu bytes per frame, "
+		"%d frames", name, length, width, height, bits_per_pixel, frame_size, c->iterations);
+	if (bench_cpu >= 0)
+		printf(", pinned to CPU %d", bench_cpu);
+	printf(":\n");
+	fbbench_run(buffer, frame_size, c->iterations);
+	if (fd >= 0) {
+		munmap(buffer, length);
+		close(fd);
+	}
+	else
+		backend->fb_munmap(c->screen, buffer, length);
+	return 0;
+}
+
+// Target that restores the given state of a screen with apply_screen_targets.
+
+static void screen_state_target(const struct screen_state *state, struct screen_target *t) {
+	memset(t, 0, sizeof(*t));
+	t->given = 1;
+	t->output_type = state->output_type;
+	t->mode = state->output_type == DISP_OUTPUT_TYPE_HDMI ? state->mode : - 1;
+	t->scaler = - 1;
+	if (state->output_type != DISP_OUTPUT_TYPE_HDMI && state->output_type != DISP_OUTPUT_TYPE_LCD)
+		return;
+	t->bytes_per_pixel = state->bytes_per_pixel;
+	t->src_width = state->console_width;
+	t->src_height = state->console_height;
+	t->virtual_height = state->console_height_virtual;
+	t->scaler = state->layer_mode == DISP_LAYER_WORK_MODE_SCALER;
+	if (t->scaler) {
+		t->scn_width = state->scn_width;
+		t->scn_height = state->scn_height;
+	}
+}
+
+// Save the state of both screens to a file, as apply settings that restore it: a line with
+// STATE_FILE_MAGIC and the format version, followed by a line per screen with the output type,
+// HDMI mode, pixel depth (which determines the layer framebuffer format), console framebuffer
+// size and virtual height, and the layer working mode and screen window. The file is replaced
+// atomically. Returns the exit code.
+
+static int save_display_state(const char *file) {
+	struct screen_state state[2];
+	char tmp_file[256];
+	FILE *f;
+	int screen, ret;
+	for (screen = 0; screen < 2; screen++) {
+		ret = read_screen_state(screen, &state[screen]);
+		if (ret < 0)
+			return ret;
+		if (state[screen].output_type != DISP_OUTPUT_TYPE_NONE &&
+		state[screen].output_type != DISP_OUTPUT_TYPE_HDMI && state[screen].output_type != DISP_OUTPUT_TYPE_LCD) {
+			printf("Cannot save the state of screen %d because it has %s output.\n", screen,
+				output_type_str(state[screen].output_type));
+			return 1;
+		}
+	}
+	snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", file);
+	f = fopen(tmp_file, "w");
+	if (f == NULL) {
+		fprintf(stderr, "Error: could not create %s: %s\n", tmp_file, strerror(errno));
+		return 1;
+	}
+	fprintf(f, "%s %d\n", STATE_FILE_MAGIC, STATE_FILE_VERSION);
+	for (screen = 0; screen < 2; screen++) {
+		struct screen_target t;
+		screen_state_target(&state[screen], &t);
+		if (t.output_type == DISP_OUTPUT_TYPE_NONE) {
+			fprintf(f, "%d:output=off\n", screen);
+			continue;
+		}
+		fprintf(f, "%d:output=%s", screen, t.output_type == DISP_OUTPUT_TYPE_HDMI ? "hdmi" : "lcd");
+		if (t.output_type == DISP_OUTPUT_TYPE_HDMI) {
+			if (t.mode == DISP_TV_MODE_EDID)
+				fprintf(f, " %d:mode=edid", screen);
+			else
+				fprintf(f, " %d:mode=%d", screen, t.mode);
+		}
+		fprintf(f, " %d:depth=%d %d:src=%dx%d %d:virtual=%d %d:scaler=%s", screen, t.bytes_per_pixel * 8,
+			screen, t.src_width, t.src_height, screen, t.virtual_height, screen, t.scaler ? "on" : "off");
+		if (t.scaler)
+			fprintf(f, " %d:scn=%dx%d", screen, t.scn_width, t.scn_height);
+		fprintf(f, "\n");
+	}
+	if (fflush(f) != 0 || fsync(fileno(f)) < 0) {
+		fprintf(stderr, "Error: could not write %s: %s\n", tmp_file, strerror(errno));
+		fclose(f);
+		unlink(tmp_file);
+		return 1;
+	}
+	fclose(f);
+	if (rename(tmp_file, file) < 0) {
+		fprintf(stderr, "Error: could not replace %s: %s\n", file, strerror(errno));
+		unlink(tmp_file);
+		return 1;
+	}
+	for (screen = 0; screen < 2; screen++) {
+		if (state[screen].output_type == DISP_OUTPUT_TYPE_NONE)
+			printf("Screen %d: output off.\n", screen);
+		else
+			printf("Screen %d: %s output, %d x %d, %dbpp%s.\n", screen, output_type_str(state[screen].output_type),
+				state[screen].console_width, state[screen].console_height, state[screen].bytes_per_pixel * 8,
+				state[screen].layer_mode == DISP_LAYER_WORK_MODE_SCALER ? ", scaler" : "");
+	}
+	printf("Display state saved to %s.\n", file);
+	return 0;
+}
+
+// Restore the state saved with save_display_state. It is applied like the apply command without
+// checking mode support (the state was in use before), so only the steps that change something
+// are performed, with a single console framebuffer change per screen, and nothing is done when
+// the display is already in the saved state. Returns the exit code.
+
+static int restore_display_state(const char *file) {
+	struct screen_target target[2];
+	char line[512], magic[32];
+	FILE *f;
+	int version, screen;
+	f = fopen(file, "r");
+	if (f == NULL) {
+		fprintf(stderr, "Error: could not open %s: %s\n", file, strerror(errno));
+		return 1;
+	}
+	if (fgets(line, sizeof(line), f) == NULL || sscanf(line, "%31s %d", magic, &version) != 2 ||
+	strcmp(magic, STATE_FILE_MAGIC) != 0) {
+		printf("%s is not a display state file.\n", file);
+		fclose(f);
+		return 1;
+	}
+	if (version != STATE_FILE_VERSION) {
+		printf("%s has display state format version %d, only version %d is supported.\n", file, version,
+			STATE_FILE_VERSION);
+		fclose(f);
+		return 1;
+	}
+	memset(target, 0, sizeof(target));
+	for (screen = 0; screen < 2; screen++) {
+		target[screen].output_type = - 1;
+		target[screen].mode = - 1;
+		target[screen].scaler = - 1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char *setting, *saveptr;
+		for (setting = strtok_r(line, " \t\n", &saveptr); setting != NULL;
+		setting = strtok_r(NULL, " \t\n", &saveptr))
+			if (parse_screen_target(setting, 0, target) < 0) {
+				printf("Invalid setting %s in %s.\n", setting, file);
+				fclose(f);
+				return 1;
+			}
+	}
+	fclose(f);
+	return apply_screen_targets(target, 0);
+}
+
+// Measure the memory bandwidth left to applications in each display configuration. Every
+// configuration is applied like the apply command, after which the STREAM kernels are run on 1 up
+// to nu_threads threads. The output and HDMI mode default to those of the initial state rather
+// than the previous configuration. A configuration that can't be applied is reported and skipped.
+// The initial state of the screens is restored afterwards.
+
+// Width of the configuration column of membench and planmem: the longest configuration name, and
+// at least 24 characters.
+
+static int config_name_width(const struct command_args *c) {
+	int i, width = 24;
+	for (i = 0; i < c->nu_configs; i++)
+		if (strlen(c->config_name[i]) > width)
+			width = strlen(c->config_name[i]);
+	return width;
+}
+
+static int run_memory_benchmark(const struct command_args *c) {
+	struct screen_state initial_state[2];
+	struct screen_target restore_target[2];
+	// The triad bandwidth of the first configuration for each number of threads, for the number
+	// of threads it could be run on.
+	double baseline[64] = { 0 };
+	jmp_buf jmp, *saved_jmp_buf;
+	int baseline_config = - 1, nu_baseline = 0;
+	int name_width = config_name_width(c);
+	int i, screen, threads, k, ret;
+
+	memset(restore_target, 0, sizeof(restore_target));
+	for (screen = 0; screen < 2; screen++)
+		for (i = 0; i < c->nu_configs; i++)
+			if (c->config_target[i][screen].given && !restore_target[screen].given) {
+				ret = read_screen_state(screen, &initial_state[screen]);
+				if (ret < 0)
+					return ret;
+				screen_state_target(&initial_state[screen], &restore_target[screen]);
+			}
+
+	printf("Memory bandwidth in MB/s, %d MB per array and thread, best of %d trials:\n",
+		(int)(MEMBENCH_ELEMENTS * sizeof(double) / (1024 * 1024)), MEMBENCH_TRIALS);
+	printf("%-*s %7s %8s", name_width, "configuration", "threads", "scanout");
+	for (k = 0; k < MEMBENCH_NU_KERNELS; k++)
+		printf(" %8s", membench_kernel_name[k]);
+	printf(" %8s\n", "triad %");
+	saved_jmp_buf = command_jmp_buf;
+	for (i = 0; i < c->nu_configs; i++) {
+		struct screen_scanout scanout[2];
+		struct screen_target target[2];
+		memcpy(target, c->config_target[i], sizeof(target));
+		for (screen = 0; screen < 2; screen++) {
+			struct screen_target *t = &target[screen];
+			if (!t->given)
+				continue;
+			if (t->output_type < 0)
+				t->output_type = initial_state[screen].output_type;
+			if (t->output_type == DISP_OUTPUT_TYPE_HDMI && t->mode < 0)
+				t->mode = initial_state[screen].mode;
+		}
+		fflush(stdout);
+		if (setjmp(jmp) == 0) {
+			command_jmp_buf = &jmp;
+			ret = apply_screen_targets(target, 1);
+		}
+		else
+			ret = command_exit_code;
+		command_jmp_buf = saved_jmp_buf;
+		if (ret != 0) {
+			printf("%-*s could not be applied (exit code %d).\n", name_width, c->config_name[i], ret);
+			continue;
+		}
+		if (baseline_config < 0)
+			baseline_config = i;
+		get_screen_scanout(0, &scanout[0]);
+		get_screen_scanout(1, &scanout[1]);
+		for (threads = 1; threads <= c->nu_threads; threads++) {
+			double bandwidth[MEMBENCH_NU_KERNELS];
+			if (membench_run(threads, MEMBENCH_ELEMENTS, MEMBENCH_TRIALS, bandwidth) < 0) {
+				printf("Could not run the benchmark on %d threads.\n", threads);
+				break;
+			}
+			if (i == baseline_config) {
+				baseline[threads - 1] = bandwidth[MEMBENCH_TRIAD];
+				nu_baseline = threads;
+			}
+			printf("%-*s %7d %8.1f", name_width, c->config_name[i], threads,
+				(scanout[0].bandwidth + scanout[1].bandwidth) / 1000000);
+			for (k = 0; k < MEMBENCH_NU_KERNELS; k++)
+				printf(" %8.1f", bandwidth[k] / 1000000);
+			if (threads <= nu_baseline && baseline[threads - 1] > 0)
+				printf(" %7.1f%%\n", bandwidth[MEMBENCH_TRIAD] * 100 / baseline[threads - 1]);
+			else
+				printf(" %8s\n", "-");
+			fflush(stdout);
+		}
+	}
+	printf("Restoring the initial display state.\n");
+	return apply_screen_targets(restore_target, 0);
+}
+
+// Compute the smallest framebuffer memory reservation (the sunxi_fb_mem_reserve kernel option, in
+// MB) that covers every configuration given for screens 0 and 1. The framebuffer of a screen
+// holds buffers times the console framebuffer, which is the layer source window: the display
+// size, the src= size when the scaler scales it up, or the size given by --renderscale (aligned
+// to 16 pixels). Each framebuffer is allocated in whole pages. The console framebuffer of a
+// screen without configurations, or with the output off, keeps its current size. The memory of
+// each /dev/fbN that is unused in the current configuration and compared to the plan is reported
+// as well.
+
+#define PLANMEM_PAGE_SIZE 4096
+
+static int run_memory_plan(const struct command_args *c) {
+	struct screen_state state[2];
+	int current_size[2], required[2], required_config[2];
+	int screen, i, ret;
+	int total_required = 0, total_smem = 0;
+	int reserve_mb;
+	int name_width = config_name_width(c);
+
+	for (screen = 0; screen < 2; screen++) {
+		ret = read_screen_state(screen, &state[screen]);
+		if (ret < 0)
+			return ret;
+		current_size[screen] = (state[screen].console_width * state[screen].console_height *
+			state[screen].bytes_per_pixel * nu_framebuffer_buffers + PLANMEM_PAGE_SIZE - 1) &
+			~(PLANMEM_PAGE_SIZE - 1);
+		required[screen] = 0;
+		required_config[screen] = - 1;
+	}
+	printf("%-*s %6s %13s %6s %7s %10s\n", name_width, "configuration", "screen", "framebuffer", "depth", "buffers",
+		"memory");
+	for (i = 0; i < c->nu_configs; i++)
+		for (screen = 0; screen < 2; screen++) {
+			const struct screen_target *t = &c->config_target[i][screen];
+			int output_type, width, height, bytes_per_pixel, buffers, size;
+			if (!t->given)
+				continue;
+			output_type = t->output_type >= 0 ? t->output_type : state[screen].output_type;
+			bytes_per_pixel = t->bytes_per_pixel > 0 ? t->bytes_per_pixel : state[screen].bytes_per_pixel;
+			buffers = c->config_buffers[i][screen] > 0 ? c->config_buffers[i][screen] : nu_framebuffer_buffers;
+			if (t->src_width > 0) {
+				width = t->src_width;
+				height = t->src_height;
+			}
+			else
+			if (t->mode >= 0 || (output_type == DISP_OUTPUT_TYPE_HDMI && state[screen].mode >= 0)) {
+				int mode = t->mode >= 0 ? t->mode : state[screen].mode;
+				if (!mode_valid(mode)) {
+					printf("Configuration %s: the size of the current HDMI mode of screen %d is not known, "
+						"give src=<width>x<height>.\n", c->config_name[i], screen);
+					return 1;
+				}
+				width = mode_timing[mode].width;
+				height = mode_timing[mode].height;
+				if (render_scale > 0 && render_scale < 1)
+					render_scaled_size(width, height, &width, &height);
+			}
+			else
+			if (output_type == DISP_OUTPUT_TYPE_NONE) {
+				width = state[screen].console_width;
+				height = state[screen].console_height;
+				bytes_per_pixel = state[screen].bytes_per_pixel;
+			}
+			else
+			if (output_type == state[screen].output_type) {
+				unsigned long args[4] = { 0 };
+				args[0] = screen;
+				width = disp_ioctl(DISP_CMD_SCN_GET_WIDTH, args);
+				args[0] = screen;
+				height = disp_ioctl(DISP_CMD_SCN_GET_HEIGHT, args);
+			}
+			else {
+				printf("Configuration %s: the display size of screen %d with %s output is not known, "
+					"give src=<width>x<height>.\n", c->config_name[i], screen, output_type_str(output_type));
+				return 1;
+			}
+			size = (width * height * bytes_per_pixel * buffers + PLANMEM_PAGE_SIZE - 1) & ~(PLANMEM_PAGE_SIZE - 1);
+			printf("%-*s %6d %6d x %-4d %4dbpp %7d %7.2f MB\n", name_width, c->config_name[i], screen,
+				width, height, bytes_per_pixel * 8, buffers, (double)size / (1024 * 1024));
+			if (size > required[screen]) {
+				required[screen] = size;
+				required_config[screen] = i;
+			}
+		}
+	for (screen = 0; screen < 2; screen++) {
+		if (required_config[screen] < 0) {
+			required[screen] = current_size[screen];
+			printf("Screen %d needs %.2f MB (current console framebuffer).\n", screen,
+				(double)required[screen] / (1024 * 1024));
+		}
+		else
+			printf("Screen %d needs %.2f MB (%s).\n", screen, (double)required[screen] / (1024 * 1024),
+				c->config_name[required_config[screen]]);
+		total_required += required[screen];
+	}
+	reserve_mb = (total_required + 1024 * 1024 - 1) / (1024 * 1024);
+	printf("Smallest reservation: %.2f MB, sunxi_fb_mem_reserve=%d.\n", (double)total_required / (1024 * 1024),
+		reserve_mb);
+	printf("Current framebuffer memory:\n");
+	for (screen = 0; screen < 2; screen++) {
+		const struct screen_state *s = &state[screen];
+		int in_use = s->console_width * s->console_height_virtual * s->bytes_per_pixel;
+		printf("/dev/fb%d: %.2f MB, %.2f MB in use (%d x %d, %dbpp), %.2f MB unused; the plan needs %.2f MB.\n",
+			screen, (double)s->smem_len / (1024 * 1024), (double)in_use / (1024 * 1024), s->console_width,
+			s->console_height_virtual, s->bytes_per_pixel * 8, (double)(s->smem_len - in_use) / (1024 * 1024),
+			(double)required[screen] / (1024 * 1024));
+		total_smem += s->smem_len;
+	}
+	if (total_smem >= reserve_mb * 1024 * 1024)
+		printf("Total %.2f MB; the plan saves %.2f MB.\n", (double)total_smem / (1024 * 1024),
+			(double)total_smem / (1024 * 1024) - reserve_mb);
+	else
+		printf("Total %.2f MB; the plan needs %.2f MB more.\n", (double)total_smem / (1024 * 1024),
+			reserve_mb - (double)total_smem / (1024 * 1024));
+	return 0;
+}
+
+// Page flipping benchmark. Cycles through the buffers of the console framebuffer (set up with
+// --buffers) by panning with FBIOPAN_DISPLAY, waiting for the vertical sync with FBIO_WAITFORVSYNC
+// after each flip, optionally after filling the next buffer like a renderer would. Reports the
+// time taken by the pan, the flip latency (from the pan until the vsync) and the number of missed
+// vsyncs, i.e. frame intervals longer than one refresh period.
+
+static int run_flip_benchmark(const struct command_args *c) {
+	struct fb_var_screeninfo var_screeninfo;
+	struct fb_fix_screeninfo fix_screeninfo;
+	struct screen_scanout scanout;
+	double *pan_time, *flip_time, *interval;
+	double period, previous_vsync = 0;
+	unsigned char *buffer = NULL;
+	size_t buffer_size = 0;
+	int nu_buffers, missed = 0, late_flips = 0;
+	int i, ret;
+
+	ret = fb_ioctl(c->screen, FBIOGET_VSCREENINFO, &var_screeninfo);
+	if (ret < 0) {
+		fprintf(stderr, "Error: ioctl(FBIOGET_VSCREENINFO) failed for /dev/fb%d: %s\n", c->screen,
+			strerror(errno));
+		exit_command(ret);
+	}
+	nu_buffers = var_screeninfo.yres_virtual / var_screeninfo.yres;
+	if (nu_buffers < 2) {
+		printf("The console framebuffer of screen %d has a single buffer; set the number of buffers with "
+			"--buffers when changing the mode.\n", c->screen);
+		return 1;
+	}
+	get_screen_scanout(c->screen, &scanout);
+	if (scanout.output_type == DISP_OUTPUT_TYPE_NONE) {
+		printf("The output of screen %d is disabled.\n", c->screen);
+		return 1;
+	}
+	period = 1000.0 / scanout.refresh;
+	if (c->fill) {
+		fb_ioctl(c->screen, FBIOGET_FSCREENINFO, &fix_screeninfo);
+		buffer_size = (size_t)fix_screeninfo.line_length * var_screeninfo.yres;
+		buffer = backend->fb_mmap(c->screen, buffer_size * nu_buffers);
+		if (buffer == MAP_FAILED) {
+			fprintf(stderr, "Error: mmap of /dev/fb%d failed: %s\n", c->screen, strerror(errno));
+			return 1;
+		}
+	}
+	pan_time = malloc(c->iterations * sizeof(double));
+	flip_time = malloc(c->iterations * sizeof(double));
+	interval = malloc(c->iterations * sizeof(double));
+	if (pan_time == NULL || flip_time == NULL || interval == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit_command(1);
+	}
+	printf("Flipping %d buffers of %d x %d at %dbpp on screen %d (%d Hz), %d flips%s.\n", nu_buffers,
+		var_screeninfo.xres, var_screeninfo.yres, var_screeninfo.bits_per_pixel, c->screen, scanout.refresh,
+		c->iterations, c->fill ? ", filling each buffer before it is shown" : "");
+	for (i = 0; i < c->iterations; i++) {
+		int next = (var_screeninfo.yoffset / var_screeninfo.yres + 1) % nu_buffers;
+		double start_time, pan_end_time, vsync_time;
+		__u32 crtc = 0;
+		if (c->fill)
+			memset(buffer + buffer_size * next, i, buffer_size);
+		var_screeninfo.yoffset = next * var_screeninfo.yres;
+		start_time = get_time_ms();
+		ret = fb_ioctl(c->screen, FBIOPAN_DISPLAY, &var_screeninfo);
+		pan_end_time = get_time_ms();
+		if (ret < 0) {
+			fprintf(stderr, "Error: ioctl(FBIOPAN_DISPLAY) failed for /dev/fb%d: %s\n", c->screen,
+				strerror(errno));
+			exit_command(ret);
+		}
+		ret = fb_ioctl(c->screen, FBIO_WAITFORVSYNC, &crtc);
+		vsync_time = get_time_ms();
+		if (ret < 0) {
+			fprintf(stderr, "Error: ioctl(FBIO_WAITFORVSYNC) failed for /dev/fb%d: %s\n", c->screen,
+				strerror(errno));
+			exit_command(ret);
+		}
+		pan_time[i] = pan_end_time - start_time;
+		flip_time[i] = vsync_time - start_time;
+		if (flip_time[i] > period * 1.5)
+			late_flips++;
+		interval[i] = i == 0 ? period : vsync_time - previous_vsync;
+		// An interval of n periods means n - 1 vsyncs without a new frame.
+		if (interval[i] > period * 1.5)
+			missed += (int)(interval[i] / period + 0.5) - 1;
+		previous_vsync = vsync_time;
+	}
+	// Show the first buffer again.
+	var_screeninfo.yoffset = 0;
+	fb_ioctl(c->screen, FBIOPAN_DISPLAY, &var_screeninfo);
+	if (c->fill)
+		backend->fb_munmap(c->screen, buffer, buffer_size * nu_buffers);
+	qsort(pan_time, c->iterations, sizeof(double), compare_double);
+	qsort(flip_time, c->iterations, sizeof(double), compare_double);
+	qsort(interval, c->iterations, sizeof(double), compare_double);
+	printf("%-22s %10s %10s %10s\n", "", "min", "median", "p99");
+	printf("%-22s %10.3f %10.3f %10.3f\n", "pan (ms)", pan_time[0], pan_time[c->iterations / 2],
+		pan_time[c->iterations * 99 / 100]);
+	printf("%-22s %10.3f %10.3f %10.3f\n", "flip to vsync (ms)", flip_time[0], flip_time[c->iterations / 2],
+		flip_time[c->iterations * 99 / 100]);
+	printf("%-22s %10.3f %10.3f %10.3f\n", "frame interval (ms)", interval[0], interval[c->iterations / 2],
+		interval[c->iterations * 99 / 100]);
+	printf("Missed vsyncs: %d (%.1f%% of %d frames), flips taking longer than a period: %d.\n", missed,
+		missed * 100.0 / (c->iterations + missed), c->iterations + missed, late_flips);
+	free(pan_time);
+	free(flip_time);
+	free(interval);
+	return 0;
+}
+
+// Console throughput benchmark. Writes a fixed text stream of full-width lines to a terminal (by
+// default /dev/tty0, the foreground virtual console), one write per line like a program tailing
+// a log, and reports the number of lines per second. On a framebuffer console most of the time
+// is spent scrolling, which depends on the mode, the pixel depth and --panscroll. A regular file
+// outside /dev can be given instead of a terminal for a baseline without the console; it is
+// created or truncated.
+
+static int run_console_benchmark(const struct command_args *c) {
+	const char *tty = c->bench_file != NULL ? c->bench_file : "/dev/tty0";
+	int to_file = strncmp(tty, "/dev/", 5) != 0;
+	struct winsize winsize;
+	char line[512];
+	double start_time, t;
+	int columns = 80, rows = 25;
+	int fd, i, j, n;
+	size_t bytes = 0;
+	fd = open(tty, to_file ? O_WRONLY | O_NOCTTY | O_CREAT | O_TRUNC : O_WRONLY | O_NOCTTY, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Error: could not open %s: %s\n", tty, strerror(errno));
+		return 1;
+	}
+	if (!to_file && !isatty(fd)) {
+		fprintf(stderr, "Error: %s is not a terminal.\n", tty);
+		close(fd);
+		return 1;
+	}
+	if (ioctl(fd, TIOCGWINSZ, &winsize) == 0 && winsize.ws_col > 0) {
+		columns = winsize.ws_col;
+		rows = winsize.ws_row;
+	}
+	if (columns > sizeof(line) - 1)
+		columns = sizeof(line) - 1;
+	start_time = get_time_ms();
+	for (i = 0; i < c->iterations; i++) {
+		// Fill the line except for the last column, so that the terminal doesn't wrap.
+		n = snprintf(line, sizeof(line), "%06d ", i);
+		for (j = n; j < columns - 1; j++)
+			line[j] = '!' + (i + j) % 94;
+		line[j++] = '\n';
+		if (write(fd, line, j) != j) {
+			fprintf(stderr, "Error: write to %s failed: %s\n", tty, strerror(errno));
+			close(fd);
+			return 1;
+		}
+		bytes += j;
+	}
+	if (isatty(fd))
+		tcdrain(fd);
+	t = (get_time_ms() - start_time) / 1000;
+	close(fd);
+	printf("Console benchmark on %s (%d x %d characters): %d lines in %.3f s, %.0f lines/s, %.1f screens/s, "
+		"%.1f KB/s.\n", tty, columns, rows, c->iterations, t, c->iterations / t, c->iterations / t / rows,
+		bytes / t / 1024);
+	return 0;
+}
+
+// Set a HDMI mode and pixel depth on a screen through apply_screen_targets, which only changes
+// what differs from the current state. The mode support has already been checked.
+
+static int apply_hdmi_mode(int screen, int mode, int bytes_per_pixel) {
+	struct screen_target target[2];
+	memset(target, 0, sizeof(target));
+	target[screen].given = 1;
+	target[screen].output_type = DISP_OUTPUT_TYPE_HDMI;
+	target[screen].mode = mode;
+	target[screen].bytes_per_pixel = bytes_per_pixel;
+	target[screen].scaler = - 1;
+	return apply_screen_targets(target, 0);
+}
+
+// Execute a command after the display driver has been opened. Returns the exit code.
+
+static int execute_command(const struct command_args *c) {
+	unsigned long args[4] = { 0 };
+	int command = c->command;
+	int mode = c->mode;
+	int bytes_per_pixel = c->bytes_per_pixel;
+	int screen = c->screen;
+	int ret, width, height;
+	struct fb_var_screeninfo var_screeninfo;
+	int previous_bytes_per_pixel;
+	int previous_width, previous_height;
+
+		if (command == COMMAND_BANDWIDTH)
+			return show_bandwidth(screen);
+
+		if (command == COMMAND_CONVERT_BENCH)
+			return run_convert_benchmark(c->width, c->height, c->iterations);
+
+		if (command == COMMAND_FB_BENCH)
+			return run_fb_benchmark(c);
+
+		if (command == COMMAND_MEM_BENCH)
+			return run_memory_benchmark(c);
+
+		if (command == COMMAND_FLIP_BENCH)
+			return run_flip_benchmark(c);
+
+		if (command == COMMAND_CONSOLE_BENCH)
+			return run_console_benchmark(c);
+
+		if (command == COMMAND_PLAN_MEM)
+			return run_memory_plan(c);
+
+		if (command == COMMAND_SAVE)
+			return save_display_state(c->state_file);
+
+		if (command == COMMAND_RESTORE)
+			return restore_display_state(c->state_file);
+
+		if (command == COMMAND_RECORD_DIFF)
+			return record_diff(c->record_file[0], c->record_file[1]);
+
+		if (command == COMMAND_EDID)
+			return show_edid_files(c->nu_edid_files, c->edid_files);
+
+		if (command == COMMAND_APPLY)
+			return apply_screen_targets(c->target, !c->force);
+
+		if (command == COMMAND_AUTO_MODE) {
+			struct command_args auto_command = *c;
+			int output_type;
+			args[0] = screen;
+			output_type = disp_ioctl(DISP_CMD_GET_OUTPUT_TYPE, args);
+			if (output_type != DISP_OUTPUT_TYPE_HDMI && output_type != DISP_OUTPUT_TYPE_LCD &&
+			output_type != DISP_OUTPUT_TYPE_NONE) {
+				printf("Cannot select a HDMI mode because the screen has %s output.\n",
+					output_type_str(output_type));
+				return 1;
+			}
+			mode = select_auto_mode(screen, c->auto_mode_policy, c->auto_mode_parameter, bytes_per_pixel,
+				&bytes_per_pixel);
+			if (mode < 0) {
+				printf("No supported HDMI mode meets the requirements and fits into the framebuffer.\n");
+				return 1;
+			}
+			printf("Selected HDMI mode %d (%s) at %dbpp, scanout bandwidth %.1f MB/s.\n", mode, mode_timing[mode].name,
+				bytes_per_pixel * 8, mode_scanout_bandwidth(mode, bytes_per_pixel) / 1000000);
+			// Support has already been checked, so use the force variants of the commands.
+			if (output_type == DISP_OUTPUT_TYPE_HDMI)
+				auto_command.command = COMMAND_CHANGE_HDMI_MODE_FORCE;
+			else
+			if (output_type == DISP_OUTPUT_TYPE_LCD)
+				auto_command.command = COMMAND_SWITCH_TO_HDMI_FORCE;
+			else
+				auto_command.command = COMMAND_ENABLE_HDMI_FORCE;
+			auto_command.mode = mode;
+			auto_command.bytes_per_pixel = bytes_per_pixel;
+			return execute_command(&auto_command);
+		}
+
+		if (command == COMMAND_INFO) {
+			struct fb_fix_screeninfo fix_screeninfo;
+			int i;
+			for (i = 0; i < 2; i++) {
+				ret = fb_ioctl(i, FBIOGET_VSCREENINFO, &var_screeninfo);
+				if (ret < 0) {
+					fprintf(stderr, "Error: ioctl(FBIOGET_VSCREENINFO) failed for /dev/fb%d: %s\n", i, strerror(-ret));
+					return ret;
+				}
+				printf("Linux info for screen %d (/dev/fb%d): size %d x %d, %d bits per pixel.\n", i, i,
+					var_screeninfo.xres, var_screeninfo.yres, var_screeninfo.bits_per_pixel);
+			}
+			for (i = 0; i < 2; i++) {
+				ret = fb_ioctl(i, FBIOGET_FSCREENINFO, &fix_screeninfo);
+				if (ret < 0) {
+					fprintf(stderr, "Error: ioctl(FBIOGET_FSCREENINFO) failed for /dev/fb%d: %s\n", i, strerror(-ret));
+					return ret;
+				}
+				printf("Linux info for screen %d (/dev/fb%d): framebuffer size %.2f MB.\n", i, i,
+					(float)fix_screeninfo.smem_len / (1024 * 1024));
+			}
+			for (screen = 0; screen <= 1; screen++) {
+				__disp_output_type_t output_type;
+				__disp_layer_info_t layer_info;
+				__disp_fb_t fb_info;
+				printf("Screen %d:\n", screen);
+
+				args[0] = screen;
+				ret = disp_ioctl(DISP_CMD_SCN_GET_WIDTH, args);
+				if (ret < 0) {
+					fprintf(stderr, "Error: ioctl(SCN_GET_WIDTH) failed: %s\n",
+						strerror(-ret));
+					return ret;
+				}
+				width = ret;
+
+				args[0] = screen;
+				ret = disp_ioctl(DISP_CMD_SCN_GET_HEIGHT, args);
+				if (ret < 0) {
+					fprintf(stderr, "Error: ioctl(SCN_GET_HEIGHT) failed: %s\n", strerror(-ret));
+					return ret;
+				}
+				height = ret;
+				printf("	Display dimensions are %d x %d.\n", width, height);
+
+				args[0] = screen;
+				output_type = disp_ioctl(DISP_CMD_GET_OUTPUT_TYPE, args);
+				printf("	Output type is %s.\n", output_type_str(output_type));
+
+				if (output_type == DISP_OUTPUT_TYPE_NONE)
+					continue;
+				// The layer parameters include the layer framebuffer.
+				get_layer_para(screen, &layer_info);
+				get_layer_fb(screen, &fb_info);
+				int bytes_per_pixel = format_bytes_per_pixel(fb_info.format);
+				printf("	Framebuffer dimensions are %d x %d (%.2f MB).\n", fb_info.size.width, fb_info.size.height,
+					(float)(bytes_per_pixel * fb_info.size.width * fb_info.size.height) / (1024 * 1024));
+				printf("	Framebuffer pixel format = 0x%02X (%dbpp).\n", fb_info.format, bytes_per_pixel * 8);
+				printf("	Layer working mode is %s.\n", layer_mode_str(layer_info.mode));
+				printf("	Layer source window size is %d x %d.\n", layer_info.src_win.width,
+					layer_info.src_win.height);
+				printf("	Layer screen window size is %d x %d.\n", layer_info.scn_win.width,
+					layer_info.scn_win.height);
+				if (output_type == DISP_OUTPUT_TYPE_HDMI) {
+					// Get the current HDMI mode.
+					args[0] = screen;
+					int current_mode = disp_ioctl(DISP_CMD_HDMI_GET_MODE, args);
+					if (current_mode == DISP_TV_MODE_EDID) {
+						const struct edid_timing *t = get_edid_preferred_timing();
+						if (t != NULL)
+							printf("Current HDMI mode: EDID (%d x %d%s %d Hz)\n", t->width, t->height,
+								t->interlaced ? "i" : "", t->refresh);
+						else
+							printf("Current HDMI mode: EDID\n");
+					}
+					else
+						printf("Current HDMI mode: %d (%s)\n", current_mode, mode_timing[current_mode].name);
+					printf("Supported HDMI modes:\n");
+					for (i = 0; i < nu_modes; i++)
+						if (mode_valid(i)) {
+							ret = hdmi_mode_supported(screen, i);
+							if (ret == 1)
+								printf("%2d      %s\n", i, mode_timing[i].name);
+						}
+				}
+			}
+			return 0;
+		}
+
+
+	// Get the current bytes per pixel.
+	ret = fb_ioctl(0, FBIOGET_VSCREENINFO, &var_screeninfo);
+	if (ret < 0) {
+		fprintf(stderr, "Error: ioctl(FBIOGET_VSCREENINFO) failed for /dev/fb%d: %s\n", 0, strerror(-ret));
+		return ret;
+	}
+	if (var_screeninfo.bits_per_pixel != 16 && var_screeninfo.bits_per_pixel != 32 && var_screeninfo.bits_per_pixel != 24) {
+		printf("Unexpected bits per pixel value (%d).\n", var_screeninfo.bits_per_pixel);
+		return - 1;
+	}
+	previous_bytes_per_pixel = var_screeninfo.bits_per_pixel / 8;
+	previous_width = var_screeninfo.xres;
+	previous_height = var_screeninfo.yres;
+
+	if (command == COMMAND_SWITCH_TO_HDMI || command == COMMAND_SWITCH_TO_HDMI_FORCE) {
+		int output_type;
+		int need_to_set_console_size_16bpp_to_32bpp;
+
+		args[0] = screen;
+		output_type = disp_ioctl(DISP_CMD_GET_OUTPUT_TYPE, args);
+		if (output_type == DISP_OUTPUT_TYPE_HDMI) {
+			printf("Cannot switch to HDMI mode because HDMI is already enabled.\n");
+			return 1;
+		}
+		if (output_type != DISP_OUTPUT_TYPE_LCD) {
+			printf("Cannot change HDMI mode because LCD is not enabled.\n");
+			return 1;
+		}
+
+		if (command != COMMAND_SWITCH_TO_HDMI_FORCE) {
+			ret = hdmi_mode_supported(screen, mode);
+			if (ret == 0) {
+				printf("Specified HDMI mode is not supported by the display according to the display driver.\n");
+				command_error = A10DISP_ERROR_UNSUPPORTED;
+				return - 1;
+			}
+		}
+
+		// With a render scale, the console framebuffer is smaller than the display and is
+		// upscaled by the scaler.
+		if (render_scale > 0)
+			return apply_hdmi_mode(screen, mode, bytes_per_pixel);
+
+		// Check that the framebuffer is large enough.
+		check_framebuffer_size(screen, mode, bytes_per_pixel);
+
+		// Turn LCD off.
+		phase_begin(PHASE_BLACKOUT);
+		args[0] = screen;
+		disp_ioctl(DISP_CMD_LCD_OFF, args);
+
+		// When changing from 32bpp to 16bpp, change the pixel depth.
+		if (previous_bytes_per_pixel == 4 && bytes_per_pixel == 2)
+			set_framebuffer_console_pixel_depth(screen, bytes_per_pixel);
+
+		// When changing from 16bpp to 32bpp, and the new mode is smaller than the previous one,
+		// set the console and pixel depth with one command, otherwise only set the pixel depth.
+		need_to_set_console_size_16bpp_to_32bpp = 0;
+		if (previous_bytes_per_pixel == 2 && bytes_per_pixel == 4) {
+			if (mode_size(mode) < previous_width * previous_height) {
+				set_framebuffer_console_size_and_depth(screen, mode, bytes_per_pixel);
+			}
+			else {
+				set_framebuffer_console_pixel_depth(screen, bytes_per_pixel);
+				need_to_set_console_size_16bpp_to_32bpp = 1;
+			}
+		}
+
+		// Set the mode.
+		args[0] = screen;
+		args[1] = mode;
+		phase_begin(PHASE_SET_MODE);
+		ret = disp_ioctl(DISP_CMD_HDMI_SET_MODE, args);
+		phase_end(PHASE_SET_MODE);
+		if (ret < 0) {
+			fprintf(stderr, "Error: ioctl(DISP_CMD_HDMI_SET_MODE) failed: %s\n",
+					strerror(-ret));
+			return ret;
+		}
+
+		if (use_scaler_for_large_32bpp_modes)
+			if ((bytes_per_pixel == 4 || (bytes_per_pixel == 0 && previous_bytes_per_pixel == 4))
+			&& mode_size(mode) > 1280 * 1024) {
+				// Enable scaler for bigger modes at 32bpp.
+				enable_scaler_for_mode(screen, mode);
+			}
+		// When switching from LCD, we can assume scaler mode was disabled.
+
+		// Turn HDMI on again.
+		args[0] = screen;
+		disp_ioctl(DISP_CMD_HDMI_ON, args);
+		phase_end(PHASE_BLACKOUT);
+
+		if (!(previous_bytes_per_pixel == 2 && bytes_per_pixel == 4) || need_to_set_console_size_16bpp_to_32bpp)
+			set_framebuffer_console_size_to_screen_size(screen);
+	}
+	else
+	if (command == COMMAND_ENABLE_HDMI || command == COMMAND_ENABLE_HDMI_FORCE) {
+		int output_type;
+		int need_to_set_console_size_16bpp_to_32bpp;
+
+		args[0] = screen;
+		output_type = disp_ioctl(DISP_CMD_GET_OUTPUT_TYPE, args);
+		if (output_type == DISP_OUTPUT_TYPE_HDMI) {
+		       printf("Cannot enable HDMI mode because HDMI is already enabled.\n");
+			return 1;
+		}
+		if (output_type == DISP_OUTPUT_TYPE_LCD) {
+			printf("Cannot enable HDMI because LCD is enabled, use switchtohdmi command.\n");
+			return 1;
+		}
+
+		if (command != COMMAND_ENABLE_HDMI_FORCE) {
+			ret = hdmi_mode_supported(screen, mode);
+			if (ret == 0) {
+				printf("Specified HDMI mode is not supported by the display according to the display driver.\n");
+				command_error = A10DISP_ERROR_UNSUPPORTED;
+				return - 1;
+			}
+		}
+
+		// With a render scale, the console framebuffer is smaller than the display and is
+		// upscaled by the scaler.
+		if (render_scale > 0)
+			return apply_hdmi_mode(screen, mode, bytes_per_pixel);
+
+		// Check that the framebuffer is large enough.
+		check_framebuffer_size(screen, mode, bytes_per_pixel);
+
+		// When changing from 32bpp to 16bpp, change the pixel depth.
+		if (previous_bytes_per_pixel == 4 && bytes_per_pixel == 2)
+			set_framebuffer_console_pixel_depth(screen, bytes_per_pixel);
+
+		// When changing from 16bpp to 32bpp, and the new mode is smaller than the previous one,
+		// set the console and pixel depth with one command, otherwise only set the pixel depth.
+		need_to_set_console_size_16bpp_to_32bpp = 0;
+		if (previous_bytes_per_pixel == 2 && bytes_per_pixel == 4) {
+			if (mode_size(mode) < previous_width * previous_height) {
+				set_framebuffer_console_size_and_depth(screen, mode, bytes_per_pixel);
+			}
+			else {
+				set_framebuffer_console_pixel_depth(screen, bytes_per_pixel);
+				need_to_set_console_size_16bpp_to_32bpp = 1;
+			}
+		}
+
+		// Set the mode.
+		args[0] = screen;
+		args[1] = mode;
+		phase_begin(PHASE_SET_MODE);
+		ret = disp_ioctl(DISP_CMD_HDMI_SET_MODE, args);
+		phase_end(PHASE_SET_MODE);
+		if (ret < 0) {
+			fprintf(stderr, "Error: ioctl(DISP_CMD_HDMI_SET_MODE) failed: %s\n",
+					strerror(-ret));
+			return ret;
+		}
+
+		if (use_scaler_for_large_32bpp_modes)
+			if ((bytes_per_pixel == 4 || (bytes_per_pixel == 0 && previous_bytes_per_pixel == 4))
+			&& mode_size(mode) > 1280 * 1024) {
+				// Enable scaler for bigger modes at 32bpp.
+				enable_scaler_for_mode(screen, mode);
+			}
+		// When switching from LCD, we can assume scaler mode was disabled.
+
+		// Turn HDMI on again.
+		args[0] = screen;
+		disp_ioctl(DISP_CMD_HDMI_ON, args);
+
+		if (!(previous_bytes_per_pixel == 2 && bytes_per_pixel == 4) || need_to_set_console_size_16bpp_to_32bpp)
+			set_framebuffer_console_size_to_screen_size(screen);
+	}
+	else
+	if (command == COMMAND_SWITCH_TO_LCD) {
+		int output_type;
+		args[0] = screen;
+		output_type = disp_ioctl(DISP_CMD_GET_OUTPUT_TYPE, args);
+		if (output_type == DISP_OUTPUT_TYPE_LCD) {
+			printf("Cannot switch to LCD mode because LCD is already enabled.\n");
+			return 1;
+		}
+		if (output_type != DISP_OUTPUT_TYPE_HDMI) {
+			printf("Cannot switch to LCD mode because HDMI is not enabled.\n");
+			return 1;
+		}
+		// Turn HDMI off.
+		phase_begin(PHASE_BLACKOUT);
+		args[0] = screen;
+		disp_ioctl(DISP_CMD_HDMI_OFF, args);
+		// Disable scaler mode.
+		disable_scaler(screen);
+		// Turn the LCD on.
+		args[0] = screen;
+		disp_ioctl(DISP_CMD_LCD_ON, args);
+		phase_end(PHASE_BLACKOUT);
+		// When changing from 16bpp to 32bpp, set the pixel depth and screen size
+		// with one command.
+		if (previous_bytes_per_pixel == 2)
+			set_framebuffer_console_size_to_screen_size_and_set_pixel_depth(screen, 4);
+		else
+			set_framebuffer_console_size_to_screen_size(screen);
+	}
+	else
+	if (command == COMMAND_RESCALE)enable_scaler_for_size(screen,c->sc_source_width,c->sc_source_height,c->sc_width,c->sc_height);
+	else
+	if (command == COMMAND_DISABLE_SCALER) disable_scaler(screen);
+
+	else
+	if (command == COMMAND_CHANGE_HDMI_MODE || command == COMMAND_CHANGE_HDMI_MODE_FORCE) {
+		int output_type;
+
+		args[0] = screen;
+		output_type = disp_ioctl(DISP_CMD_GET_OUTPUT_TYPE, args);
+		if (output_type != DISP_OUTPUT_TYPE_HDMI) {
+		       printf("Cannot change HDMI mode because HDMI is not enabled.\n");
+			return 1;
+		}
+		if (command != COMMAND_CHANGE_HDMI_MODE_FORCE) {
+			ret = hdmi_mode_supported(screen, mode);
+			if (ret == 0) {
+				printf("Specified HDMI mode is not supported by the display according to the display driver.\n");
+				command_error = A10DISP_ERROR_UNSUPPORTED;
+				return - 1;
+			}
+		}
+
+		// Only change what differs from the current state: the display isn't turned off when
+		// the mode and pixel depth stay the same, and the console framebuffer isn't changed
+		// when the new mode has the same size.
+		return apply_hdmi_mode(screen, mode, bytes_per_pixel);
+	}
+	else
+	if (command == COMMAND_CHANGE_PIXEL_DEPTH) {
+		int output_type;
+
+		if (bytes_per_pixel == previous_bytes_per_pixel) {
+			printf("Display is already set to pixel depth of %dbpp.\n", bytes_per_pixel * 8);
+			return 1;
+		}
+
+		args[0] = screen;
+		output_type = disp_ioctl(DISP_CMD_GET_OUTPUT_TYPE, args);
+		if (output_type != DISP_OUTPUT_TYPE_HDMI) {
+	       		printf("Cannot change color depth because HDMI is not enabled.\n");
+			return 1;
+		}
+
+		// Get the current HDMI mode.
+		args[0] = screen;
+		mode = disp_ioctl(DISP_CMD_HDMI_GET_MODE, args);
+
+		// Check that the framebuffer is large enough.
+		check_framebuffer_size(screen, mode, bytes_per_pixel);
+
+		// Turn HDMI off.
+		phase_begin(PHASE_BLACKOUT);
+      		args[0] = screen;
+		disp_ioctl(DISP_CMD_HDMI_OFF, args);
+
+		// mode is equal to 0xFF when EDID setting is enabled; the display then uses the
+		// preferred timing of its EDID, or the console size if the EDID isn't available.
+		int mode_width, mode_height;
+		if (mode_valid(mode)) {
+			mode_width = mode_timing[mode].width;
+			mode_height = mode_timing[mode].height;
+		}
+		else
+		if (get_edid_preferred_timing() != NULL) {
+			mode_width = get_edid_preferred_timing()->width;
+			mode_height = get_edid_preferred_timing()->height;
+		}
+		else {
+			mode_width = previous_width;
+			mode_height = previous_height;
+		}
+		int large_mode = (mode_width * mode_height > 1280 * 1024);
+
+		if (bytes_per_pixel == 4 && use_scaler_for_large_32bpp_modes && large_mode)
+			// Enable scaler for bigger modes at 32bpp.
+			enable_scaler_for_size(screen, mode_width, mode_height, mode_width, mode_height);
+		else
+			disable_scaler(screen);
+
+		set_framebuffer_console_pixel_depth(screen, bytes_per_pixel);
+
+		// Turn HDMI on again.
+		args[0] = screen;
+		disp_ioctl(DISP_CMD_HDMI_ON, args);
+		phase_end(PHASE_BLACKOUT);
+	}
+	else
+	if (command == COMMAND_DISPLAY_OFF) {
+		int output_type;
+		args[0] = screen;
+		output_type = disp_ioctl(DISP_CMD_GET_OUTPUT_TYPE, args);
+		if (output_type == DISP_OUTPUT_TYPE_HDMI) {
+	      		args[0] = screen;
+			disp_ioctl(DISP_CMD_HDMI_OFF, args);
+		}
+		else
+		if (output_type == DISP_OUTPUT_TYPE_LCD) {
+			args[0] = screen;
+			disp_ioctl(DISP_CMD_LCD_OFF, args);
+		}
+		else
+		if (output_type == DISP_OUTPUT_TYPE_VGA) {
+			args[0] = screen;
+			disp_ioctl(DISP_CMD_VGA_OFF, args);
+		}
+		else
+		if (output_type == DISP_OUTPUT_TYPE_TV) {
+			args[0] = screen;
+			disp_ioctl(DISP_CMD_TV_OFF, args);
+		}
+	}
+	else
+	if (command == COMMAND_LCD_ON) {
+		int output_type;
+		args[0] = screen;
+		output_type = disp_ioctl(DISP_CMD_GET_OUTPUT_TYPE, args);
+		if (output_type != DISP_OUTPUT_TYPE_NONE) {
+			printf("Display must be off for lcdon.\n");
+			return - 1;
+		}
+		args[0] = screen;
+		disp_ioctl(DISP_CMD_LCD_ON, args);
+		// When changing from 16bpp to 32bpp, set the pixel depth and screen size
+		// with one command.
+		if (previous_bytes_per_pixel == 2)
+			set_framebuffer_console_size_to_screen_size_and_set_pixel_depth(screen, 4);
+		else
+			set_framebuffer_console_size_to_screen_size(screen);
+	}
+	return 0;
+}
+
+// Run a command the given number of times and print the minimum, median and 99th percentile
+// of the time spent in each phase. If the backend can restore its initial state (the simulated
+// backend can), this is done before every run, so that every run does the same transition.
+// The output of the command itself is discarded.
+
+static int run_benchmark(const struct command_args *c, int iterations, const char *name) {
+	double *times[NU_PHASES];
+	int count[NU_PHASES];
+	int saved_stdout, devnull;
+	int i, p, ret = 0;
+	double start_time;
+	for (p = 0; p < NU_PHASES; p++) {
+		times[p] = malloc(iterations * sizeof(double));
+		count[p] = 0;
+	}
+	fflush(stdout);
+	saved_stdout = dup(1);
+	devnull = open("/dev/null", O_WRONLY);
+	for (i = 0; i < iterations; i++) {
+		if (backend->reset != NULL)
+			backend->reset();
+		begin_command_ioctls();
+		reset_phases();
+		dup2(devnull, 1);
+		start_time = get_time_ms();
+		ret = execute_command(c);
+		phase_time[PHASE_TOTAL] = get_time_ms() - start_time;
+		phase_seen[PHASE_TOTAL] = 1;
+		fflush(stdout);
+		dup2(saved_stdout, 1);
+		if (ret != 0) {
+			fprintf(stderr, "Command failed in run %d (exit code %d).\n", i + 1, ret);
+			break;
+		}
+		for (p = 0; p < NU_PHASES; p++)
+			if (phase_seen[p])
+				times[p][count[p]++] = phase_time[p];
+	}
+	close(devnull);
+	close(saved_stdout);
+	if (ret == 0) {
+		printf("Benchmark of %s, %d runs with the %s backend (times in ms):\n", name, iterations,
+			backend->name);
+		printf("%-20s %10s %10s %10s\n", "phase", "min", "median", "p99");
+		for (p = 0; p < NU_PHASES; p++) {
+			int n = count[p];
+			double median;
+			if (n == 0) {
+				printf("%-20s %10s %10s %10s\n", phase_str[p], "-", "-", "-");
+				continue;
+			}
+			qsort(times[p], n, sizeof(double), compare_double);
+			median = (n & 1) ? times[p][n / 2] : (times[p][n / 2 - 1] + times[p][n / 2]) / 2;
+			printf("%-20s %10.3f %10.3f %10.3f\n", phase_str[p], times[p][0], median,
+				times[p][(99 * n + 99) / 100 - 1]);
+		}
+	}
+	for (p = 0; p < NU_PHASES; p++)
+		free(times[p]);
+	return ret;
+}
+
+// Parse a membench configuration: comma-separated apply settings, or "current" for the current
+// state.
+
+static int parse_membench_config(const char *name, int screen, struct screen_target *target) {
+	char config[256], *setting, *saveptr;
+	int i;
+	memset(target, 0, 2 * sizeof(struct screen_target));
+	for (i = 0; i < 2; i++) {
+		target[i].output_type = - 1;
+		target[i].mode = - 1;
+		target[i].scaler = - 1;
+	}
+	if (strcasecmp(name, "current") == 0)
+		return 0;
+	snprintf(config, sizeof(config), "%s", name);
+	for (setting = strtok_r(config, ",", &saveptr); setting != NULL; setting = strtok_r(NULL, ",", &saveptr))
+		if (parse_screen_target(setting, screen, target) < 0) {
+			printf("Invalid setting %s for membench.\n", setting);
+			return - 1;
+		}
+	return 0;
+}
+
+// Parse a planmem configuration: comma-separated apply settings and [<screen>:]buffers=<n>.
+
+static int parse_planmem_config(const char *name, int screen, struct screen_target *target, int *buffers) {
+	char config[256], *setting, *saveptr;
+	int i;
+	memset(target, 0, 2 * sizeof(struct screen_target));
+	for (i = 0; i < 2; i++) {
+		target[i].output_type = - 1;
+		target[i].mode = - 1;
+		target[i].scaler = - 1;
+		buffers[i] = 0;
+	}
+	snprintf(config, sizeof(config), "%s", name);
+	for (setting = strtok_r(config, ",", &saveptr); setting != NULL; setting = strtok_r(NULL, ",", &saveptr)) {
+		int s = screen;
+		const char *key = setting;
+		if ((key[0] == '0' || key[0] == '1') && key[1] == ':') {
+			s = key[0] - '0';
+			key += 2;
+		}
+		if (strncasecmp(key, "buffers=", 8) == 0) {
+			buffers[s] = atoi(key + 8);
+			target[s].given = 1;
+			if (buffers[s] >= 1 && buffers[s] <= 8)
+				continue;
+		}
+		else
+		if (parse_screen_target(setting, screen, target) == 0)
+			continue;
+		printf("Invalid setting %s for planmem.\n", setting);
+		return - 1;
+	}
+	return 0;
+}
+
+// Turn a command given with --screen all into the targets of both screens for apply. Returns -1
+// if the command can't be used with --screen all, -2 if the mode is not valid.
+
+static int apply_all_screens(int command, int mode, int bytes_per_pixel, struct command_args *c) {
+	int i;
+	for (i = 0; i < 2; i++) {
+		struct screen_target *t = &c->target[i];
+		t->given = 1;
+		switch (command) {
+		case COMMAND_SWITCH_TO_HDMI_FORCE :
+		case COMMAND_CHANGE_HDMI_MODE_FORCE :
+		case COMMAND_ENABLE_HDMI_FORCE :
+			c->force = 1;
+			// Fall through.
+		case COMMAND_SWITCH_TO_HDMI :
+		case COMMAND_CHANGE_HDMI_MODE :
+		case COMMAND_ENABLE_HDMI :
+			if (!mode_valid(mode))
+				return - 2;
+			t->output_type = DISP_OUTPUT_TYPE_HDMI;
+			t->mode = mode;
+			t->bytes_per_pixel = bytes_per_pixel;
+			break;
+		case COMMAND_CHANGE_PIXEL_DEPTH :
+			if (bytes_per_pixel == 3)
+				return - 1;
+			t->bytes_per_pixel = bytes_per_pixel;
+			break;
+		case COMMAND_DISPLAY_OFF :
+			t->output_type = DISP_OUTPUT_TYPE_NONE;
+			break;
+		default :
+			return - 1;
+		}
+	}
+	return 0;
+}
+
+// Parse the options and the command of a command line into c. For a request to the daemon,
+// the options that select and configure the display driver backend can't be used. Returns 0 on
+// success, otherwise the exit code.
+
+static int parse_command_line(int argc, char *argv[], struct command_args *c, int daemon_request) {
+	int command;
+	int mode = 0;
+	int bytes_per_pixel = 0;
+	int screen = 0;
+	int sc_source_width = 0, sc_source_height = 0, sc_width = 0, sc_height = 0; //Scaler args
+	int auto_mode_policy = 0, auto_mode_parameter = 0;
+	int bench_iterations = 0;
+	int all_screens = 0;
+	int argi = 1;
+	int i;
+	memset(c, 0, sizeof(*c));
+	for (i = 0; i < 2; i++) {
+		c->target[i].output_type = - 1;
+		c->target[i].mode = - 1;
+		c->target[i].scaler = - 1;
+	}
+
+	/* Process options. */
+	for (;;) {
+		if (argi >= argc)
+			break;
+		if (strcasecmp(argv[argi], "--screen") == 0 && argi + 1 < argc &&
+		strcasecmp(argv[argi + 1], "all") == 0) {
+			all_screens = 1;
+			screen = 0;
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--screen") == 0 && argi + 1 < argc) {
+			all_screens = 0;
+			screen = atoi(argv[argi + 1]);
+			if (screen < 0 || screen > 1) {
+				fprintf(stderr, "Screen must be 0 or 1.\n");
+				return 1;
+			}
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--nodoublebuffer") == 0) {
+			nu_framebuffer_buffers = 1;
+			argi++;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--buffers") == 0 && argi + 1 < argc) {
+			nu_framebuffer_buffers = atoi(argv[argi + 1]);
+			if (nu_framebuffer_buffers < 1 || nu_framebuffer_buffers > 8) {
+				printf("Number of buffers must be between 1 and 8.\n");
+				return 1;
+			}
+			set_virtual_buffers = 1;
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--panscroll") == 0) {
+			pan_scroll = 1;
+			argi++;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--noscaler") == 0) {
+			use_scaler_for_large_32bpp_modes = 0;
+			argi++;
+			continue;
+		}
+		if (daemon_request && (strcasecmp(argv[argi], "--sim") == 0 ||
+		strcasecmp(argv[argi], "--modecache") == 0 || strcasecmp(argv[argi], "--edid") == 0 ||
+		strcasecmp(argv[argi], "--socket") == 0 || strcasecmp(argv[argi], "--client") == 0 ||
+		strcasecmp(argv[argi], "--trace") == 0 || strcasecmp(argv[argi], "--record") == 0 ||
+		strcasecmp(argv[argi], "--replay") == 0 || strcasecmp(argv[argi], "--modes") == 0)) {
+			printf("Option %s can only be given when starting the daemon.\n", argv[argi]);
+			return 1;
+		}
+		if (strcasecmp(argv[argi], "--socket") == 0 && argi + 1 < argc) {
+			socket_file = argv[argi + 1];
+			use_daemon = 1;
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--preserve") == 0) {
+			preserve_contents = 1;
+			argi++;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--dither") == 0) {
+			preserve_contents = 1;
+			dither_contents = 1;
+			argi++;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--renderscale") == 0 && argi + 1 < argc) {
+			double numerator, denominator;
+			if (sscanf(argv[argi + 1], "%lf/%lf", &numerator, &denominator) == 2 && denominator > 0)
+				render_scale = numerator / denominator;
+			else
+				render_scale = atof(argv[argi + 1]);
+			// A factor larger than one is the upscaling factor.
+			if (render_scale > 1)
+				render_scale = 1 / render_scale;
+			if (render_scale <= 0.1) {
+				printf("Invalid render scale %s.\n", argv[argi + 1]);
+				return 1;
+			}
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--nosimd") == 0) {
+			use_simd = 0;
+			argi++;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--trace") == 0 && argi + 1 < argc) {
+			trace_file_name = argv[argi + 1];
+			argi += 2;
+			continue;
+		}
+		if (strcmp(argv[argi], "-v") == 0 || strcasecmp(argv[argi], "--verbose") == 0) {
+			verbose = 1;
+			argi++;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--record") == 0 && argi + 1 < argc) {
+			record_file_name = argv[argi + 1];
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--replay") == 0 && argi + 1 < argc) {
+			if (replay_load(argv[argi + 1]) < 0)
+				return 1;
+			backend = &replay_backend;
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--cpu") == 0 && argi + 1 < argc) {
+			bench_cpu = atoi(argv[argi + 1]);
+			if (bench_cpu < 0) {
+				printf("Invalid CPU number.\n");
+				return 1;
+			}
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--hotplug") == 0 && argi + 1 < argc) {
+			hotplug_source_spec = argv[argi + 1];
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--client") == 0) {
+			use_daemon = 1;
+			argi++;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--sim") == 0 && argi + 1 < argc) {
+			if (sim_configure(argv[argi + 1]) < 0)
+				return 1;
+			backend = &sim_backend;
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--drambandwidth") == 0 && argi + 1 < argc) {
+			dram_bandwidth = atoi(argv[argi + 1]);
+			if (dram_bandwidth < 1) {
+				fprintf(stderr, "DRAM bandwidth must be at least 1 MB/s.\n");
+				return 1;
+			}
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--modecache") == 0 && argi + 1 < argc) {
+			if (strcasecmp(argv[argi + 1], "none") == 0)
+				mode_cache_file = NULL;
+			else
+				mode_cache_file = argv[argi + 1];
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--refresh-modes") == 0) {
+			refresh_modes = 1;
+			argi++;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--modes") == 0 && argi + 1 < argc) {
+			if (load_modes_file(argv[argi + 1], 1) < 0)
+				return 1;
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--edid") == 0 && argi + 1 < argc) {
+			edid_file = argv[argi + 1];
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--bench") == 0 && argi + 1 < argc) {
+			bench_iterations = atoi(argv[argi + 1]);
+			if (bench_iterations < 1) {
+				fprintf(stderr, "Number of benchmark runs must be at least 1.\n");
+				return 1;
+			}
+			argi += 2;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--fbset") == 0) {
+			use_fbset = 1;
+			argi++;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--comparefbset") == 0) {
+			compare_with_fbset = 1;
+			argi++;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--interleaved") == 0) {
+			screen_sequencing = SCREENS_INTERLEAVED;
+			argi++;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--sequential") == 0) {
+			screen_sequencing = SCREENS_SEQUENTIAL;
+			argi++;
+			continue;
+		}
+		if (strcasecmp(argv[argi], "--concurrent") == 0) {
+			screen_sequencing = SCREENS_CONCURRENT;
+			argi++;
+			continue;
+		}
+		break;
+	}
+
+	if (argi >= argc) {
+		fprintf(stderr, "No command given.\n");
+		return 1;
+	}
+
+	/* Process commands. */
+	if (strcasecmp(argv[argi], "info") == 0) {
+		command = COMMAND_INFO;
+	}
+	else
+	if (strcasecmp(argv[argi], "automode") == 0) {
+		int depth_argi = argi + 2;
+		if (argi + 1 >= argc) {
+			usage(argc, argv);
+			return 1;
+		}
+		command = COMMAND_AUTO_MODE;
+		if (strcasecmp(argv[argi + 1], "maxres") == 0)
+			auto_mode_policy = AUTO_MODE_MAX_RESOLUTION;
+		else
+		if (strcasecmp(argv[argi + 1], "native") == 0)
+			auto_mode_policy = AUTO_MODE_NATIVE;
+		else
+		if (strcasecmp(argv[argi + 1], "minbandwidth") == 0 && argi + 2 < argc) {
+			int min_width, min_height;
+			if (sscanf(argv[argi + 2], "%dx%d", &min_width, &min_height) != 2) {
+				printf("Minimum resolution must be given as <width>x<height>.\n");
+				return 1;
+			}
+			auto_mode_policy = AUTO_MODE_MIN_BANDWIDTH;
+			auto_mode_parameter = min_width * min_height;
+			depth_argi++;
+		}
+		else
+		if (strcasecmp(argv[argi + 1], "refresh") == 0 && argi + 2 < argc) {
+			auto_mode_policy = AUTO_MODE_REFRESH;
+			auto_mode_parameter = atoi(argv[argi + 2]);
+			depth_argi++;
+		}
+		else {
+			usage(argc, argv);
+			return 1;
+		}
+		if (depth_argi < argc) {
+			int bits_per_pixel = atoi(argv[depth_argi]);
+			if (bits_per_pixel != 16 && bits_per_pixel != 32) {
+				printf("Bits per pixel must be 16 or 32.\n");
+				return 1;
+			}
+			bytes_per_pixel = bits_per_pixel / 8;
+		}
+	}
+	else
+	if (strcasecmp(argv[argi], "bandwidth") == 0) {
+		command = COMMAND_BANDWIDTH;
+	}
+	else
+	if (strcasecmp(argv[argi], "switchtohdmi") == 0) {
+		if (argi + 1 >= argc) {
+			usage(argc, argv);
+			return 1;
+		}
+		command = COMMAND_SWITCH_TO_HDMI;
+		mode = atoi(argv[argi + 1]);
+		bytes_per_pixel = 0;
+		if (argi + 2 < argc) {
+			int bits_per_pixel = atoi(argv[argi + 2]);
+			if (bits_per_pixel != 16 && bits_per_pixel != 32) {
+				printf("Bits per pixel must be 16 or 32.\n");
+				return 1;
+			}
+			bytes_per_pixel = bits_per_pixel / 8;
+		}
+	}
+	else
+	if (strcasecmp(argv[argi], "switchtohdmiforce") == 0) {
+		if (argi + 1 >= argc) {
+			usage(argc, argv);
+			return 1;
+		}
+		command = COMMAND_SWITCH_TO_HDMI_FORCE;
+		mode = atoi(argv[argi + 1]);
+		bytes_per_pixel = 0;
+		if (argi + 2 < argc) {
+			int bits_per_pixel = atoi(argv[argi + 2]);
+			if (bits_per_pixel != 16 && bits_per_pixel != 32) {
+				printf("Bits per pixel must be 16 or 32.\n");
+				return 1;
+			}
+			bytes_per_pixel = bits_per_pixel / 8;
+		}
+	}
+	else
+	if (strcasecmp(argv[argi], "switchtolcd") == 0) {
+		command = COMMAND_SWITCH_TO_LCD;
+	}
+	else
+	if (strcasecmp(argv[argi], "changehdmimode") == 0) {
+		if (argi + 1 >= argc) {
+			usage(argc, argv);
+			return 1;
+		}
+		command = COMMAND_CHANGE_HDMI_MODE;
+		mode = atoi(argv[argi + 1]);
+		if (mode < 0 || mode >= nu_modes) {
+			printf("Mode out of range.\n");
+			return 1;
+		}
+		bytes_per_pixel = 0;
+		if (argi + 2 < argc) {
+			int bits_per_pixel = atoi(argv[argi + 2]);
+			if (bits_per_pixel != 16 && bits_per_pixel != 32) {
+				printf("Bits per pixel must be 16 or 32.\n");
+				return 1;
+			}
 			bytes_per_pixel = bits_per_pixel / 8;
 		}
 	}
@@ -615,7 +4124,7 @@ int main(int argc, char *argv[]) {
 		}
 		command = COMMAND_CHANGE_HDMI_MODE_FORCE;
 		mode = atoi(argv[argi + 1]);
-		if (mode < 0 || mode >= MODE_COUNT) {
+		if (mode < 0 || mode >= nu_modes) {
 			printf("Mode out of range.\n");
 			return 1;
 		}
@@ -637,7 +4146,7 @@ int main(int argc, char *argv[]) {
 		}
 		command = COMMAND_ENABLE_HDMI_FORCE;
 		mode = atoi(argv[argi + 1]);
-		if (mode < 0 || mode >= MODE_COUNT) {
+		if (mode < 0 || mode >= nu_modes) {
 			printf("Mode out of range.\n");
 			return 1;
 		}
@@ -659,7 +4168,7 @@ int main(int argc, char *argv[]) {
 		}
 		command = COMMAND_ENABLE_HDMI;
 		mode = atoi(argv[argi + 1]);
-		if (mode < 0 || mode >= MODE_COUNT) {
+		if (mode < 0 || mode >= nu_modes) {
 			printf("Mode out of range.\n");
 			return 1;
 		}
@@ -712,525 +4221,951 @@ int main(int argc, char *argv[]) {
 	else
 		if(strcasecmp(argv[argi], "disablescaler") == 0)
 			command=COMMAND_DISABLE_SCALER;
-	else {
-		fprintf(stderr, "Unknown command %s. Run a10disp without arguments for usage information.\n", argv[argi]);
-		return 1;
+	else
+	if (strcasecmp(argv[argi], "apply") == 0) {
+		if (argi + 1 >= argc) {
+			usage(argc, argv);
+			return 1;
+		}
+		command = COMMAND_APPLY;
+		for (i = argi + 1; i < argc; i++)
+			if (parse_screen_target(argv[i], screen, c->target) < 0 ||
+			(all_screens && parse_screen_target(argv[i], 1, c->target) < 0)) {
+				printf("Invalid setting %s for apply.\n", argv[i]);
+				return 1;
+			}
 	}
-
-	fd_disp = open("/dev/disp", O_RDWR);
-	if (fd_disp == -1) {
-		fprintf(stderr, "Error: Failed to open /dev/disp: %s\n",
-			strerror(errno));
-		fprintf(stderr, "Are you root?\n");
-		return errno;
+	else
+	if (strcasecmp(argv[argi], "convertbench") == 0) {
+		command = COMMAND_CONVERT_BENCH;
+		c->width = 1920;
+		c->height = 1080;
+		c->iterations = 20;
+		if (argi + 1 < argc && (sscanf(argv[argi + 1], "%dx%d", &c->width, &c->height) != 2 ||
+		c->width <= 0 || c->height <= 0)) {
+			printf("Frame size must be given as <width>x<height>.\n");
+			return 1;
+		}
+		if (argi + 2 < argc) {
+			c->iterations = atoi(argv[argi + 2]);
+			if (c->iterations < 1) {
+				printf("Number of runs must be at least 1.\n");
+				return 1;
+			}
+		}
 	}
-
-	tmp = SUNXI_DISP_VERSION;
-	ret = ioctl(fd_disp, DISP_CMD_VERSION, &tmp);
-	int ver_major, ver_minor;
-	if (ret == -1) {
-		printf("Warning: kernel sunxi disp driver does not support "
-		       "versioning.\n");
-		ver_major = ver_minor = 0;
-	} else if (ret < 0) {
-		fprintf(stderr, "Error: ioctl(VERSION) failed: %s\n",
-			strerror(-ret));
-		return ret;
-	} else {
-		ver_major = ret >> 16;
-		ver_minor = ret & 0xFFFF;
-		printf("sunxi disp kernel module version is %d.%d\n",
-		       ver_major, ver_minor);
+	else
+	if (strcasecmp(argv[argi], "fbbench") == 0) {
+		command = COMMAND_FB_BENCH;
+		c->iterations = 20;
+		c->width = 1920;
+		c->height = 1080;
+		c->bench_file = NULL;
+		bytes_per_pixel = 4;
+		if (argi + 1 < argc) {
+			c->iterations = atoi(argv[argi + 1]);
+			if (c->iterations < 1) {
+				printf("Number of frames must be at least 1.\n");
+				return 1;
+			}
+		}
+		if (argi + 2 < argc) {
+			static char bench_file[256];
+			char *geometry;
+			snprintf(bench_file, sizeof(bench_file), "%s", argv[argi + 2]);
+			geometry = strrchr(bench_file, ':');
+			if (geometry != NULL) {
+				int bits_per_pixel;
+				*geometry = '\0';
+				if (sscanf(geometry + 1, "%dx%dx%d", &c->width, &c->height, &bits_per_pixel) != 3 ||
+				c->width <= 0 || c->height <= 0 || (bits_per_pixel != 16 && bits_per_pixel != 24 &&
+				bits_per_pixel != 32)) {
+					printf("Buffer geometry must be given as <width>x<height>x<16|24|32>.\n");
+					return 1;
+				}
+				bytes_per_pixel = bits_per_pixel / 8;
+			}
+			c->bench_file = bench_file;
+		}
+	}
+	else
+	if (strcasecmp(argv[argi], "membench") == 0) {
+		static const char *default_configs[] = {
+			"output=off", "depth=16,scaler=off", "depth=32,scaler=off", "depth=32,scaler=on"
+		};
+		command = COMMAND_MEM_BENCH;
+		c->nu_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (c->nu_threads < 1)
+			c->nu_threads = 1;
+		i = argi + 1;
+		if (i < argc && strchr(argv[i], '=') == NULL && strcasecmp(argv[i], "current") != 0) {
+			c->nu_threads = atoi(argv[i]);
+			if (c->nu_threads < 1 || c->nu_threads > 64) {
+				printf("Number of threads must be between 1 and 64.\n");
+				return 1;
+			}
+			i++;
+		}
+		if (argc - i > MEMBENCH_MAX_CONFIGS) {
+			printf("Too many configurations (maximum %d).\n", MEMBENCH_MAX_CONFIGS);
+			return 1;
+		}
+		for (; i < argc; i++) {
+			if (parse_membench_config(argv[i], screen, c->config_target[c->nu_configs]) < 0)
+				return 1;
+			c->config_name[c->nu_configs++] = argv[i];
+		}
+		if (c->nu_configs == 0)
+			for (i = 0; i < sizeof(default_configs) / sizeof(default_configs[0]); i++) {
+				parse_membench_config(default_configs[i], screen, c->config_target[i]);
+				c->config_name[c->nu_configs++] = default_configs[i];
+			}
 	}
-	if (ver_major < 1) {
-		printf("This program requires sunxi display driver 1.0 or higher.\n"
-			"Upgrade your kernel.\n");
-		return - 1;
+	else
+	if (strcasecmp(argv[argi], "save") == 0 && argi + 1 < argc) {
+		command = COMMAND_SAVE;
+		c->state_file = argv[argi + 1];
 	}
-
-	for (i = 0; i < 2; i++) {
-		char s[16];
-		sprintf(s, "/dev/fb%d", i);
-		fd_fb[i] = open(s, O_RDWR);
-		if (fd_fb[i] == -1) {
-			fprintf(stderr, "Error: Failed to open /dev/fb%d: %s\n", i, strerror(errno));
-			return errno;
+	else
+	if (strcasecmp(argv[argi], "restore") == 0 && argi + 1 < argc) {
+		command = COMMAND_RESTORE;
+		c->state_file = argv[argi + 1];
+	}
+	else
+	if (strcasecmp(argv[argi], "planmem") == 0) {
+		command = COMMAND_PLAN_MEM;
+		if (argc - argi - 1 > MEMBENCH_MAX_CONFIGS) {
+			printf("Too many configurations (maximum %d).\n", MEMBENCH_MAX_CONFIGS);
+			return 1;
+		}
+		for (i = argi + 1; i < argc; i++) {
+			if (parse_planmem_config(argv[i], screen, c->config_target[c->nu_configs],
+			c->config_buffers[c->nu_configs]) < 0)
+				return 1;
+			c->config_name[c->nu_configs++] = argv[i];
 		}
 	}
-
-		if (command == COMMAND_INFO) {
-			struct fb_fix_screeninfo fix_screeninfo;
-			int i;
-			for (i = 0; i < 2; i++) {
-				ioctl(fd_fb[i], FBIOGET_VSCREENINFO, &var_screeninfo);
-				if (ret < 0) {
-					fprintf(stderr, "Error: ioctl(FBIOGET_VSCREENINFO) failed for /dev/fb%d: %s\n", i, strerror(-ret));
-					return ret;
+	else
+	if (strcasecmp(argv[argi], "flipbench") == 0) {
+		command = COMMAND_FLIP_BENCH;
+		c->iterations = 300;
+		for (i = argi + 1; i < argc; i++) {
+			if (strcasecmp(argv[i], "fill") == 0)
+				c->fill = 1;
+			else {
+				c->iterations = atoi(argv[i]);
+				if (c->iterations < 1) {
+					printf("Number of flips must be at least 1.\n");
+					return 1;
 				}
-				printf("Linux info for screen %d (/dev/fb%d): size %d x %d, %d bits per pixel.\n", i, i,
-					var_screeninfo.xres, var_screeninfo.yres, var_screeninfo.bits_per_pixel);
 			}
-			for (i = 0; i < 2; i++) {
-				ioctl(fd_fb[i], FBIOGET_FSCREENINFO, &fix_screeninfo);
-				if (ret < 0) {
-					fprintf(stderr, "Error: ioctl(FBIOGET_FSCREENINFO) failed for /dev/fb%d: %s\n", i, strerror(-ret));
-					return ret;
-				}
-				printf("Linux info for screen %d (/dev/fb%d): framebuffer size %.2f MB.\n", i, i,
-					(float)fix_screeninfo.smem_len / (1024 * 1024));
+		}
+	}
+	else
+	if (strcasecmp(argv[argi], "consolebench") == 0) {
+		command = COMMAND_CONSOLE_BENCH;
+		c->iterations = 2000;
+		if (argi + 1 < argc) {
+			c->iterations = atoi(argv[argi + 1]);
+			if (c->iterations < 1) {
+				printf("Number of lines must be at least 1.\n");
+				return 1;
 			}
-			for (screen = 0; screen <= 1; screen++) {
-				__disp_output_type_t output_type;
-				__disp_layer_info_t layer_info;
-				__disp_fb_t fb_info;
-				int layer_handle;
-				printf("Screen %d:\n", screen);
-
-				tmp = screen;
-				ret = ioctl(fd_disp, DISP_CMD_SCN_GET_WIDTH, &tmp);
-				if (ret < 0) {
-					fprintf(stderr, "Error: ioctl(SCN_GET_WIDTH) failed: %s\n",
-						strerror(-ret));
-					return ret;
-				}
-				width = ret;
-
-				args[0] = screen;
-				ret = ioctl(fd_disp, DISP_CMD_SCN_GET_HEIGHT, args);
-				if (ret < 0) {
-					fprintf(stderr, "Error: ioctl(SCN_GET_HEIGHT) failed: %s\n", strerror(-ret));
-					return ret;
-				}
-				height = ret;
-				printf("	Display dimensions are %d x %d.\n", width, height);
-
-				args[0] = screen;
-				output_type = ioctl(fd_disp, DISP_CMD_GET_OUTPUT_TYPE, args);
-				printf("	Output type is %s.\n", output_type_str(output_type));
-
-				if (output_type == DISP_OUTPUT_TYPE_NONE)
-					continue;
-				if (screen == 0)
-					ret = ioctl(fd_fb[0], FBIOGET_LAYER_HDL_0, args);
-				else
-					ret = ioctl(fd_fb[1], FBIOGET_LAYER_HDL_1, args);
-				if (ret < 0) {
-					fprintf(stderr, "Error: ioctl(FBIOGET_LAYER_HDL_%d) failed: %s\n", screen, strerror(- ret));
-					return ret;
-				}
-				layer_handle = args[0];
-#if 0
-				printf("%d\n", layer_handle);
-#endif
-				args[0] = screen;
-				args[1] = layer_handle;
-				args[2] = &fb_info;
-				ret = ioctl(fd_disp, DISP_CMD_LAYER_GET_FB, args);
-				if (ret < 0) {
-					fprintf(stderr, "Error: ioctl(DISP_CMD_LAYER_GET_FB) failed: %s\n", strerror(- ret));
-					return ret;
-				}
-				int bytes_per_pixel = 1;
-				if (fb_info.format >= DISP_FORMAT_RGB655 && fb_info.format <= DISP_FORMAT_RGBA5551)
-					bytes_per_pixel = 2;
-				if (fb_info.format == DISP_FORMAT_ARGB888 || fb_info.format == DISP_FORMAT_ARGB8888)
-					bytes_per_pixel = 4;
-				if (fb_info.format == DISP_FORMAT_RGB888)
-					bytes_per_pixel = 3;
-				if (fb_info.format == DISP_FORMAT_ARGB4444)
-					bytes_per_pixel = 2;
-				printf("	Framebuffer dimensions are %d x %d (%.2f MB).\n", fb_info.size.width, fb_info.size.height,
-					(float)(bytes_per_pixel * fb_info.size.width * fb_info.size.height) / (1024 * 1024));
-				printf("	Framebuffer pixel format = 0x%02X (%dbpp).\n", fb_info.format, bytes_per_pixel * 8);
-				args[0] = screen;
-				args[1] = layer_handle;
-				args[2] = &layer_info;
-				ret = ioctl(fd_disp, DISP_CMD_LAYER_GET_PARA, args);
-				if (ret < 0) {
-					fprintf(stderr, "Error: ioctl(DISP_CMD_LAYER_GET_PARA) failed: %s\n", strerror(- ret));
-					return ret;
-				}
-				printf("	Layer working mode is %s.\n", layer_mode_str(layer_info.mode));
-				printf("	Layer source window size is %d x %d.\n", layer_info.src_win.width,
-					layer_info.src_win.height);
-				printf("	Layer screen window size is %d x %d.\n", layer_info.scn_win.width,
-					layer_info.scn_win.height);
-				if (output_type == DISP_OUTPUT_TYPE_HDMI) {
-					// Get the current HDMI mode.
-					args[0] = screen;
-					int current_mode = ioctl(fd_disp, DISP_CMD_HDMI_GET_MODE, args);
-					if (current_mode == DISP_TV_MODE_EDID)
-						printf("Current HDMI mode: EDID\n");
-					else
-						printf("Current HDMI mode: %d (%s)\n", current_mode, mode_str[current_mode]);
-					printf("Supported HDMI modes:\n");
-					for (i = 0; i < MODE_COUNT; i++)
-						if (strlen(mode_str[i]) > 0) {
-							args[0] = screen;
-							args[1] = i;
-							ret = ioctl(fd_disp, DISP_CMD_HDMI_SUPPORT_MODE, args);
-							if (ret == 1)
-								printf("%2d      %s\n", i, mode_str[i]);
-						}
-				}
+		}
+		if (argi + 2 < argc)
+			c->bench_file = argv[argi + 2];
+	}
+	else
+	if (strcasecmp(argv[argi], "recorddiff") == 0 && argi + 1 < argc) {
+		command = COMMAND_RECORD_DIFF;
+		c->record_file[0] = argv[argi + 1];
+		c->record_file[1] = argi + 2 < argc ? argv[argi + 2] : NULL;
+	}
+	else
+	if (strcasecmp(argv[argi], "edid") == 0) {
+		command = COMMAND_EDID;
+		c->nu_edid_files = argc - argi - 1;
+		c->edid_files = argv + argi + 1;
+	}
+	else
+	if (strcasecmp(argv[argi], "monitor") == 0 && !daemon_request) {
+		command = COMMAND_MONITOR;
+		mode = - 1;
+		if (argi + 1 < argc && strcasecmp(argv[argi + 1], "auto") != 0) {
+			mode = atoi(argv[argi + 1]);
+			if (mode < 0 || mode >= nu_modes) {
+				printf("Mode out of range.\n");
+				return 1;
 			}
-			return 0;
 		}
-
-
-	// Get the current bytes per pixel.
-	ioctl(fd_fb[0], FBIOGET_VSCREENINFO, &var_screeninfo);
-	if (ret < 0) {
-		fprintf(stderr, "Error: ioctl(FBIOGET_VSCREENINFO) failed for /dev/fb%d: %s\n", 0, strerror(-ret));
-		return ret;
+		if (argi + 2 < argc) {
+			int bits_per_pixel = atoi(argv[argi + 2]);
+			if (bits_per_pixel != 16 && bits_per_pixel != 32) {
+				printf("Bits per pixel must be 16 or 32.\n");
+				return 1;
+			}
+			bytes_per_pixel = bits_per_pixel / 8;
+		}
 	}
-	if (var_screeninfo.bits_per_pixel != 16 && var_screeninfo.bits_per_pixel != 32 && var_screeninfo.bits_per_pixel != 24) {
-		printf("Unexpected bits per pixel value (%d).\n", var_screeninfo.bits_per_pixel);
-		return - 1;
+	else
+	if (strcasecmp(argv[argi], "daemon") == 0 && !daemon_request) {
+		command = COMMAND_DAEMON;
+		if (argi + 1 < argc)
+			socket_file = argv[argi + 1];
+	}
+	else {
+		fprintf(stderr, "Unknown command %s. Run a10disp without arguments for usage information.\n", argv[argi]);
+		return 1;
 	}
-	previous_bytes_per_pixel = var_screeninfo.bits_per_pixel / 8;
-	previous_width = var_screeninfo.xres;
-	previous_height = var_screeninfo.yres;
-
-	if (command == COMMAND_SWITCH_TO_HDMI || command == COMMAND_SWITCH_TO_HDMI_FORCE) {
-		int output_type;
-		int need_to_set_console_size_16bpp_to_32bpp;
 
-		args[0] = screen;
-		output_type = ioctl(fd_disp, DISP_CMD_GET_OUTPUT_TYPE, args);
-		if (output_type == DISP_OUTPUT_TYPE_HDMI) {
-			printf("Cannot switch to HDMI mode because HDMI is already enabled.\n");
+	if (all_screens && command != COMMAND_APPLY) {
+		// Change both screens with the apply engine.
+		int ret = apply_all_screens(command, mode, bytes_per_pixel, c);
+		if (ret == - 2) {
+			printf("Mode out of range.\n");
 			return 1;
 		}
-		if (output_type != DISP_OUTPUT_TYPE_LCD) {
-			printf("Cannot change HDMI mode because LCD is not enabled.\n");
+		if (ret < 0) {
+			printf("--screen all can't be used with %s.\n", argv[argi]);
 			return 1;
 		}
+		command = COMMAND_APPLY;
+	}
 
-		if (command != COMMAND_SWITCH_TO_HDMI_FORCE) {
-			args[0] = screen;
-			args[1] = mode;
-			ret = ioctl(fd_disp, DISP_CMD_HDMI_SUPPORT_MODE, args);
-			if (ret == 0) {
-				printf("Specified HDMI mode is not supported by the display according to the display driver.\n");
-				return - 1;
-			}
-		}
+	c->command = command;
+	c->screen = screen;
+	c->mode = mode;
+	c->bytes_per_pixel = bytes_per_pixel;
+	c->sc_source_width = sc_source_width;
+	c->sc_source_height = sc_source_height;
+	c->sc_width = sc_width;
+	c->sc_height = sc_height;
+	c->auto_mode_policy = auto_mode_policy;
+	c->auto_mode_parameter = auto_mode_parameter;
+	c->bench_iterations = bench_iterations;
+	c->name = argv[argi];
+	return 0;
+}
 
-		// Check that the framebuffer is large enough.
-		check_framebuffer_size(screen, mode, bytes_per_pixel);
+// Settings that can be changed by options in a request to the daemon. They are restored to the
+// values the daemon was started with before each request.
+struct daemon_settings {
+	int nu_framebuffer_buffers;
+	int set_virtual_buffers;
+	int pan_scroll;
+	int use_scaler_for_large_32bpp_modes;
+	int dram_bandwidth;
+	int use_fbset;
+	int compare_with_fbset;
+	int refresh_modes;
+	int preserve_contents;
+	int dither_contents;
+	int use_simd;
+	int bench_cpu;
+	int verbose;
+	int screen_sequencing;
+	double render_scale;
+};
 
-		// Turn LCD off.
-		args[0] = screen;
-		ioctl(fd_disp, DISP_CMD_LCD_OFF, args);
+static struct daemon_settings daemon_defaults;
 
-		// When changing from 32bpp to 16bpp, change the pixel depth.
-		if (previous_bytes_per_pixel == 4 && bytes_per_pixel == 2)
-			set_framebuffer_console_pixel_depth(screen, bytes_per_pixel);
+static void remove_socket_file(void) {
+	unlink(socket_file);
+}
 
-		// When changing from 16bpp to 32bpp, and the new mode is smaller than the previous one,
-		// set the console and pixel depth with one command, otherwise only set the pixel depth.
-		need_to_set_console_size_16bpp_to_32bpp = 0;
-		if (previous_bytes_per_pixel == 2 && bytes_per_pixel == 4) {
-			if (mode_size[mode] < previous_width * previous_height) {
-				set_framebuffer_console_size_and_depth(screen, mode, bytes_per_pixel);
-			}
-			else {
-				set_framebuffer_console_pixel_depth(screen, bytes_per_pixel);
-				need_to_set_console_size_16bpp_to_32bpp = 1;
-			}
-		}
+// Handle one request to the daemon. The request consists of the command line arguments, each
+// terminated by a newline, followed by an empty line. The output of the command is sent back,
+// followed by a zero byte and the exit code as text.
 
-		// Set the mode.
-		args[0] = screen;
-		args[1] = mode;
-		ret = ioctl(fd_disp, DISP_CMD_HDMI_SET_MODE, args);
-		if (ret < 0) {
-			fprintf(stderr, "Error: ioctl(DISP_CMD_HDMI_SET_MODE) failed: %s\n",
-					strerror(-ret));
-			return ret;
-		}
+static void handle_daemon_request(int client_fd) {
+	char request[DAEMON_REQUEST_SIZE];
+	char *argv[DAEMON_MAX_ARGS + 1];
+	int argc, size, n, ret, complete;
+	int saved_stdout, saved_stderr;
+	struct command_args c;
+	jmp_buf jmp;
+	char *p;
 
-		if (use_scaler_for_large_32bpp_modes)
-			if ((bytes_per_pixel == 4 || (bytes_per_pixel == 0 && previous_bytes_per_pixel == 4))
-			&& mode_size[mode] > 1280 * 1024) {
-				// Enable scaler for bigger modes at 32bpp.
-				enable_scaler_for_mode(screen, mode);
-			}
-		// When switching from LCD, we can assume scaler mode was disabled.
+	size = 0;
+	complete = 0;
+	while (!complete && size < sizeof(request)) {
+		n = read(client_fd, request + size, sizeof(request) - size);
+		if (n <= 0)
+			break;
+		size += n;
+		complete = request[size - 1] == '\n' && (size == 1 || request[size - 2] == '\n');
+	}
+	if (!complete) {
+		dprintf(client_fd, "Invalid request.\n%c%d\n", 0, 1);
+		return;
+	}
+	request[size - 1] = '\0';
+	argv[0] = "a10disp";
+	argc = 1;
+	for (p = request; *p != '\0' && argc < DAEMON_MAX_ARGS; argc++) {
+		argv[argc] = p;
+		p = strchr(p, '\n');
+		*p++ = '\0';
+	}
+	argv[argc] = NULL;
 
-		// Turn HDMI on again.
-		args[0] = screen;
-		ioctl(fd_disp, DISP_CMD_HDMI_ON, args);
+	nu_framebuffer_buffers = daemon_defaults.nu_framebuffer_buffers;
+	set_virtual_buffers = daemon_defaults.set_virtual_buffers;
+	pan_scroll = daemon_defaults.pan_scroll;
+	use_scaler_for_large_32bpp_modes = daemon_defaults.use_scaler_for_large_32bpp_modes;
+	dram_bandwidth = daemon_defaults.dram_bandwidth;
+	use_fbset = daemon_defaults.use_fbset;
+	compare_with_fbset = daemon_defaults.compare_with_fbset;
+	refresh_modes = daemon_defaults.refresh_modes;
+	preserve_contents = daemon_defaults.preserve_contents;
+	dither_contents = daemon_defaults.dither_contents;
+	use_simd = daemon_defaults.use_simd;
+	bench_cpu = daemon_defaults.bench_cpu;
+	verbose = daemon_defaults.verbose;
+	screen_sequencing = daemon_defaults.screen_sequencing;
+	render_scale = daemon_defaults.render_scale;
+	// Another display may have been connected since the previous request.
+	mode_cache_screen_state[0] = mode_cache_screen_state[1] = 0;
 
-		if (!(previous_bytes_per_pixel == 2 && bytes_per_pixel == 4) || need_to_set_console_size_16bpp_to_32bpp)
-			set_framebuffer_console_size_to_screen_size(screen);
+	// Send the output of the command to the client.
+	fflush(stdout);
+	fflush(stderr);
+	saved_stdout = dup(1);
+	saved_stderr = dup(2);
+	dup2(client_fd, 1);
+	dup2(client_fd, 2);
+	if (setjmp(jmp) == 0) {
+		command_jmp_buf = &jmp;
+		if (argc == 1) {
+			usage(argc, argv);
+			ret = 0;
+		}
+		else
+			ret = parse_command_line(argc, argv, &c, 1);
+		if (argc > 1 && ret == 0) {
+			if (refresh_modes && mode_cache_loaded) {
+				memset(mode_cache.screen, 0, sizeof(mode_cache.screen));
+				mode_cache_dirty = 1;
+			}
+			trace_command(c.name);
+			begin_command_ioctls();
+			if (c.bench_iterations > 0)
+				ret = run_benchmark(&c, c.bench_iterations, c.name);
+			else
+				ret = execute_command(&c);
+			show_command_ioctls();
+		}
 	}
 	else
-	if (command == COMMAND_ENABLE_HDMI || command == COMMAND_ENABLE_HDMI_FORCE) {
-		int output_type;
-		int need_to_set_console_size_16bpp_to_32bpp;
+		ret = command_exit_code;
+	command_jmp_buf = NULL;
+	trace_summary();
+	fflush(stdout);
+	fflush(stderr);
+	dup2(saved_stdout, 1);
+	dup2(saved_stderr, 2);
+	close(saved_stdout);
+	close(saved_stderr);
+	dprintf(client_fd, "%c%d\n", 0, ret);
+	if (mode_cache_file != NULL)
+		save_mode_cache();
+}
 
-		args[0] = screen;
-		output_type = ioctl(fd_disp, DISP_CMD_GET_OUTPUT_TYPE, args);
-		if (output_type == DISP_OUTPUT_TYPE_HDMI) {
-		       printf("Cannot enable HDMI mode because HDMI is already enabled.\n");
-			return 1;
-		}
-		if (output_type == DISP_OUTPUT_TYPE_LCD) {
-			printf("Cannot enable HDMI because LCD is enabled, use switchtohdmi command.\n");
-			return 1;
-		}
+// Run as daemon, keeping the display driver open and executing the requests received on the
+// Unix socket. Returns the exit code.
 
-		if (command != COMMAND_ENABLE_HDMI_FORCE) {
-			args[0] = screen;
-			args[1] = mode;
-			ret = ioctl(fd_disp, DISP_CMD_HDMI_SUPPORT_MODE, args);
-			if (ret == 0) {
-				printf("Specified HDMI mode is not supported by the display according to the display driver.\n");
-				return - 1;
-			}
-		}
+static int run_daemon(void) {
+	struct sockaddr_un addr;
+	struct sigaction action;
+	int fd, client_fd;
 
-		// Check that the framebuffer is large enough.
-		check_framebuffer_size(screen, mode, bytes_per_pixel);
+	if (strlen(socket_file) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket file name %s is too long.\n", socket_file);
+		return 1;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Error: socket() failed: %s\n", strerror(errno));
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_file);
+	unlink(socket_file);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+		fprintf(stderr, "Error: cannot listen on %s: %s\n", socket_file, strerror(errno));
+		close(fd);
+		return 1;
+	}
+	// Only root (or the user running the daemon) can change the display.
+	chmod(socket_file, 0600);
+	atexit(remove_socket_file);
 
-		// When changing from 32bpp to 16bpp, change the pixel depth.
-		if (previous_bytes_per_pixel == 4 && bytes_per_pixel == 2)
-			set_framebuffer_console_pixel_depth(screen, bytes_per_pixel);
+	// Stop on SIGINT and SIGTERM; accept() is interrupted because SA_RESTART isn't set.
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stop_signal_handler;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
 
-		// When changing from 16bpp to 32bpp, and the new mode is smaller than the previous one,
-		// set the console and pixel depth with one command, otherwise only set the pixel depth.
-		need_to_set_console_size_16bpp_to_32bpp = 0;
-		if (previous_bytes_per_pixel == 2 && bytes_per_pixel == 4) {
-			if (mode_size[mode] < previous_width * previous_height) {
-				set_framebuffer_console_size_and_depth(screen, mode, bytes_per_pixel);
-			}
-			else {
-				set_framebuffer_console_pixel_depth(screen, bytes_per_pixel);
-				need_to_set_console_size_16bpp_to_32bpp = 1;
-			}
-		}
+	// Calls made while starting the daemon.
+	trace_summary();
+	daemon_defaults.nu_framebuffer_buffers = nu_framebuffer_buffers;
+	daemon_defaults.set_virtual_buffers = set_virtual_buffers;
+	daemon_defaults.pan_scroll = pan_scroll;
+	daemon_defaults.use_scaler_for_large_32bpp_modes = use_scaler_for_large_32bpp_modes;
+	daemon_defaults.dram_bandwidth = dram_bandwidth;
+	daemon_defaults.use_fbset = use_fbset;
+	daemon_defaults.compare_with_fbset = compare_with_fbset;
+	daemon_defaults.refresh_modes = refresh_modes;
+	daemon_defaults.preserve_contents = preserve_contents;
+	daemon_defaults.dither_contents = dither_contents;
+	daemon_defaults.use_simd = use_simd;
+	daemon_defaults.bench_cpu = bench_cpu;
+	daemon_defaults.verbose = verbose;
+	daemon_defaults.screen_sequencing = screen_sequencing;
+	daemon_defaults.render_scale = render_scale;
 
-		// Set the mode.
-		args[0] = screen;
-		args[1] = mode;
-		ret = ioctl(fd_disp, DISP_CMD_HDMI_SET_MODE, args);
-		if (ret < 0) {
-			fprintf(stderr, "Error: ioctl(DISP_CMD_HDMI_SET_MODE) failed: %s\n",
-					strerror(-ret));
-			return ret;
+	printf("a10dispd listening on %s.\n", socket_file);
+	fflush(stdout);
+	while (!stop_requested) {
+		client_fd = accept(fd, NULL, NULL);
+		if (client_fd < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Error: accept() failed: %s\n", strerror(errno));
+			break;
 		}
+		handle_daemon_request(client_fd);
+		close(client_fd);
+	}
+	close(fd);
+	return 0;
+}
 
-		if (use_scaler_for_large_32bpp_modes)
-			if ((bytes_per_pixel == 4 || (bytes_per_pixel == 0 && previous_bytes_per_pixel == 4))
-			&& mode_size[mode] > 1280 * 1024) {
-				// Enable scaler for bigger modes at 32bpp.
-				enable_scaler_for_mode(screen, mode);
-			}
-		// When switching from LCD, we can assume scaler mode was disabled.
+// Send the command line to the daemon and show its output. Returns the exit code of the command.
 
-		// Turn HDMI on again.
-		args[0] = screen;
-		ioctl(fd_disp, DISP_CMD_HDMI_ON, args);
+static int run_client(int argc, char *argv[]) {
+	struct sockaddr_un addr;
+	char buffer[4096];
+	char exit_code[16];
+	int exit_code_size = 0;
+	int in_exit_code = 0;
+	int fd, i, n;
 
-		if (!(previous_bytes_per_pixel == 2 && bytes_per_pixel == 4) || need_to_set_console_size_16bpp_to_32bpp)
-			set_framebuffer_console_size_to_screen_size(screen);
+	if (strlen(socket_file) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket file name %s is too long.\n", socket_file);
+		return 1;
 	}
-	else
-	if (command == COMMAND_SWITCH_TO_LCD) {
-		int output_type;
-		args[0] = screen;
-		output_type = ioctl(fd_disp, DISP_CMD_GET_OUTPUT_TYPE, args);
-		if (output_type == DISP_OUTPUT_TYPE_LCD) {
-			printf("Cannot switch to LCD mode because LCD is already enabled.\n");
-			return 1;
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_file);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "Error: cannot connect to a10dispd on %s: %s\n", socket_file, strerror(errno));
+		return 1;
+	}
+	for (i = 1; i < argc; i++) {
+		if (strcasecmp(argv[i], "--client") == 0)
+			continue;
+		if (strcasecmp(argv[i], "--socket") == 0) {
+			i++;
+			continue;
 		}
-		if (output_type != DISP_OUTPUT_TYPE_HDMI) {
-			printf("Cannot switch to LCD mode because HDMI is not enabled.\n");
+		if (strchr(argv[i], '\n') != NULL) {
+			fprintf(stderr, "Arguments can't contain newlines.\n");
+			close(fd);
 			return 1;
 		}
-		// Turn HDMI off.
-		args[0] = screen;
-		ioctl(fd_disp, DISP_CMD_HDMI_OFF, args);
-		// Disable scaler mode.
-		disable_scaler(screen);
-		// Turn the LCD on.
-		args[0] = screen;
-		ioctl(fd_disp, DISP_CMD_LCD_ON, args);
-		// When changing from 16bpp to 32bpp, set the pixel depth and screen size
-		// with one command.
-		if (previous_bytes_per_pixel == 2)
-			set_framebuffer_console_size_to_screen_size_and_set_pixel_depth(screen, 4);
-		else
-			set_framebuffer_console_size_to_screen_size(screen);
+		dprintf(fd, "%s\n", argv[i]);
 	}
-	else
-	if (command == COMMAND_RESCALE)enable_scaler_for_size(screen,sc_source_width,sc_source_height,sc_width,sc_height);
-	else
-	if (command == COMMAND_DISABLE_SCALER) disable_scaler(screen);
+	dprintf(fd, "\n");
+	while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+		for (i = 0; i < n; i++) {
+			if (in_exit_code) {
+				if (exit_code_size < sizeof(exit_code) - 1)
+					exit_code[exit_code_size++] = buffer[i];
+			}
+			else
+			if (buffer[i] == '\0') {
+				fwrite(buffer, 1, i, stdout);
+				in_exit_code = 1;
+			}
+		}
+		if (!in_exit_code)
+			fwrite(buffer, 1, n, stdout);
+	}
+	close(fd);
+	if (!in_exit_code) {
+		fprintf(stderr, "Error: connection to a10dispd closed before the command completed.\n");
+		return 1;
+	}
+	exit_code[exit_code_size] = '\0';
+	return atoi(exit_code);
+}
 
-	else
-	if (command == COMMAND_CHANGE_HDMI_MODE || command == COMMAND_CHANGE_HDMI_MODE_FORCE) {
-		int output_type;
-		int need_to_set_console_size_16bpp_to_32bpp;
+static struct hotplug_source *hotplug_sources[] = {
+	&netlink_hotplug_source, &sysfs_hotplug_source, &feeder_hotplug_source
+};
 
-		args[0] = screen;
-		output_type = ioctl(fd_disp, DISP_CMD_GET_OUTPUT_TYPE, args);
-		if (output_type != DISP_OUTPUT_TYPE_HDMI) {
-		       printf("Cannot change HDMI mode because HDMI is not enabled.\n");
-			return 1;
+// Handle a change of the HDMI connection state: on connect, switch from LCD (or a disabled
+// output) to HDMI with the configured mode, or the highest resolution mode if none is given;
+// on disconnect, switch back to LCD.
+
+static int handle_hotplug(const struct command_args *c, int connected) {
+	struct command_args hotplug_command = *c;
+	unsigned long args[4] = { 0 };
+	int output_type;
+	args[0] = c->screen;
+	output_type = disp_ioctl(DISP_CMD_GET_OUTPUT_TYPE, args);
+	if (connected) {
+		// A different display may have been connected.
+		mode_cache_screen_state[c->screen] = 0;
+		edid_state = 0;
+		if (output_type == DISP_OUTPUT_TYPE_HDMI) {
+			printf("HDMI is already enabled.\n");
+			return 0;
 		}
-		if (command != COMMAND_CHANGE_HDMI_MODE_FORCE) {
-			args[0] = screen;
-			args[1] = mode;
-			ret = ioctl(fd_disp, DISP_CMD_HDMI_SUPPORT_MODE, args);
-			if (ret == 0) {
-				printf("Specified HDMI mode is not supported by the display according to the display driver.\n");
-				return - 1;
-			}
+		if (c->mode < 0) {
+			hotplug_command.command = COMMAND_AUTO_MODE;
+			hotplug_command.auto_mode_policy = AUTO_MODE_NATIVE;
+		}
+		else
+		if (output_type == DISP_OUTPUT_TYPE_LCD)
+			hotplug_command.command = COMMAND_SWITCH_TO_HDMI;
+		else
+			hotplug_command.command = COMMAND_ENABLE_HDMI;
+	}
+	else {
+		if (output_type != DISP_OUTPUT_TYPE_HDMI) {
+			printf("HDMI is not enabled.\n");
+			return 0;
 		}
+		hotplug_command.command = COMMAND_SWITCH_TO_LCD;
+	}
+	return execute_command(&hotplug_command);
+}
 
-		// Check that the framebuffer is large enough.
-		check_framebuffer_size(screen, mode, bytes_per_pixel);
+// Wait for HDMI hot plug events and apply the policy on every change. Returns the exit code.
 
-		// Turn HDMI off.
-		args[0] = screen;
-		ioctl(fd_disp, DISP_CMD_HDMI_OFF, args);
+static int run_monitor(const struct command_args *c) {
+	struct hotplug_source *source = NULL;
+	struct sigaction action;
+	unsigned long args[4] = { 0 };
+	const char *source_arg;
+	int state, new_state, ret;
+	jmp_buf jmp;
+	int i;
 
-		// When changing from 32bpp to 16bpp, disable the scaler and change the pixel depth first.
-		if (previous_bytes_per_pixel == 4 && bytes_per_pixel == 2) {
-			disable_scaler(screen);
-			set_framebuffer_console_pixel_depth(screen, bytes_per_pixel);
-		}
+	source_arg = strchr(hotplug_source_spec, ':');
+	for (i = 0; i < sizeof(hotplug_sources) / sizeof(hotplug_sources[0]); i++) {
+		int length = strlen(hotplug_sources[i]->name);
+		if (strncasecmp(hotplug_source_spec, hotplug_sources[i]->name, length) == 0 &&
+		(hotplug_source_spec[length] == '\0' || hotplug_source_spec[length] == ':'))
+			source = hotplug_sources[i];
+	}
+	if (source == NULL) {
+		printf("Unknown hot plug event source %s.\n", hotplug_source_spec);
+		return 1;
+	}
+	if (source->open(source_arg != NULL ? source_arg + 1 : NULL) < 0)
+		return 1;
 
-		// When changing from 16bpp to 32bpp, and the new mode is smaller than the previous one,
-		// set the console and pixel depth with one command, otherwise only set the pixel depth.
-		need_to_set_console_size_16bpp_to_32bpp = 0;
-		if (previous_bytes_per_pixel == 2 && bytes_per_pixel == 4) {
-			if (mode_size[mode] < previous_width * previous_height) {
-				set_framebuffer_console_size_and_depth(screen, mode, bytes_per_pixel);
-			}
-			else {
-				set_framebuffer_console_pixel_depth(screen, bytes_per_pixel);
-				need_to_set_console_size_16bpp_to_32bpp = 1;
-			}
-		}
+	// Stop on SIGINT and SIGTERM, which interrupt the wait for an event.
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stop_signal_handler;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
 
-		// Set the mode.
-		args[0] = screen;
-		args[1] = mode;
-		ret = ioctl(fd_disp, DISP_CMD_HDMI_SET_MODE, args);
-		if (ret < 0) {
-       			fprintf(stderr, "Error: ioctl(DISP_CMD_HDMI_SET_MODE) failed: %s\n",
-	     			strerror(-ret));
-			return ret;
+	args[0] = c->screen;
+	state = disp_ioctl(DISP_CMD_HDMI_GET_HPD_STATUS, args) == 1 ? HOTPLUG_CONNECTED : HOTPLUG_DISCONNECTED;
+	printf("Monitoring HDMI hot plug events for screen %d (%s), HDMI is %s.\n", c->screen, source->name,
+		state == HOTPLUG_CONNECTED ? "connected" : "disconnected");
+	// Apply the policy to the initial state, then to every change.
+	new_state = state;
+	state = HOTPLUG_UNKNOWN;
+	while (!stop_requested) {
+		if (state != HOTPLUG_UNKNOWN)
+			new_state = source->wait();
+		if (new_state == HOTPLUG_END)
+			break;
+		if (new_state == HOTPLUG_UNKNOWN) {
+			args[0] = c->screen;
+			new_state = disp_ioctl(DISP_CMD_HDMI_GET_HPD_STATUS, args) == 1 ? HOTPLUG_CONNECTED :
+				HOTPLUG_DISCONNECTED;
+		}
+		if (new_state == state)
+			continue;
+		if (state != HOTPLUG_UNKNOWN)
+			printf("HDMI %s.\n", new_state == HOTPLUG_CONNECTED ? "connected" : "disconnected");
+		state = new_state;
+		// Keep monitoring when switching fails.
+		if (setjmp(jmp) == 0) {
+			command_jmp_buf = &jmp;
+			begin_command_ioctls();
+			ret = handle_hotplug(c, state == HOTPLUG_CONNECTED);
+			show_command_ioctls();
 		}
-
-		if (use_scaler_for_large_32bpp_modes &&
-		((bytes_per_pixel == 4 || (bytes_per_pixel == 0 && previous_bytes_per_pixel == 4))
-		&& mode_size[mode] > 1280 * 1024))
-			// Enable scaler for bigger modes at 32bpp.
-			enable_scaler_for_mode(screen, mode);
 		else
-			disable_scaler(screen);
+			ret = command_exit_code;
+		command_jmp_buf = NULL;
+		if (ret != 0)
+			printf("Switching the display failed (exit code %d).\n", ret);
+		if (mode_cache_file != NULL)
+			save_mode_cache();
+		fflush(stdout);
+	}
+	source->close();
+	return 0;
+}
 
-		// Turn HDMI on again.
-		args[0] = screen;
-		ioctl(fd_disp, DISP_CMD_HDMI_ON, args);
+// Check the version of the display driver after opening the backend. Returns 0 if it can be used,
+// otherwise the exit code.
 
-		// If we didn't already, set the console framebuffer size to the new dimensions.
-		if (!(previous_bytes_per_pixel == 2 && bytes_per_pixel == 4) || need_to_set_console_size_16bpp_to_32bpp)
-			set_framebuffer_console_size_to_screen_size(screen);
+static int check_driver_version(void) {
+	unsigned long args[4] = { 0 };
+	int ver_major, ver_minor;
+	int ret;
+	args[0] = SUNXI_DISP_VERSION;
+	ret = disp_ioctl(DISP_CMD_VERSION, args);
+	if (ret == -1) {
+		printf("Warning: kernel sunxi disp driver does not support "
+		       "versioning.\n");
+		ver_major = ver_minor = 0;
+	} else if (ret < 0) {
+		fprintf(stderr, "Error: ioctl(VERSION) failed: %s\n",
+			strerror(-ret));
+		return ret;
+	} else {
+		ver_major = ret >> 16;
+		ver_minor = ret & 0xFFFF;
+		driver_version = ret;
+		printf("sunxi disp kernel module version is %d.%d\n",
+		       ver_major, ver_minor);
 	}
-	else
-	if (command == COMMAND_CHANGE_PIXEL_DEPTH) {
-		int output_type;
+	if (ver_major < 1) {
+		printf("This program requires sunxi display driver 1.0 or higher.\n"
+			"Upgrade your kernel.\n");
+		return - 1;
+	}
+	return 0;
+}
 
-		if (bytes_per_pixel == previous_bytes_per_pixel) {
-			printf("Display is already set to pixel depth of %dbpp.\n", bytes_per_pixel * 8);
-			return 1;
-		}
+// Select the display driver backend, unless selected with --sim or --replay.
 
-		args[0] = screen;
-		output_type = ioctl(fd_disp, DISP_CMD_GET_OUTPUT_TYPE, args);
-		if (output_type != DISP_OUTPUT_TYPE_HDMI) {
-	       		printf("Cannot change color depth because HDMI is not enabled.\n");
+static void select_backend(void) {
+#ifdef A10DISP_SIM_ONLY
+	if (backend == NULL)
+		backend = &sim_backend;
+#else
+	if (backend == NULL)
+		backend = &sunxi_backend;
+#endif
+}
+
+int a10disp_run(int argc, char *argv[]) {
+	struct command_args c;
+	int ret;
+	if (load_modes_file(DEFAULT_MODES_FILE, 0) < 0)
+		return 1;
+	if (argc == 1) {
+		usage(argc, argv);
+		return 0;
+	}
+	ret = parse_command_line(argc, argv, &c, 0);
+	if (ret != 0)
+		return ret;
+	if (use_daemon && c.command != COMMAND_DAEMON)
+		return run_client(argc, argv);
+	// The conversion and console benchmarks, the framebuffer benchmark of a given device or
+	// file, recorddiff and edid don't need the display driver.
+	if (c.command == COMMAND_CONVERT_BENCH)
+		return run_convert_benchmark(c.width, c.height, c.iterations);
+	if (c.command == COMMAND_FB_BENCH && c.bench_file != NULL)
+		return run_fb_benchmark(&c);
+	if (c.command == COMMAND_CONSOLE_BENCH)
+		return run_console_benchmark(&c);
+	if (c.command == COMMAND_RECORD_DIFF)
+		return record_diff(c.record_file[0], c.record_file[1]);
+	if (c.command == COMMAND_EDID)
+		return show_edid_files(c.nu_edid_files, c.edid_files);
+
+	select_backend();
+	if (record_file_name != NULL) {
+		if (record_open(record_file_name) < 0)
 			return 1;
-		}
+		backend = record_backend(backend);
+		atexit(record_close);
+	}
+	if (trace_file_name != NULL) {
+		if (trace_open(trace_file_name) < 0)
+			return 1;
+		backend = trace_backend(backend);
+		// Registered first, so that it runs after the backend has been closed.
+		atexit(trace_close);
+		trace_command(c.name);
+	}
+	if (backend->open() < 0)
+		return errno;
+	atexit(close_backend);
 
-		// Get the current HDMI mode.
-		args[0] = screen;
-		mode = ioctl(fd_disp, DISP_CMD_HDMI_GET_MODE, args);
+	ret = check_driver_version();
+	if (ret != 0)
+		return ret;
 
-		// Check that the framebuffer is large enough.
-		check_framebuffer_size(screen, mode, bytes_per_pixel);
+	if (c.command == COMMAND_DAEMON)
+		return run_daemon();
+	if (c.command == COMMAND_MONITOR)
+		return run_monitor(&c);
+	begin_command_ioctls();
+	if (c.bench_iterations > 0)
+		ret = run_benchmark(&c, c.bench_iterations, c.name);
+	else
+		ret = execute_command(&c);
+	show_command_ioctls();
+	return ret;
+}
 
-		// Turn HDMI off.
-      		args[0] = screen;
-		ioctl(fd_disp, DISP_CMD_HDMI_OFF, args);
+// Library API (liba10disp.h). The functions run the same code as the commands, with failures
+// returned as error codes instead of exiting.
 
-		// mode is equal to 0xFF when EDID setting is enabled.
-		int large_mode;
-		if (mode >= 0 && mode < MODE_COUNT)
-			large_mode = (mode_size[mode] > 1280 * 1024);
-		else
-			large_mode = (previous_width * previous_height > 1280 * 1024);
+struct a10disp_context {
+	int open;
+};
 
-		if (bytes_per_pixel == 4 && use_scaler_for_large_32bpp_modes && large_mode)
-			// Enable scaler for bigger modes at 32bpp.
-			enable_scaler_for_mode(screen, mode);
-		else
-			disable_scaler(screen);
+static struct a10disp_context library_context;
 
-		set_framebuffer_console_pixel_depth(screen, bytes_per_pixel);
+// The library output types are the display driver values.
+typedef char check_output_types[A10DISP_OUTPUT_LCD == DISP_OUTPUT_TYPE_LCD &&
+	A10DISP_OUTPUT_HDMI == DISP_OUTPUT_TYPE_HDMI && A10DISP_OUTPUT_TV == DISP_OUTPUT_TYPE_TV &&
+	A10DISP_OUTPUT_VGA == DISP_OUTPUT_TYPE_VGA && A10DISP_OUTPUT_NONE == DISP_OUTPUT_TYPE_NONE ? 1 : - 1];
 
-		// Turn HDMI on again.
-		args[0] = screen;
-		ioctl(fd_disp, DISP_CMD_HDMI_ON, args);
+// Returns the error code of a command that returned the given exit code.
+
+static int library_error(int ret) {
+	if (ret == 0)
+		return A10DISP_OK;
+	return command_error != 0 ? command_error : A10DISP_ERROR;
+}
+
+// Execute a command, returning failures as an error code.
+
+static int run_library_command(const struct command_args *c) {
+	jmp_buf jmp, *saved_jmp_buf = command_jmp_buf;
+	int ret;
+	command_error = 0;
+	if (setjmp(jmp) == 0) {
+		command_jmp_buf = &jmp;
+		begin_command_ioctls();
+		ret = execute_command(c);
 	}
 	else
-	if (command == COMMAND_DISPLAY_OFF) {
-		int output_type;
-		args[0] = screen;
-		output_type = ioctl(fd_disp, DISP_CMD_GET_OUTPUT_TYPE, args);
-		if (output_type == DISP_OUTPUT_TYPE_HDMI) {
-	      		args[0] = screen;
-			ioctl(fd_disp, DISP_CMD_HDMI_OFF, args);
-		}
+		ret = command_exit_code;
+	command_jmp_buf = saved_jmp_buf;
+	return library_error(ret);
+}
+
+a10disp_context *a10disp_open(const char *sim_spec, int *error) {
+	int ret = A10DISP_OK;
+	if (library_context.open)
+		ret = A10DISP_ERROR_BUSY;
+	else
+	if (sim_spec != NULL && sim_configure(sim_spec) < 0)
+		ret = A10DISP_ERROR_INVALID;
+	else
+	if (load_modes_file(DEFAULT_MODES_FILE, 0) < 0)
+		ret = A10DISP_ERROR_INVALID;
+	else {
+		if (sim_spec != NULL)
+			backend = &sim_backend;
+		select_backend();
+		if (backend->open() < 0)
+			ret = A10DISP_ERROR_OPEN;
 		else
-		if (output_type == DISP_OUTPUT_TYPE_LCD) {
-			args[0] = screen;
-			ioctl(fd_disp, DISP_CMD_LCD_OFF, args);
+		if (check_driver_version() != 0) {
+			backend->close();
+			ret = A10DISP_ERROR_OPEN;
 		}
-		else
-		if (output_type == DISP_OUTPUT_TYPE_VGA) {
-			args[0] = screen;
-			ioctl(fd_disp, DISP_CMD_VGA_OFF, args);
+	}
+	if (error != NULL)
+		*error = ret;
+	if (ret != A10DISP_OK)
+		return NULL;
+	library_context.open = 1;
+	return &library_context;
+}
+
+void a10disp_close(a10disp_context *ctx) {
+	if (ctx == NULL || !ctx->open)
+		return;
+	if (mode_cache_file != NULL)
+		save_mode_cache();
+	backend->close();
+	ctx->open = 0;
+}
+
+int a10disp_set_buffers(a10disp_context *ctx, int nu_buffers) {
+	if (ctx == NULL || !ctx->open || nu_buffers < 1 || nu_buffers > 8)
+		return A10DISP_ERROR_INVALID;
+	nu_framebuffer_buffers = nu_buffers;
+	return A10DISP_OK;
+}
+
+int a10disp_get_screen_info(a10disp_context *ctx, int screen, struct a10disp_screen_info *info) {
+	jmp_buf jmp, *saved_jmp_buf = command_jmp_buf;
+	struct screen_state state;
+	int ret;
+	if (ctx == NULL || !ctx->open || screen < 0 || screen > 1 || info == NULL)
+		return A10DISP_ERROR_INVALID;
+	command_error = 0;
+	if (setjmp(jmp) == 0) {
+		command_jmp_buf = &jmp;
+		begin_command_ioctls();
+		ret = read_screen_state(screen, &state);
+		if (ret == 0) {
+			memset(info, 0, sizeof(*info));
+			info->output = state.output_type;
+			info->mode = state.mode;
+			if (state.output_type != DISP_OUTPUT_TYPE_NONE)
+				get_screen_size(screen, &info->width, &info->height);
+			info->fb_width = state.console_width;
+			info->fb_height = state.console_height;
+			info->bits_per_pixel = state.bytes_per_pixel * 8;
+			info->scaler = state.layer_mode == DISP_LAYER_WORK_MODE_SCALER;
+			info->src_width = state.src_width;
+			info->src_height = state.src_height;
+			info->scn_width = state.scn_width;
+			info->scn_height = state.scn_height;
 		}
 		else
-		if (output_type == DISP_OUTPUT_TYPE_TV) {
-			args[0] = screen;
-			ioctl(fd_disp, DISP_CMD_TV_OFF, args);
-		}
+			command_error = A10DISP_ERROR_DRIVER;
 	}
 	else
-	if (command == COMMAND_LCD_ON) {
-		int output_type;
-		args[0] = screen;
-		output_type = ioctl(fd_disp, DISP_CMD_GET_OUTPUT_TYPE, args);
-		if (output_type != DISP_OUTPUT_TYPE_NONE) {
-			printf("Display must be off for lcdon.\n");
-			return - 1;
-		}
-		args[0] = screen;
-		ioctl(fd_disp, DISP_CMD_LCD_ON, args);
-		// When changing from 16bpp to 32bpp, set the pixel depth and screen size
-		// with one command.
-		if (previous_bytes_per_pixel == 2)
-			set_framebuffer_console_size_to_screen_size_and_set_pixel_depth(screen, 4);
-		else
-			set_framebuffer_console_size_to_screen_size(screen);
+		ret = command_exit_code;
+	command_jmp_buf = saved_jmp_buf;
+	return library_error(ret);
+}
+
+int a10disp_hdmi_mode_supported(a10disp_context *ctx, int screen, int mode) {
+	jmp_buf jmp, *saved_jmp_buf = command_jmp_buf;
+	int ret;
+	if (ctx == NULL || !ctx->open || screen < 0 || screen > 1 || mode < 0 || mode >= nu_modes)
+		return A10DISP_ERROR_INVALID;
+	command_error = 0;
+	if (setjmp(jmp) == 0) {
+		command_jmp_buf = &jmp;
+		ret = hdmi_mode_supported(screen, mode) != 0;
 	}
+	else
+		ret = library_error(command_exit_code);
+	command_jmp_buf = saved_jmp_buf;
+	return ret;
+}
+
+void a10disp_target_init(struct a10disp_target *target) {
+	memset(target, 0, sizeof(*target));
+	target->output = - 1;
+	target->mode = - 1;
+	target->scaler = - 1;
+}
+
+// Convert a library target to a screen target. Returns -1 if it is not valid.
+
+static int library_screen_target(const struct a10disp_target *target, struct screen_target *t) {
+	memset(t, 0, sizeof(*t));
+	t->output_type = - 1;
+	t->mode = - 1;
+	t->scaler = - 1;
+	if (target == NULL)
+		return 0;
+	if (target->output >= 0 && target->output != A10DISP_OUTPUT_NONE && target->output != A10DISP_OUTPUT_LCD &&
+	target->output != A10DISP_OUTPUT_HDMI)
+		return - 1;
+	if (target->mode >= 0 && !mode_valid(target->mode))
+		return - 1;
+	if (target->bits_per_pixel != 0 && target->bits_per_pixel != 16 && target->bits_per_pixel != 32)
+		return - 1;
+	if (target->src_width < 0 || target->src_height < 0 || (target->src_width > 0) != (target->src_height > 0) ||
+	target->scn_width < 0 || target->scn_height < 0 || (target->scn_width > 0) != (target->scn_height > 0))
+		return - 1;
+	t->given = 1;
+	t->output_type = target->output;
+	t->mode = target->mode < 0 ? - 1 : target->mode;
+	t->bytes_per_pixel = target->bits_per_pixel / 8;
+	t->src_width = target->src_width;
+	t->src_height = target->src_height;
+	t->scn_width = target->scn_width;
+	t->scn_height = target->scn_height;
+	t->scaler = target->scaler < 0 ? - 1 : target->scaler != 0;
 	return 0;
 }
+
+int a10disp_apply(a10disp_context *ctx, const struct a10disp_target *target0,
+const struct a10disp_target *target1) {
+	struct command_args c;
+	if (ctx == NULL || !ctx->open)
+		return A10DISP_ERROR_INVALID;
+	memset(&c, 0, sizeof(c));
+	c.command = COMMAND_APPLY;
+	c.name = "apply";
+	if (library_screen_target(target0, &c.target[0]) < 0 || library_screen_target(target1, &c.target[1]) < 0)
+		return A10DISP_ERROR_INVALID;
+	return run_library_command(&c);
+}
+
+int a10disp_apply_settings(a10disp_context *ctx, const char *settings) {
+	struct command_args c;
+	char buffer[512], *setting, *saveptr;
+	int i;
+	if (ctx == NULL || !ctx->open || settings == NULL || strlen(settings) >= sizeof(buffer))
+		return A10DISP_ERROR_INVALID;
+	memset(&c, 0, sizeof(c));
+	c.command = COMMAND_APPLY;
+	c.name = "apply";
+	for (i = 0; i < 2; i++) {
+		c.target[i].output_type = - 1;
+		c.target[i].mode = - 1;
+		c.target[i].scaler = - 1;
+	}
+	strcpy(buffer, settings);
+	for (setting = strtok_r(buffer, " ,\t\n", &saveptr); setting != NULL;
+	setting = strtok_r(NULL, " ,\t\n", &saveptr))
+		if (parse_screen_target(setting, 0, c.target) < 0) {
+			printf("Invalid setting %s for apply.\n", setting);
+			return A10DISP_ERROR_INVALID;
+		}
+	return run_library_command(&c);
+}
+
+const char *a10disp_mode_info(int mode, int *width, int *height, int *refresh) {
+	if (!mode_valid(mode))
+		return NULL;
+	if (width != NULL)
+		*width = mode_timing[mode].width;
+	if (height != NULL)
+		*height = mode_timing[mode].height;
+	if (refresh != NULL)
+		*refresh = mode_timing[mode].refresh;
+	return mode_timing[mode].name;
+}
+
+const char *a10disp_strerror(int error) {
+	switch (error) {
+	case A10DISP_OK :
+		return "Success";
+	case A10DISP_ERROR_INVALID :
+		return "Invalid argument";
+	case A10DISP_ERROR_OPEN :
+		return "Display driver could not be opened";
+	case A10DISP_ERROR_BUSY :
+		return "A context is already open";
+	case A10DISP_ERROR_DRIVER :
+		return "Display driver call failed";
+	case A10DISP_ERROR_UNSUPPORTED :
+		return "HDMI mode not supported by the display";
+	case A10DISP_ERROR_FRAMEBUFFER :
+		return "Framebuffer memory too small";
+	default :
+		return "Operation failed";
+	}
+}
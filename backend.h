@@ -0,0 +1,69 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  Display driver backend interface. All access to /dev/disp and /dev/fb0-1
+  goes through a backend, so that the program can also run against a
+  simulated display driver.
+*/
+
+#ifndef A10DISP_BACKEND_H
+#define A10DISP_BACKEND_H
+
+#include <stddef.h>
+#include <linux/fb.h>
+#ifdef A10DISP_SIM_ONLY
+// Build without the kernel header; only the simulated backend is available.
+#include "sunxi_disp_compat.h"
+#else
+#include "sunxi_disp_ioctl.h"
+#endif
+
+#define MODE_COUNT DISP_TV_MODE_NUM
+
+// Each function mirrors the corresponding system call: on failure -1 is returned
+// and errno is set. disp_ioctl takes the driver's argument array of four
+// unsigned longs; pointer arguments are stored in it as unsigned long.
+
+struct disp_backend {
+	const char *name;
+	int (*open)(void);
+	void (*close)(void);
+	int (*disp_ioctl)(unsigned int cmd, unsigned long *args);
+	int (*fb_ioctl)(int fb, unsigned long cmd, void *arg);
+	// Change the console framebuffer with fbset. command is the fbset command line,
+	// the other arguments are the equivalent geometry (zero means unchanged).
+	int (*fbset)(int fb, const char *command, int width, int height, int bytes_per_pixel);
+	// Restore the state the display was in when the backend was opened, so that a command
+	// can be repeated with the same starting point. NULL if not possible.
+	void (*reset)(void);
+	// Map length bytes of the framebuffer memory of /dev/fbN for reading and writing. Returns
+	// MAP_FAILED on failure, like mmap().
+	void *(*fb_mmap)(int fb, size_t length);
+	void (*fb_munmap)(int fb, void *address, size_t length);
+};
+
+// Timing of a display driver mode. The refresh rate of interlaced modes is the field rate.
+// Mode numbers without a mode have a width of zero.
+struct mode_timing {
+	const char *name;
+	int width, height;
+	int refresh;
+	int interlaced;
+	// Pixel clock in kHz.
+	int pixel_clock;
+};
+
+// The table holds the modes of the display driver header and custom modes of kernels built
+// with extra modes, loaded at startup (--modes). Mode numbers are stored in 64-bit masks by the
+// mode cache, hence the maximum.
+#define MAX_MODES 64
+
+extern struct mode_timing mode_timing[MAX_MODES];
+// Number of mode numbers in use, MODE_COUNT plus custom modes.
+extern int nu_modes;
+
+// sim_backend.c
+extern struct disp_backend sim_backend;
+int sim_configure(const char *spec);
+
+#endif
@@ -0,0 +1,335 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  EDID parser. The base block provides the detailed timings (the first one is
+  the preferred timing of the display), the established and standard timings,
+  the display name and the range limits. CTA-861 extension blocks provide
+  more detailed timings, the short video descriptors (CTA video formats,
+  possibly marked native) and whether the display is HDMI.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "edid.h"
+
+static const unsigned char edid_header[8] = { 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00 };
+
+struct edid_video_format {
+	int vic;
+	int width, height;
+	int refresh;
+	int interlaced;
+	int pixel_clock;
+};
+
+// The CTA-861 video formats that can be mapped onto display driver modes, and the common
+// higher ones. 480i and 576i are 1440 pixels wide with pixel repetition; the width without it is
+// given.
+static const struct edid_video_format edid_video_formats[] = {
+	{ 1, 640, 480, 60, 0, 25175 },
+	{ 2, 720, 480, 60, 0, 27000 },
+	{ 3, 720, 480, 60, 0, 27000 },
+	{ 4, 1280, 720, 60, 0, 74250 },
+	{ 5, 1920, 1080, 60, 1, 74250 },
+	{ 6, 720, 480, 60, 1, 13500 },
+	{ 7, 720, 480, 60, 1, 13500 },
+	{ 14, 1440, 480, 60, 0, 54000 },
+	{ 15, 1440, 480, 60, 0, 54000 },
+	{ 16, 1920, 1080, 60, 0, 148500 },
+	{ 17, 720, 576, 50, 0, 27000 },
+	{ 18, 720, 576, 50, 0, 27000 },
+	{ 19, 1280, 720, 50, 0, 74250 },
+	{ 20, 1920, 1080, 50, 1, 74250 },
+	{ 21, 720, 576, 50, 1, 13500 },
+	{ 22, 720, 576, 50, 1, 13500 },
+	{ 29, 1440, 576, 50, 0, 54000 },
+	{ 30, 1440, 576, 50, 0, 54000 },
+	{ 31, 1920, 1080, 50, 0, 148500 },
+	{ 32, 1920, 1080, 24, 0, 74250 },
+	{ 33, 1920, 1080, 25, 0, 74250 },
+	{ 34, 1920, 1080, 30, 0, 74250 },
+	{ 60, 1280, 720, 24, 0, 59400 },
+	{ 61, 1280, 720, 25, 0, 74250 },
+	{ 62, 1280, 720, 30, 0, 74250 },
+	{ 63, 1920, 1080, 120, 0, 297000 },
+	{ 64, 1920, 1080, 100, 0, 297000 },
+	{ 93, 3840, 2160, 24, 0, 297000 },
+	{ 94, 3840, 2160, 25, 0, 297000 },
+	{ 95, 3840, 2160, 30, 0, 297000 },
+	{ 96, 3840, 2160, 50, 0, 594000 },
+	{ 97, 3840, 2160, 60, 0, 594000 },
+	{ 0 }
+};
+
+// The established timings, in the order of the bits of bytes 35-37 (most significant bit first).
+static const struct {
+	int width, height, refresh, interlaced;
+} edid_established_timings[17] = {
+	{ 720, 400, 70, 0 }, { 720, 400, 88, 0 }, { 640, 480, 60, 0 }, { 640, 480, 67, 0 },
+	{ 640, 480, 72, 0 }, { 640, 480, 75, 0 }, { 800, 600, 56, 0 }, { 800, 600, 60, 0 },
+	{ 800, 600, 72, 0 }, { 800, 600, 75, 0 }, { 832, 624, 75, 0 }, { 1024, 768, 87, 1 },
+	{ 1024, 768, 60, 0 }, { 1024, 768, 70, 0 }, { 1024, 768, 75, 0 }, { 1280, 1024, 75, 0 },
+	{ 1152, 870, 75, 0 }
+};
+
+static int hex_digit(int c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c = tolower(c);
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return - 1;
+}
+
+int edid_read(const char *file, unsigned char *data, int max_size) {
+	unsigned char buffer[EDID_MAX_SIZE * 4];
+	FILE *f;
+	int n, i, size, high;
+	f = fopen(file, "rb");
+	if (f == NULL)
+		return - 1;
+	n = fread(buffer, 1, sizeof(buffer), f);
+	fclose(f);
+	if (n >= 8 && memcmp(buffer, edid_header, 8) == 0) {
+		if (n > max_size)
+			n = max_size;
+		memcpy(data, buffer, n);
+		return n;
+	}
+	// Hexadecimal text; anything that isn't a hex digit separates the bytes.
+	size = 0;
+	high = - 1;
+	for (i = 0; i < n && size < max_size; i++) {
+		int digit = hex_digit(buffer[i]);
+		if (buffer[i] == 'x' && high == 0) {
+			// "0x" prefix.
+			high = - 1;
+			continue;
+		}
+		if (digit < 0) {
+			if (high >= 0)
+				data[size++] = high;
+			high = - 1;
+			continue;
+		}
+		if (high < 0)
+			high = digit;
+		else {
+			data[size++] = high * 16 + digit;
+			high = - 1;
+		}
+	}
+	if (high >= 0 && size < max_size)
+		data[size++] = high;
+	return size;
+}
+
+// Add a timing, merging it with an existing one with the same format.
+
+static void edid_add_timing(struct edid_info *info, const struct edid_timing *t) {
+	int i;
+	if (t->width <= 0 || t->height <= 0 || t->refresh <= 0)
+		return;
+	for (i = 0; i < info->nu_timings; i++) {
+		struct edid_timing *e = &info->timing[i];
+		if (e->width == t->width && e->height == t->height && e->refresh == t->refresh &&
+		e->interlaced == t->interlaced) {
+			e->preferred |= t->preferred;
+			e->native |= t->native;
+			if (e->vic == 0)
+				e->vic = t->vic;
+			if (e->pixel_clock == 0)
+				e->pixel_clock = t->pixel_clock;
+			return;
+		}
+	}
+	if (info->nu_timings < EDID_MAX_TIMINGS)
+		info->timing[info->nu_timings++] = *t;
+}
+
+static void edid_add_video_format(struct edid_info *info, int vic, int native) {
+	struct edid_timing t;
+	int i;
+	for (i = 0; edid_video_formats[i].vic != 0; i++)
+		if (edid_video_formats[i].vic == vic) {
+			memset(&t, 0, sizeof(t));
+			t.source = EDID_SOURCE_CTA;
+			t.width = edid_video_formats[i].width;
+			t.height = edid_video_formats[i].height;
+			t.refresh = edid_video_formats[i].refresh;
+			t.interlaced = edid_video_formats[i].interlaced;
+			t.pixel_clock = edid_video_formats[i].pixel_clock;
+			t.native = native;
+			t.vic = vic;
+			edid_add_timing(info, &t);
+			return;
+		}
+}
+
+// Parse an 18-byte descriptor: a detailed timing, or a display descriptor when the pixel clock
+// is zero.
+
+static void edid_parse_descriptor(struct edid_info *info, const unsigned char *d, int preferred, int native) {
+	struct edid_timing t;
+	int htotal, vtotal, vactive;
+	int pixel_clock = d[0] | (d[1] << 8);
+	if (pixel_clock == 0) {
+		if (d[3] == 0xFC) {
+			// Display name, terminated by a newline.
+			int i;
+			for (i = 0; i < 13 && d[5 + i] != '\n' && d[5 + i] != '\0'; i++)
+				info->name[i] = d[5 + i];
+			info->name[i] = '\0';
+			while (i > 0 && info->name[i - 1] == ' ')
+				info->name[--i] = '\0';
+		}
+		else
+		if (d[3] == 0xFD) {
+			info->min_vrate = d[5];
+			info->max_vrate = d[6];
+			info->min_hrate = d[7];
+			info->max_hrate = d[8];
+			info->max_pixel_clock = d[9] * 10;
+		}
+		return;
+	}
+	memset(&t, 0, sizeof(t));
+	t.source = EDID_SOURCE_DETAILED;
+	t.pixel_clock = pixel_clock * 10;
+	t.width = d[2] | ((d[4] & 0xF0) << 4);
+	htotal = t.width + (d[3] | ((d[4] & 0x0F) << 8));
+	vactive = d[5] | ((d[7] & 0xF0) << 4);
+	vtotal = vactive + (d[6] | ((d[7] & 0x0F) << 8));
+	t.interlaced = (d[17] & 0x80) != 0;
+	// The vertical values of an interlaced timing are those of a field.
+	t.height = t.interlaced ? vactive * 2 : vactive;
+	if (htotal > 0 && vtotal > 0)
+		t.refresh = (int)(t.pixel_clock * 1000.0 / ((double)htotal * vtotal) + 0.5);
+	t.preferred = preferred;
+	t.native = native;
+	edid_add_timing(info, &t);
+}
+
+static void edid_parse_cta_block(struct edid_info *info, const unsigned char *b) {
+	int dtd_offset = b[2];
+	int nu_native = b[3] & 0x0F;
+	int i, n;
+	info->nu_cta_blocks++;
+	// Data block collection.
+	for (i = 4; dtd_offset >= 4 && i < dtd_offset && i < 127; ) {
+		int tag = b[i] >> 5;
+		int length = b[i] & 0x1F;
+		const unsigned char *p = b + i + 1;
+		if (i + 1 + length > 127)
+			break;
+		if (tag == 2) {
+			// Video data block: short video descriptors.
+			int j;
+			for (j = 0; j < length; j++) {
+				int svd = p[j];
+				if (svd >= 129 && svd <= 192)
+					edid_add_video_format(info, svd & 0x7F, 1);
+				else
+				if (svd != 0 && svd != 128)
+					edid_add_video_format(info, svd, 0);
+			}
+		}
+		else
+		if (tag == 3 && length >= 3 && p[0] == 0x03 && p[1] == 0x0C && p[2] == 0x00)
+			info->hdmi = 1;
+		i += 1 + length;
+	}
+	// Detailed timings.
+	if (dtd_offset < 4)
+		return;
+	for (i = dtd_offset, n = 0; i + 18 <= 127; i += 18, n++) {
+		if (b[i] == 0 && b[i + 1] == 0)
+			break;
+		edid_parse_descriptor(info, b + i, 0, n < nu_native);
+	}
+}
+
+int edid_parse(const unsigned char *data, int size, struct edid_info *info) {
+	int block, i;
+	memset(info, 0, sizeof(*info));
+	if (size < 128 || memcmp(data, edid_header, 8) != 0)
+		return - 1;
+	info->manufacturer[0] = '@' + ((data[8] >> 2) & 0x1F);
+	info->manufacturer[1] = '@' + (((data[8] & 0x03) << 3) | (data[9] >> 5));
+	info->manufacturer[2] = '@' + (data[9] & 0x1F);
+	info->manufacturer[3] = '\0';
+	info->product = data[10] | (data[11] << 8);
+	info->serial = data[12] | (data[13] << 8) | (data[14] << 16) | ((unsigned int)data[15] << 24);
+	info->year = data[17] + 1990;
+	info->version = data[18];
+	info->revision = data[19];
+	info->width_cm = data[21];
+	info->height_cm = data[22];
+	info->nu_extensions = data[126];
+	for (block = 0; block <= info->nu_extensions && (block + 1) * 128 <= size; block++) {
+		unsigned char sum = 0;
+		for (i = 0; i < 128; i++)
+			sum += data[block * 128 + i];
+		if (sum != 0)
+			info->checksum_errors++;
+	}
+	// The first detailed timing is the preferred timing.
+	for (i = 0; i < 4; i++)
+		edid_parse_descriptor(info, data + 54 + i * 18, i == 0, 0);
+	for (i = 0; i < 17; i++)
+		if (data[35 + i / 8] & (0x80 >> (i % 8))) {
+			struct edid_timing t;
+			memset(&t, 0, sizeof(t));
+			t.source = EDID_SOURCE_ESTABLISHED;
+			t.width = edid_established_timings[i].width;
+			t.height = edid_established_timings[i].height;
+			t.refresh = edid_established_timings[i].refresh;
+			t.interlaced = edid_established_timings[i].interlaced;
+			edid_add_timing(info, &t);
+		}
+	for (i = 0; i < 8; i++) {
+		const unsigned char *s = data + 38 + i * 2;
+		struct edid_timing t;
+		if ((s[0] == 0x01 && s[1] == 0x01) || s[0] == 0x00)
+			continue;
+		memset(&t, 0, sizeof(t));
+		t.source = EDID_SOURCE_STANDARD;
+		t.width = (s[0] + 31) * 8;
+		switch (s[1] >> 6) {
+		case 0 :
+			// 16:10, or 1:1 before EDID 1.3.
+			t.height = (info->version == 1 && info->revision < 3) ? t.width : t.width * 10 / 16;
+			break;
+		case 1 :
+			t.height = t.width * 3 / 4;
+			break;
+		case 2 :
+			t.height = t.width * 4 / 5;
+			break;
+		default :
+			t.height = t.width * 9 / 16;
+			break;
+		}
+		t.refresh = (s[1] & 0x3F) + 60;
+		edid_add_timing(info, &t);
+	}
+	for (block = 1; block <= info->nu_extensions && (block + 1) * 128 <= size; block++)
+		if (data[block * 128] == 0x02)
+			edid_parse_cta_block(info, data + block * 128);
+	return 0;
+}
+
+const char *edid_source_name(int source) {
+	switch (source) {
+	case EDID_SOURCE_DETAILED :
+		return "detailed";
+	case EDID_SOURCE_ESTABLISHED :
+		return "established";
+	case EDID_SOURCE_STANDARD :
+		return "standard";
+	default :
+		return "CTA-861";
+	}
+}
@@ -0,0 +1,67 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  EDID parser for the base block and CTA-861 extension blocks, used to find
+  the native mode of the connected display without probing every mode with
+  DISP_CMD_HDMI_SUPPORT_MODE.
+*/
+
+#ifndef A10DISP_EDID_H
+#define A10DISP_EDID_H
+
+#define EDID_MAX_SIZE 1024
+#define EDID_MAX_TIMINGS 64
+
+// Where a timing was found.
+#define EDID_SOURCE_DETAILED	0
+#define EDID_SOURCE_ESTABLISHED	1
+#define EDID_SOURCE_STANDARD	2
+#define EDID_SOURCE_CTA			3
+
+struct edid_timing {
+	int source;
+	int width, height;
+	// Refresh rate rounded to Hz; for interlaced timings this is the field rate.
+	int refresh;
+	int interlaced;
+	// Pixel clock in kHz, zero if not known.
+	int pixel_clock;
+	// The preferred timing (the first detailed timing), or a native CTA video format.
+	int preferred;
+	int native;
+	// CTA-861 video identification code, zero if none.
+	int vic;
+};
+
+struct edid_info {
+	char manufacturer[4];
+	int product;
+	unsigned int serial;
+	int year;
+	int version, revision;
+	char name[14];
+	// Screen size in cm (zero if not given).
+	int width_cm, height_cm;
+	// Range limits (zero if not given): vertical rate in Hz, horizontal rate in kHz, pixel
+	// clock in MHz.
+	int min_vrate, max_vrate, min_hrate, max_hrate, max_pixel_clock;
+	int nu_extensions;
+	int nu_cta_blocks;
+	// Whether an HDMI vendor-specific data block is present.
+	int hdmi;
+	// Number of blocks with a wrong checksum.
+	int checksum_errors;
+	int nu_timings;
+	struct edid_timing timing[EDID_MAX_TIMINGS];
+};
+
+// Read an EDID from a file, either binary or as hexadecimal text (as some kernels present it in
+// sysfs). Returns the size in bytes, or -1 if it can't be read.
+int edid_read(const char *file, unsigned char *data, int max_size);
+
+// Parse an EDID. Returns -1 if it doesn't start with a valid base block.
+int edid_parse(const unsigned char *data, int size, struct edid_info *info);
+
+const char *edid_source_name(int source);
+
+#endif
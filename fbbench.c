@@ -0,0 +1,206 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  Framebuffer memory throughput benchmark. Framebuffer memory is usually mapped
+  uncached or write-combined, so reads are much slower than writes and the
+  width of the stores matters; the scalar code uses 32-bit accesses, the SIMD
+  code 128-bit accesses (SSE2 or NEON).
+*/
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define FBBENCH_SIMD_NAME "SSE2"
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FBBENCH_SIMD_NAME "NEON"
+#endif
+
+#include "fbbench.h"
+
+#define FBBENCH_WRITE	0
+#define FBBENCH_READ	1
+#define FBBENCH_BLIT	2
+#define FBBENCH_FILL	3
+#define FBBENCH_NU_TESTS	4
+
+static const char *fbbench_test_str[FBBENCH_NU_TESTS] = { "write", "read", "blit", "fill" };
+
+static double fbbench_time_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+int fbbench_pin_cpu(int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set);
+}
+
+// Sink for the result of the read test, so that the reads aren't optimized away.
+static volatile uint32_t fbbench_sink;
+
+static void run_scalar(int test, void *framebuffer, const void *source, size_t size, uint32_t value) {
+	volatile uint32_t *d = framebuffer;
+	const uint32_t *s = source;
+	size_t i, n = size / 4;
+	uint32_t sum = 0;
+	switch (test) {
+	case FBBENCH_WRITE :
+		for (i = 0; i < n; i++)
+			d[i] = value + i;
+		break;
+	case FBBENCH_READ :
+		for (i = 0; i < n; i++)
+			sum ^= d[i];
+		fbbench_sink = sum;
+		break;
+	case FBBENCH_BLIT :
+		for (i = 0; i < n; i++)
+			d[i] = s[i];
+		break;
+	case FBBENCH_FILL :
+		for (i = 0; i < n; i++)
+			d[i] = value;
+		break;
+	}
+}
+
+#ifdef FBBENCH_SIMD_NAME
+
+// 64 bytes per iteration; size must be a multiple of 64 and the buffers 16-byte aligned.
+
+static void run_simd(int test, void *framebuffer, const void *source, size_t size, uint32_t value) {
+	uint8_t *d = framebuffer;
+	const uint8_t *s = source;
+	size_t i;
+#if defined(__SSE2__)
+	__m128i v = _mm_set1_epi32(value), step = _mm_set1_epi32(4), sum = _mm_setzero_si128();
+	v = _mm_add_epi32(v, _mm_set_epi32(3, 2, 1, 0));
+	for (i = 0; i < size; i += 64) {
+		__m128i *p = (__m128i *)(d + i);
+		switch (test) {
+		case FBBENCH_WRITE :
+			_mm_store_si128(p, v);
+			v = _mm_add_epi32(v, step);
+			_mm_store_si128(p + 1, v);
+			v = _mm_add_epi32(v, step);
+			_mm_store_si128(p + 2, v);
+			v = _mm_add_epi32(v, step);
+			_mm_store_si128(p + 3, v);
+			v = _mm_add_epi32(v, step);
+			break;
+		case FBBENCH_READ :
+			sum = _mm_xor_si128(sum, _mm_xor_si128(_mm_xor_si128(_mm_load_si128(p), _mm_load_si128(p + 1)),
+				_mm_xor_si128(_mm_load_si128(p + 2), _mm_load_si128(p + 3))));
+			break;
+		case FBBENCH_BLIT : {
+			const __m128i *q = (const __m128i *)(s + i);
+			__m128i a = _mm_load_si128(q), b = _mm_load_si128(q + 1);
+			__m128i c = _mm_load_si128(q + 2), e = _mm_load_si128(q + 3);
+			_mm_store_si128(p, a);
+			_mm_store_si128(p + 1, b);
+			_mm_store_si128(p + 2, c);
+			_mm_store_si128(p + 3, e);
+			break;
+			}
+		case FBBENCH_FILL :
+			_mm_store_si128(p, v);
+			_mm_store_si128(p + 1, v);
+			_mm_store_si128(p + 2, v);
+			_mm_store_si128(p + 3, v);
+			break;
+		}
+	}
+	fbbench_sink = _mm_cvtsi128_si32(sum);
+#else
+	uint32x4_t v = vdupq_n_u32(value), step = vdupq_n_u32(4), sum = vdupq_n_u32(0);
+	static const uint32_t offsets[4] = { 0, 1, 2, 3 };
+	v = vaddq_u32(v, vld1q_u32(offsets));
+	for (i = 0; i < size; i += 64) {
+		uint32_t *p = (uint32_t *)(d + i);
+		switch (test) {
+		case FBBENCH_WRITE :
+			vst1q_u32(p, v);
+			v = vaddq_u32(v, step);
+			vst1q_u32(p + 4, v);
+			v = vaddq_u32(v, step);
+			vst1q_u32(p + 8, v);
+			v = vaddq_u32(v, step);
+			vst1q_u32(p + 12, v);
+			v = vaddq_u32(v, step);
+			break;
+		case FBBENCH_READ :
+			sum = veorq_u32(sum, veorq_u32(veorq_u32(vld1q_u32(p), vld1q_u32(p + 4)),
+				veorq_u32(vld1q_u32(p + 8), vld1q_u32(p + 12))));
+			break;
+		case FBBENCH_BLIT : {
+			const uint32_t *q = (const uint32_t *)(s + i);
+			uint32x4_t a = vld1q_u32(q), b = vld1q_u32(q + 4), c = vld1q_u32(q + 8), e = vld1q_u32(q + 12);
+			vst1q_u32(p, a);
+			vst1q_u32(p + 4, b);
+			vst1q_u32(p + 8, c);
+			vst1q_u32(p + 12, e);
+			break;
+			}
+		case FBBENCH_FILL :
+			vst1q_u32(p, v);
+			vst1q_u32(p + 4, v);
+			vst1q_u32(p + 8, v);
+			vst1q_u32(p + 12, v);
+			break;
+		}
+	}
+	fbbench_sink = vgetq_lane_u32(sum, 0);
+#endif
+}
+
+#endif
+
+void fbbench_run(void *framebuffer, size_t frame_size, int frames) {
+	void *source;
+	int nu_kernels = 1;
+	int test, kernel, i;
+	// Round down to whole 64-byte blocks for the SIMD code.
+	frame_size &= ~(size_t)63;
+#ifdef FBBENCH_SIMD_NAME
+	nu_kernels = 2;
+#endif
+	if (posix_memalign(&source, 64, frame_size) != 0) {
+		fprintf(stderr, "Out of memory.\n");
+		return;
+	}
+	memset(source, 0x55, frame_size);
+	// Touch the framebuffer first so that the page faults of a fresh mapping aren't timed.
+	memset(framebuffer, 0, frame_size);
+	printf("%-8s %-8s %10s %10s\n", "test", "kernel", "MB/s", "frames/s");
+	for (test = 0; test < FBBENCH_NU_TESTS; test++)
+		for (kernel = 0; kernel < nu_kernels; kernel++) {
+			double start_time, t;
+			start_time = fbbench_time_ms();
+			for (i = 0; i < frames; i++) {
+#ifdef FBBENCH_SIMD_NAME
+				if (kernel == 1)
+					run_simd(test, framebuffer, source, frame_size, i * 0x01010101);
+				else
+#endif
+					run_scalar(test, framebuffer, source, frame_size, i * 0x01010101);
+			}
+			t = (fbbench_time_ms() - start_time) / 1000;
+			printf("%-8s %-8s %10.1f %10.1f\n", fbbench_test_str[test],
+#ifdef FBBENCH_SIMD_NAME
+				kernel == 1 ? FBBENCH_SIMD_NAME :
+#endif
+				"scalar", (double)frame_size * frames / t / 1000000, frames / t);
+		}
+	free(source);
+}
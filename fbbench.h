@@ -0,0 +1,20 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  Framebuffer memory throughput benchmark, used by the fbbench command.
+*/
+
+#ifndef A10DISP_FBBENCH_H
+#define A10DISP_FBBENCH_H
+
+#include <stddef.h>
+
+// Pin the calling thread to the given CPU. Returns -1 on failure.
+int fbbench_pin_cpu(int cpu);
+
+// Measure sequential write, read, blit (copy from system memory) and fill throughput on a
+// framebuffer of frame_size bytes, with the scalar code and the SIMD code if available. Each
+// test is repeated for the given number of frames. The results are printed.
+void fbbench_run(void *framebuffer, size_t frame_size, int frames);
+
+#endif
@@ -0,0 +1,324 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  Conversion of framebuffer contents between ARGB8888, RGB888 and RGB565.
+
+  In memory (little endian), ARGB8888 is B, G, R, A, RGB888 is B, G, R and RGB565
+  is a 16-bit word with red in the top five bits. Conversions to a smaller format
+  are done from the start of a row to the end, conversions to a larger format
+  from the end to the start, so that a row can be converted in place. The SIMD
+  kernels load a block before storing the result, which keeps this property.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define FBCONVERT_SSE2
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FBCONVERT_NEON
+#endif
+
+#include "fbconvert.h"
+
+// 4x4 ordered dither matrix. For a 5-bit channel the threshold is added as value / 2 (0 to 7,
+// half of the quantization step of 8), for the 6-bit green channel as value / 4 (0 to 3).
+static const uint8_t bayer[4][4] = {
+	{ 0, 8, 2, 10 },
+	{ 12, 4, 14, 6 },
+	{ 3, 11, 1, 9 },
+	{ 15, 7, 13, 5 }
+};
+
+const char *fbconvert_simd_name(void) {
+#if defined(FBCONVERT_SSE2)
+	return "SSE2";
+#elif defined(FBCONVERT_NEON)
+	return "NEON";
+#else
+	return NULL;
+#endif
+}
+
+static inline uint32_t read_pixel(const uint8_t *p, int bytes_per_pixel) {
+	uint32_t v;
+	if (bytes_per_pixel == 4)
+		return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	if (bytes_per_pixel == 3)
+		return p[0] | (p[1] << 8) | (p[2] << 16) | 0xFF000000;
+	v = p[0] | (p[1] << 8);
+	return 0xFF000000 | ((v & 0xF800) << 8) | ((v & 0xE000) << 3) | ((v & 0x07E0) << 5) |
+		((v & 0x0600) >> 1) | ((v & 0x1F) << 3) | ((v & 0x1C) >> 2);
+}
+
+static inline void write_pixel(uint8_t *p, uint32_t v, int bytes_per_pixel) {
+	p[0] = v;
+	p[1] = v >> 8;
+	if (bytes_per_pixel >= 3)
+		p[2] = v >> 16;
+	if (bytes_per_pixel == 4)
+		p[3] = v >> 24;
+}
+
+static inline uint32_t dither_pixel(uint32_t v, int x, int y) {
+	int d = bayer[y & 3][x & 3];
+	int r = ((v >> 16) & 0xFF) + (d >> 1);
+	int g = ((v >> 8) & 0xFF) + (d >> 2);
+	int b = (v & 0xFF) + (d >> 1);
+	return (v & 0xFF000000) | ((r > 255 ? 255 : r) << 16) | ((g > 255 ? 255 : g) << 8) |
+		(b > 255 ? 255 : b);
+}
+
+static inline uint16_t pixel_to_rgb565(uint32_t v) {
+	return ((v >> 8) & 0xF800) | ((v >> 5) & 0x07E0) | ((v >> 3) & 0x001F);
+}
+
+// Convert pixels [start, end) of a row with the scalar code.
+
+static void convert_scalar(uint8_t *dst, const uint8_t *src, int start, int end, int y,
+int src_bpp, int dst_bpp, int dither) {
+	int x;
+	if (dst_bpp <= src_bpp) {
+		for (x = start; x < end; x++) {
+			uint32_t v = read_pixel(src + x * src_bpp, src_bpp);
+			if (dst_bpp == 2) {
+				uint16_t w;
+				if (dither)
+					v = dither_pixel(v, x, y);
+				w = pixel_to_rgb565(v);
+				dst[x * 2] = w;
+				dst[x * 2 + 1] = w >> 8;
+			}
+			else
+				write_pixel(dst + x * dst_bpp, v, dst_bpp);
+		}
+	}
+	else
+		for (x = end - 1; x >= start; x--)
+			write_pixel(dst + x * dst_bpp, read_pixel(src + x * src_bpp, src_bpp), dst_bpp);
+}
+
+#if defined(FBCONVERT_SSE2)
+
+// ARGB8888 to RGB565, eight pixels at a time. Returns the number of pixels converted.
+
+static int argb8888_to_rgb565_simd(uint8_t *dst, const uint8_t *src, int width, int y, int dither) {
+	const __m128i mask_r = _mm_set1_epi32(0xF800);
+	const __m128i mask_g = _mm_set1_epi32(0x07E0);
+	const __m128i mask_b = _mm_set1_epi32(0x001F);
+	__m128i dither_offset = _mm_setzero_si128();
+	int x;
+	if (dither) {
+		uint8_t d[16];
+		for (x = 0; x < 4; x++) {
+			d[x * 4] = bayer[y & 3][x] >> 1;
+			d[x * 4 + 1] = bayer[y & 3][x] >> 2;
+			d[x * 4 + 2] = bayer[y & 3][x] >> 1;
+			d[x * 4 + 3] = 0;
+		}
+		dither_offset = _mm_loadu_si128((const __m128i *)d);
+	}
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m128i p0 = _mm_loadu_si128((const __m128i *)(src + x * 4));
+		__m128i p1 = _mm_loadu_si128((const __m128i *)(src + x * 4 + 16));
+		__m128i v0, v1;
+		p0 = _mm_adds_epu8(p0, dither_offset);
+		p1 = _mm_adds_epu8(p1, dither_offset);
+		v0 = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(p0, 8), mask_r),
+			_mm_and_si128(_mm_srli_epi32(p0, 5), mask_g)), _mm_and_si128(_mm_srli_epi32(p0, 3), mask_b));
+		v1 = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(p1, 8), mask_r),
+			_mm_and_si128(_mm_srli_epi32(p1, 5), mask_g)), _mm_and_si128(_mm_srli_epi32(p1, 3), mask_b));
+		// Sign-extend so that the signed saturating pack keeps all 16 bits.
+		v0 = _mm_srai_epi32(_mm_slli_epi32(v0, 16), 16);
+		v1 = _mm_srai_epi32(_mm_slli_epi32(v1, 16), 16);
+		_mm_storeu_si128((__m128i *)(dst + x * 2), _mm_packs_epi32(v0, v1));
+	}
+	return x;
+}
+
+// RGB565 to ARGB8888. The pixels after the last full block are converted first, then blocks
+// of eight pixels from the end of the row to the start.
+
+static void rgb565_to_argb8888_simd(uint8_t *dst, const uint8_t *src, int width) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alpha = _mm_set1_epi32(0xFF000000);
+	int x = width & ~7;
+	convert_scalar(dst, src, x, width, 0, 2, 4, 0);
+	while (x > 0) {
+		__m128i p, v[2];
+		int i;
+		x -= 8;
+		p = _mm_loadu_si128((const __m128i *)(src + x * 2));
+		v[0] = _mm_unpacklo_epi16(p, zero);
+		v[1] = _mm_unpackhi_epi16(p, zero);
+		for (i = 0; i < 2; i++) {
+			__m128i q = v[i];
+			__m128i r = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(q, _mm_set1_epi32(0xF800)), 8),
+				_mm_slli_epi32(_mm_and_si128(q, _mm_set1_epi32(0xE000)), 3));
+			__m128i g = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(q, _mm_set1_epi32(0x07E0)), 5),
+				_mm_srli_epi32(_mm_and_si128(q, _mm_set1_epi32(0x0600)), 1));
+			__m128i b = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(q, _mm_set1_epi32(0x1F)), 3),
+				_mm_srli_epi32(_mm_and_si128(q, _mm_set1_epi32(0x1C)), 2));
+			v[i] = _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, alpha));
+		}
+		_mm_storeu_si128((__m128i *)(dst + x * 4 + 16), v[1]);
+		_mm_storeu_si128((__m128i *)(dst + x * 4), v[0]);
+	}
+}
+
+#define HAVE_SIMD_8888_565
+
+#elif defined(FBCONVERT_NEON)
+
+static int argb8888_to_rgb565_simd(uint8_t *dst, const uint8_t *src, int width, int y, int dither) {
+	uint8x16_t dither5 = vdupq_n_u8(0), dither6 = vdupq_n_u8(0);
+	int x;
+	if (dither) {
+		uint8_t d5[16], d6[16];
+		for (x = 0; x < 16; x++) {
+			d5[x] = bayer[y & 3][x & 3] >> 1;
+			d6[x] = bayer[y & 3][x & 3] >> 2;
+		}
+		dither5 = vld1q_u8(d5);
+		dither6 = vld1q_u8(d6);
+	}
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x16x4_t p = vld4q_u8(src + x * 4);
+		uint8x16_t b = vqaddq_u8(p.val[0], dither5);
+		uint8x16_t g = vqaddq_u8(p.val[1], dither6);
+		uint8x16_t r = vqaddq_u8(p.val[2], dither5);
+		uint16x8_t lo, hi;
+		lo = vsriq_n_u16(vshll_n_u8(vget_low_u8(r), 8), vshll_n_u8(vget_low_u8(g), 8), 5);
+		lo = vsriq_n_u16(lo, vshll_n_u8(vget_low_u8(b), 8), 11);
+		hi = vsriq_n_u16(vshll_n_u8(vget_high_u8(r), 8), vshll_n_u8(vget_high_u8(g), 8), 5);
+		hi = vsriq_n_u16(hi, vshll_n_u8(vget_high_u8(b), 8), 11);
+		vst1q_u16((uint16_t *)(dst + x * 2), lo);
+		vst1q_u16((uint16_t *)(dst + x * 2 + 16), hi);
+	}
+	return x;
+}
+
+static void rgb565_to_argb8888_simd(uint8_t *dst, const uint8_t *src, int width) {
+	int x = width & ~7;
+	convert_scalar(dst, src, x, width, 0, 2, 4, 0);
+	while (x > 0) {
+		uint16x8_t p;
+		uint8x8x4_t v;
+		uint8x8_t r, g, b;
+		x -= 8;
+		p = vld1q_u16((const uint16_t *)(src + x * 2));
+		r = vand_u8(vshrn_n_u16(p, 8), vdup_n_u8(0xF8));
+		g = vand_u8(vshrn_n_u16(p, 3), vdup_n_u8(0xFC));
+		b = vmovn_u16(vshlq_n_u16(p, 3));
+		v.val[0] = vorr_u8(b, vshr_n_u8(b, 5));
+		v.val[1] = vorr_u8(g, vshr_n_u8(g, 6));
+		v.val[2] = vorr_u8(r, vshr_n_u8(r, 5));
+		v.val[3] = vdup_n_u8(0xFF);
+		vst4_u8(dst + x * 4, v);
+	}
+}
+
+// ARGB8888 to RGB888, sixteen pixels at a time.
+
+static int argb8888_to_rgb888_simd(uint8_t *dst, const uint8_t *src, int width) {
+	int x;
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x16x4_t p = vld4q_u8(src + x * 4);
+		uint8x16x3_t v;
+		v.val[0] = p.val[0];
+		v.val[1] = p.val[1];
+		v.val[2] = p.val[2];
+		vst3q_u8(dst + x * 3, v);
+	}
+	return x;
+}
+
+// RGB888 to ARGB8888, sixteen pixels at a time from the end of the row.
+
+static void rgb888_to_argb8888_simd(uint8_t *dst, const uint8_t *src, int width) {
+	int x = width & ~15;
+	convert_scalar(dst, src, x, width, 0, 3, 4, 0);
+	while (x > 0) {
+		uint8x16x3_t p;
+		uint8x16x4_t v;
+		x -= 16;
+		p = vld3q_u8(src + x * 3);
+		v.val[0] = p.val[0];
+		v.val[1] = p.val[1];
+		v.val[2] = p.val[2];
+		v.val[3] = vdupq_n_u8(0xFF);
+		vst4q_u8(dst + x * 4, v);
+	}
+}
+
+#define HAVE_SIMD_8888_565
+#define HAVE_SIMD_8888_888
+
+#endif
+
+int fbconvert_has_simd(int src_bytes_per_pixel, int dst_bytes_per_pixel) {
+#ifdef HAVE_SIMD_8888_565
+	if ((src_bytes_per_pixel == 4 && dst_bytes_per_pixel == 2) ||
+	(src_bytes_per_pixel == 2 && dst_bytes_per_pixel == 4))
+		return 1;
+#endif
+#ifdef HAVE_SIMD_8888_888
+	if ((src_bytes_per_pixel == 4 && dst_bytes_per_pixel == 3) ||
+	(src_bytes_per_pixel == 3 && dst_bytes_per_pixel == 4))
+		return 1;
+#endif
+	return 0;
+}
+
+void fbconvert_row(void *dst, const void *src, int width, int y, int src_bytes_per_pixel,
+int dst_bytes_per_pixel, int dither, int use_simd) {
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	if (src_bytes_per_pixel == dst_bytes_per_pixel) {
+		if (dst != src)
+			memmove(dst, src, width * dst_bytes_per_pixel);
+		return;
+	}
+	if (use_simd) {
+#ifdef HAVE_SIMD_8888_565
+		if (src_bytes_per_pixel == 4 && dst_bytes_per_pixel == 2) {
+			int x = argb8888_to_rgb565_simd(d, s, width, y, dither);
+			convert_scalar(d, s, x, width, y, 4, 2, dither);
+			return;
+		}
+		if (src_bytes_per_pixel == 2 && dst_bytes_per_pixel == 4) {
+			rgb565_to_argb8888_simd(d, s, width);
+			return;
+		}
+#endif
+#ifdef HAVE_SIMD_8888_888
+		if (src_bytes_per_pixel == 4 && dst_bytes_per_pixel == 3) {
+			int x = argb8888_to_rgb888_simd(d, s, width);
+			convert_scalar(d, s, x, width, y, 4, 3, 0);
+			return;
+		}
+		if (src_bytes_per_pixel == 3 && dst_bytes_per_pixel == 4) {
+			rgb888_to_argb8888_simd(d, s, width);
+			return;
+		}
+#endif
+	}
+	convert_scalar(d, s, 0, width, y, src_bytes_per_pixel, dst_bytes_per_pixel, dither);
+}
+
+void fbconvert_frame(void *buffer, int width, int height, int src_bytes_per_pixel,
+int dst_bytes_per_pixel, int dither, int use_simd) {
+	uint8_t *b = buffer;
+	int y;
+	if (dst_bytes_per_pixel < src_bytes_per_pixel)
+		for (y = 0; y < height; y++)
+			fbconvert_row(b + y * width * dst_bytes_per_pixel, b + y * width * src_bytes_per_pixel,
+				width, y, src_bytes_per_pixel, dst_bytes_per_pixel, dither, use_simd);
+	else
+	if (dst_bytes_per_pixel > src_bytes_per_pixel)
+		for (y = height - 1; y >= 0; y--)
+			fbconvert_row(b + y * width * dst_bytes_per_pixel, b + y * width * src_bytes_per_pixel,
+				width, y, src_bytes_per_pixel, dst_bytes_per_pixel, dither, use_simd);
+}
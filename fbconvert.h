@@ -0,0 +1,30 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  Conversion of framebuffer contents between the pixel formats used for the
+  console framebuffer: ARGB8888 (4 bytes per pixel), RGB888 (3) and RGB565 (2),
+  with scalar kernels and SIMD (SSE2 or NEON) kernels where available.
+*/
+
+#ifndef A10DISP_FBCONVERT_H
+#define A10DISP_FBCONVERT_H
+
+// Name of the SIMD instruction set used by the SIMD kernels, or NULL if there are none and
+// the scalar kernels are always used.
+const char *fbconvert_simd_name(void);
+
+// Returns 1 if there is a SIMD kernel for the given conversion, 0 if the scalar code is used.
+int fbconvert_has_simd(int src_bytes_per_pixel, int dst_bytes_per_pixel);
+
+// Convert one row of width pixels from src_bytes_per_pixel to dst_bytes_per_pixel. The rows may
+// overlap if they start at the same address (in-place conversion). y is the row number, used for
+// ordered dithering when converting to RGB565 with dither set.
+void fbconvert_row(void *dst, const void *src, int width, int y, int src_bytes_per_pixel,
+	int dst_bytes_per_pixel, int dither, int use_simd);
+
+// Convert a framebuffer of width x height pixels in place, where rows directly follow each other
+// both before and after the conversion. The buffer must be large enough for the larger format.
+void fbconvert_frame(void *buffer, int width, int height, int src_bytes_per_pixel,
+	int dst_bytes_per_pixel, int dither, int use_simd);
+
+#endif
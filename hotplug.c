@@ -0,0 +1,167 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  HDMI hot plug event sources for the monitor command.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "hotplug.h"
+
+#define DEFAULT_SYSFS_HDMI_STATE_FILE "/sys/class/switch/hdmi/state"
+
+// Kernel uevents. The sunxi HDMI driver reports hot plug through the "hdmi" switch device,
+// with SWITCH_NAME=hdmi and SWITCH_STATE=0|1 in the uevent.
+
+static int netlink_fd = -1;
+
+static int netlink_open(const char *arg) {
+	struct sockaddr_nl addr;
+	netlink_fd = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+	if (netlink_fd < 0) {
+		fprintf(stderr, "Error: cannot open uevent netlink socket: %s\n", strerror(errno));
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_pid = 0;
+	addr.nl_groups = 1;
+	if (bind(netlink_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "Error: cannot bind uevent netlink socket: %s\n", strerror(errno));
+		close(netlink_fd);
+		netlink_fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static int netlink_wait(void) {
+	char buffer[8192];
+	int n, i;
+	for (;;) {
+		int is_hdmi = 0;
+		int state = HOTPLUG_UNKNOWN;
+		n = recv(netlink_fd, buffer, sizeof(buffer) - 1, 0);
+		if (n <= 0)
+			return HOTPLUG_END;
+		buffer[n] = '\0';
+		// The message is "action@devpath" followed by KEY=VALUE strings, all zero-terminated.
+		for (i = 0; i < n; i += strlen(buffer + i) + 1) {
+			const char *s = buffer + i;
+			if (strcmp(s, "SWITCH_NAME=hdmi") == 0 || (i == 0 && strstr(s, "/switch/hdmi") != NULL))
+				is_hdmi = 1;
+			else
+			if (strncmp(s, "SWITCH_STATE=", 13) == 0)
+				state = atoi(s + 13) != 0 ? HOTPLUG_CONNECTED : HOTPLUG_DISCONNECTED;
+		}
+		if (is_hdmi)
+			return state;
+	}
+}
+
+static void netlink_close(void) {
+	if (netlink_fd >= 0)
+		close(netlink_fd);
+	netlink_fd = -1;
+}
+
+struct hotplug_source netlink_hotplug_source = {
+	"netlink", netlink_open, netlink_wait, netlink_close
+};
+
+// sysfs attribute. The driver calls sysfs_notify() when the state changes, which wakes up
+// poll() with POLLPRI; the attribute has to be read from the start again after that.
+
+static int sysfs_fd = -1;
+
+static int sysfs_read_state(void) {
+	char buffer[16];
+	int n;
+	lseek(sysfs_fd, 0, SEEK_SET);
+	n = read(sysfs_fd, buffer, sizeof(buffer) - 1);
+	if (n <= 0)
+		return HOTPLUG_UNKNOWN;
+	buffer[n] = '\0';
+	return atoi(buffer) != 0 ? HOTPLUG_CONNECTED : HOTPLUG_DISCONNECTED;
+}
+
+static int sysfs_open(const char *arg) {
+	const char *file = arg != NULL ? arg : DEFAULT_SYSFS_HDMI_STATE_FILE;
+	sysfs_fd = open(file, O_RDONLY);
+	if (sysfs_fd < 0) {
+		fprintf(stderr, "Error: cannot open %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+	// Read once, otherwise poll() returns immediately.
+	sysfs_read_state();
+	return 0;
+}
+
+static int sysfs_wait(void) {
+	struct pollfd pfd;
+	pfd.fd = sysfs_fd;
+	pfd.events = POLLPRI | POLLERR;
+	if (poll(&pfd, 1, -1) < 0)
+		return HOTPLUG_END;
+	return sysfs_read_state();
+}
+
+static void sysfs_close(void) {
+	if (sysfs_fd >= 0)
+		close(sysfs_fd);
+	sysfs_fd = -1;
+}
+
+struct hotplug_source sysfs_hotplug_source = {
+	"sysfs", sysfs_open, sysfs_wait, sysfs_close
+};
+
+// Events read from a file, FIFO or standard input ("-" or no argument).
+
+static FILE *feeder_file;
+
+static int feeder_open(const char *arg) {
+	if (arg == NULL || strcmp(arg, "-") == 0) {
+		feeder_file = stdin;
+		return 0;
+	}
+	feeder_file = fopen(arg, "r");
+	if (feeder_file == NULL) {
+		fprintf(stderr, "Error: cannot open %s: %s\n", arg, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int feeder_wait(void) {
+	char line[64];
+	while (fgets(line, sizeof(line), feeder_file) != NULL) {
+		line[strcspn(line, " \t\r\n")] = '\0';
+		if (strcasecmp(line, "connect") == 0 || strcmp(line, "1") == 0)
+			return HOTPLUG_CONNECTED;
+		if (strcasecmp(line, "disconnect") == 0 || strcmp(line, "0") == 0)
+			return HOTPLUG_DISCONNECTED;
+		if (strcasecmp(line, "change") == 0)
+			return HOTPLUG_UNKNOWN;
+	}
+	return HOTPLUG_END;
+}
+
+static void feeder_close(void) {
+	if (feeder_file != NULL && feeder_file != stdin)
+		fclose(feeder_file);
+	feeder_file = NULL;
+}
+
+struct hotplug_source feeder_hotplug_source = {
+	"feeder", feeder_open, feeder_wait, feeder_close
+};
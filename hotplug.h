@@ -0,0 +1,37 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  HDMI hot plug event sources for the monitor command. A source blocks until
+  the HDMI connection state may have changed, so that the monitor doesn't
+  have to poll the display driver.
+*/
+
+#ifndef A10DISP_HOTPLUG_H
+#define A10DISP_HOTPLUG_H
+
+#define HOTPLUG_END				-1
+#define HOTPLUG_DISCONNECTED	0
+#define HOTPLUG_CONNECTED		1
+// The state may have changed, but the event doesn't say how; ask the display driver.
+#define HOTPLUG_UNKNOWN			2
+
+struct hotplug_source {
+	const char *name;
+	// Open the source. arg is the part of the source specification after the colon, or NULL.
+	// Returns -1 on failure, after printing an error.
+	int (*open)(const char *arg);
+	// Wait for the next event and return one of the HOTPLUG_* values. HOTPLUG_END is returned
+	// when the source ends, fails or the wait is interrupted by a signal.
+	int (*wait)(void);
+	void (*close)(void);
+};
+
+// Kernel uevents received on a NETLINK_KOBJECT_UEVENT socket.
+extern struct hotplug_source netlink_hotplug_source;
+// poll() on the state attribute of the switch class device of HDMI in sysfs.
+extern struct hotplug_source sysfs_hotplug_source;
+// Lines with "connect"/"disconnect" (or 1/0) read from a file, FIFO or standard input, for
+// driving the monitor by hand or from a test script.
+extern struct hotplug_source feeder_hotplug_source;
+
+#endif
@@ -0,0 +1,122 @@
+/*
+  liba10disp -- library to change the display mode of Allwinner A10 devices.
+
+  The mode switching of a10disp as a library, so that applications (video
+  players, kiosk shells) can change the display mode in-process instead of
+  running the a10disp program. Functions return A10DISP_OK or a negative
+  A10DISP_ERROR_* code and never exit the process. Progress and error
+  messages are printed to standard output and standard error, like the
+  a10disp program does.
+
+  The library keeps the state of the display driver in global variables, so
+  only one context can be open at a time and the functions must not be called
+  from more than one thread at the same time.
+*/
+
+#ifndef LIBA10DISP_H
+#define LIBA10DISP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Only the functions declared here are exported from the shared library; everything else is
+// built with hidden visibility.
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define A10DISP_API __attribute__((visibility("default")))
+#else
+#define A10DISP_API
+#endif
+
+#define A10DISP_OK					0
+// The operation failed; the reason has been printed.
+#define A10DISP_ERROR				- 1
+#define A10DISP_ERROR_INVALID		- 2
+// The display driver could not be opened, or is too old.
+#define A10DISP_ERROR_OPEN			- 3
+#define A10DISP_ERROR_BUSY			- 4
+#define A10DISP_ERROR_DRIVER		- 5
+// The display reports that the HDMI mode is not supported.
+#define A10DISP_ERROR_UNSUPPORTED	- 6
+// The framebuffer memory reserved at boot is too small for the requested mode.
+#define A10DISP_ERROR_FRAMEBUFFER	- 7
+
+// Output types, the same values as the display driver's __disp_output_type_t.
+#define A10DISP_OUTPUT_NONE			0
+#define A10DISP_OUTPUT_LCD			1
+#define A10DISP_OUTPUT_TV			2
+#define A10DISP_OUTPUT_HDMI			4
+#define A10DISP_OUTPUT_VGA			8
+
+typedef struct a10disp_context a10disp_context;
+
+struct a10disp_screen_info {
+	int output;
+	// The HDMI mode number, or -1 if the output is not HDMI.
+	int mode;
+	// Display dimensions (zero when the output is off).
+	int width, height;
+	// Console framebuffer.
+	int fb_width, fb_height;
+	int bits_per_pixel;
+	// Whether the framebuffer layer is in scaler mode, and its source and screen windows.
+	int scaler;
+	int src_width, src_height;
+	int scn_width, scn_height;
+};
+
+// Target state of a screen for a10disp_apply, the equivalent of the settings of the apply
+// command. Initialize it with a10disp_target_init, which sets every setting to "unchanged"
+// (-1 for output, mode and scaler, 0 for the pixel depth and window sizes).
+struct a10disp_target {
+	int output;
+	int mode;
+	int bits_per_pixel;
+	int src_width, src_height;
+	int scn_width, scn_height;
+	int scaler;
+};
+
+// Open the display driver, or a simulated display driver when sim_spec is not NULL (see the
+// --sim option). Returns NULL on failure and sets *error if error is not NULL.
+A10DISP_API a10disp_context *a10disp_open(const char *sim_spec, int *error);
+
+A10DISP_API void a10disp_close(a10disp_context *ctx);
+
+// Set the number of buffers that must fit into the framebuffer memory when changing the
+// console framebuffer (default 2, as with the a10disp program).
+A10DISP_API int a10disp_set_buffers(a10disp_context *ctx, int nu_buffers);
+
+A10DISP_API int a10disp_get_screen_info(a10disp_context *ctx, int screen, struct a10disp_screen_info *info);
+
+// Returns 1 if the display connected to the screen supports the HDMI mode, 0 if it doesn't, or
+// an error code.
+A10DISP_API int a10disp_hdmi_mode_supported(a10disp_context *ctx, int screen, int mode);
+
+A10DISP_API void a10disp_target_init(struct a10disp_target *target);
+
+// Bring screens 0 and 1 into the target state (NULL leaves a screen unchanged), with a single
+// display off/on cycle and only the steps that change something.
+A10DISP_API int a10disp_apply(a10disp_context *ctx, const struct a10disp_target *target0,
+	const struct a10disp_target *target1);
+
+// Like a10disp_apply, with settings given as in the apply command ("output=hdmi mode=10
+// depth=32 1:output=off"), separated by spaces or commas. Settings without a screen prefix
+// apply to screen 0.
+A10DISP_API int a10disp_apply_settings(a10disp_context *ctx, const char *settings);
+
+// Returns the name of a mode number (for example "1080p 60 Hz") and its dimensions and refresh
+// rate, or NULL if the mode number is not valid.
+A10DISP_API const char *a10disp_mode_info(int mode, int *width, int *height, int *refresh);
+
+A10DISP_API const char *a10disp_strerror(int error);
+
+// Run the a10disp program with the given command line. Returns the exit code. This may exit the
+// process; applications should use the functions above.
+A10DISP_API int a10disp_run(int argc, char *argv[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,25 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  The a10disp program. The commands are implemented in liba10disp.
+*/
+
+#include <string.h>
+
+#include "liba10disp.h"
+
+int main(int argc, char *argv[]) {
+	char *daemon_argv[argc + 2];
+	const char *name;
+	// When run as a10dispd, start the daemon.
+	name = strrchr(argv[0], '/');
+	name = name == NULL ? argv[0] : name + 1;
+	if (strcmp(name, "a10dispd") == 0) {
+		memcpy(daemon_argv, argv, argc * sizeof(char *));
+		daemon_argv[argc] = "daemon";
+		daemon_argv[argc + 1] = NULL;
+		argv = daemon_argv;
+		argc++;
+	}
+	return a10disp_run(argc, argv);
+}
@@ -0,0 +1,155 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  STREAM-style system memory bandwidth benchmark. Every thread runs the kernels
+  on its own arrays; the threads start each kernel together and the time until
+  the last one finishes gives the aggregate bandwidth. Like STREAM, a kernel
+  is counted as moving the bytes it reads and writes (two arrays for copy and
+  scale, three for add and triad). The scanout of the display controller
+  competes with the kernels for DRAM bandwidth.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "membench.h"
+
+const char *membench_kernel_name[MEMBENCH_NU_KERNELS] = { "copy", "scale", "add", "triad" };
+
+static const int membench_kernel_arrays[MEMBENCH_NU_KERNELS] = { 2, 2, 3, 3 };
+
+struct membench_thread {
+	pthread_t thread;
+	double *a, *b, *c;
+	// Start and end time of the last trial.
+	double start_time, end_time;
+};
+
+static size_t membench_elements;
+static int membench_trials;
+static int membench_failed;
+static pthread_barrier_t membench_barrier;
+// The threads wait until all of them have been created and the barrier is set up for them.
+static pthread_mutex_t membench_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t membench_cond = PTHREAD_COND_INITIALIZER;
+static int membench_started;
+
+static double membench_time_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void run_kernel(int kernel, double *a, double *b, double *c, size_t n) {
+	const double scalar = 3.0;
+	size_t i;
+	switch (kernel) {
+	case MEMBENCH_COPY :
+		for (i = 0; i < n; i++)
+			c[i] = a[i];
+		break;
+	case MEMBENCH_SCALE :
+		for (i = 0; i < n; i++)
+			b[i] = scalar * c[i];
+		break;
+	case MEMBENCH_ADD :
+		for (i = 0; i < n; i++)
+			c[i] = a[i] + b[i];
+		break;
+	case MEMBENCH_TRIAD :
+		for (i = 0; i < n; i++)
+			a[i] = b[i] + scalar * c[i];
+		break;
+	}
+}
+
+static void *membench_thread_main(void *arg) {
+	struct membench_thread *t = arg;
+	size_t i;
+	int kernel, trial;
+	pthread_mutex_lock(&membench_mutex);
+	while (!membench_started)
+		pthread_cond_wait(&membench_cond, &membench_mutex);
+	pthread_mutex_unlock(&membench_mutex);
+	t->a = malloc(membench_elements * sizeof(double));
+	t->b = malloc(membench_elements * sizeof(double));
+	t->c = malloc(membench_elements * sizeof(double));
+	if (t->a == NULL || t->b == NULL || t->c == NULL)
+		membench_failed = 1;
+	else
+		// Touch the arrays so that page faults aren't timed.
+		for (i = 0; i < membench_elements; i++) {
+			t->a[i] = 1.0;
+			t->b[i] = 2.0;
+			t->c[i] = 0.0;
+		}
+	pthread_barrier_wait(&membench_barrier);
+	// The main thread checks for allocation failures in between.
+	pthread_barrier_wait(&membench_barrier);
+	if (!membench_failed)
+		for (kernel = 0; kernel < MEMBENCH_NU_KERNELS; kernel++)
+			for (trial = 0; trial < membench_trials; trial++) {
+				pthread_barrier_wait(&membench_barrier);
+				t->start_time = membench_time_ms();
+				run_kernel(kernel, t->a, t->b, t->c, membench_elements);
+				t->end_time = membench_time_ms();
+				pthread_barrier_wait(&membench_barrier);
+			}
+	free(t->a);
+	free(t->b);
+	free(t->c);
+	return NULL;
+}
+
+int membench_run(int nu_threads, size_t elements, int trials, double *bandwidth) {
+	struct membench_thread *threads;
+	int i, kernel, trial, nu_started;
+	threads = calloc(nu_threads, sizeof(struct membench_thread));
+	if (threads == NULL)
+		return - 1;
+	membench_elements = elements;
+	membench_trials = trials;
+	membench_started = 0;
+	pthread_mutex_lock(&membench_mutex);
+	for (nu_started = 0; nu_started < nu_threads; nu_started++)
+		if (pthread_create(&threads[nu_started].thread, NULL, membench_thread_main, &threads[nu_started]) != 0)
+			break;
+	membench_failed = nu_started < nu_threads;
+	pthread_barrier_init(&membench_barrier, NULL, nu_started + 1);
+	membench_started = 1;
+	pthread_cond_broadcast(&membench_cond);
+	pthread_mutex_unlock(&membench_mutex);
+	pthread_barrier_wait(&membench_barrier);
+	pthread_barrier_wait(&membench_barrier);
+	if (!membench_failed)
+		for (kernel = 0; kernel < MEMBENCH_NU_KERNELS; kernel++) {
+			double best = 1E30;
+			for (trial = 0; trial < trials; trial++) {
+				double start_time, end_time, t;
+				pthread_barrier_wait(&membench_barrier);
+				pthread_barrier_wait(&membench_barrier);
+				// From the first thread starting to the last one finishing.
+				start_time = threads[0].start_time;
+				end_time = threads[0].end_time;
+				for (i = 1; i < nu_threads; i++) {
+					if (threads[i].start_time < start_time)
+						start_time = threads[i].start_time;
+					if (threads[i].end_time > end_time)
+						end_time = threads[i].end_time;
+				}
+				t = end_time - start_time;
+				if (t < best)
+					best = t;
+			}
+			bandwidth[kernel] = (double)membench_kernel_arrays[kernel] * sizeof(double) * elements *
+				nu_threads / (best / 1000);
+		}
+	for (i = 0; i < nu_started; i++)
+		pthread_join(threads[i].thread, NULL);
+	pthread_barrier_destroy(&membench_barrier);
+	free(threads);
+	return membench_failed ? - 1 : 0;
+}
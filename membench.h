@@ -0,0 +1,26 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  STREAM-style system memory bandwidth benchmark, used by the membench command.
+*/
+
+#ifndef A10DISP_MEMBENCH_H
+#define A10DISP_MEMBENCH_H
+
+#include <stddef.h>
+
+#define MEMBENCH_COPY	0
+#define MEMBENCH_SCALE	1
+#define MEMBENCH_ADD	2
+#define MEMBENCH_TRIAD	3
+#define MEMBENCH_NU_KERNELS	4
+
+extern const char *membench_kernel_name[MEMBENCH_NU_KERNELS];
+
+// Run the copy, scale, add and triad kernels on nu_threads threads, each with its own arrays of
+// the given number of doubles, and store the best aggregate bandwidth of the given number of
+// trials in bytes per second for each kernel. Returns -1 if the arrays or threads can't be
+// allocated.
+int membench_run(int nu_threads, size_t elements, int trials, double *bandwidth);
+
+#endif
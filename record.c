@@ -0,0 +1,579 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  Recording and replaying of display driver sessions. The file starts with a
+  header (magic and version), followed by one entry per call: a fixed-size
+  little-endian header with the call type, the command, the screen, the first
+  two arguments, the result and the duration, followed by the data passed
+  through a pointer argument, if any. Pointer arguments themselves are not
+  meaningful in a recording and are stored as zero.
+
+  The replay backend serves the calls of a new run from a recording. Calls are
+  matched by type, command, screen and arguments, in order; a call that was
+  made in a different order is served from the first matching entry, and a
+  call that isn't in the recording fails with EIO. The original durations are
+  reproduced.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "record.h"
+#include "trace.h"
+
+#define RECORD_MAGIC 0x52303141
+#define RECORD_VERSION 1
+
+#define RECORD_OPEN			0
+#define RECORD_CLOSE		1
+#define RECORD_DISP_IOCTL	2
+#define RECORD_FB_IOCTL		3
+#define RECORD_FBSET		4
+#define RECORD_MMAP			5
+#define RECORD_MUNMAP		6
+
+struct record_file_header {
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct record_entry {
+	uint32_t type;
+	uint32_t cmd;
+	int32_t fb;
+	uint32_t args[2];
+	int32_t ret;
+	int32_t error;
+	uint32_t duration_us;
+	uint32_t payload_size;
+};
+
+struct replay_entry {
+	struct record_entry e;
+	const unsigned char *payload;
+	int used;
+};
+
+struct recording {
+	unsigned char *data;
+	struct replay_entry *entries;
+	int nu_entries;
+};
+
+static FILE *record_file;
+static struct disp_backend *record_inner;
+static struct disp_backend record_wrapper;
+
+static struct recording replay;
+static const char *replay_file_name;
+static int replay_cursor;
+static int replay_nu_served, replay_nu_out_of_order, replay_nu_missing;
+
+static double record_time_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Returns the size of the data passed to or returned by a call through a pointer argument, and
+// sets data to it.
+
+static uint32_t record_disp_payload(unsigned long cmd, unsigned long *args, void **data) {
+	*data = (void *)args[2];
+	if (cmd == DISP_CMD_LAYER_GET_PARA || cmd == DISP_CMD_LAYER_SET_PARA)
+		return sizeof(__disp_layer_info_t);
+	if (cmd == DISP_CMD_LAYER_GET_FB)
+		return sizeof(__disp_fb_t);
+	return 0;
+}
+
+static uint32_t record_fb_payload(unsigned long cmd, void *arg, void **data) {
+	*data = arg;
+	if (cmd == FBIOGET_VSCREENINFO || cmd == FBIOPUT_VSCREENINFO || cmd == FBIOPAN_DISPLAY)
+		return sizeof(struct fb_var_screeninfo);
+	if (cmd == FBIOGET_FSCREENINFO)
+		return sizeof(struct fb_fix_screeninfo);
+	if (cmd == FBIO_WAITFORVSYNC)
+		return sizeof(__u32);
+	// The layer handle is an unsigned long, stored as 32 bits so that recordings made on ARM
+	// can be replayed on 64-bit machines.
+	if (cmd == FBIOGET_LAYER_HDL_0 || cmd == FBIOGET_LAYER_HDL_1)
+		return sizeof(uint32_t);
+	return 0;
+}
+
+// Whether the data of a call is returned by the driver, so that replay has to copy it back.
+
+// Number of leading arguments of a call that are recorded and compared when replaying. Display
+// driver commands only use some of them; callers may leave the others uninitialized or set by an
+// earlier call.
+
+static int record_nu_args(uint32_t type, uint32_t cmd) {
+	if (type != RECORD_DISP_IOCTL)
+		return 2;
+	switch (cmd) {
+	case DISP_CMD_VERSION :
+		return 0;
+	case DISP_CMD_SCN_GET_WIDTH :
+	case DISP_CMD_SCN_GET_HEIGHT :
+	case DISP_CMD_GET_OUTPUT_TYPE :
+	case DISP_CMD_LCD_ON :
+	case DISP_CMD_LCD_OFF :
+	case DISP_CMD_TV_ON :
+	case DISP_CMD_TV_OFF :
+	case DISP_CMD_HDMI_ON :
+	case DISP_CMD_HDMI_OFF :
+	case DISP_CMD_HDMI_GET_MODE :
+	case DISP_CMD_HDMI_GET_HPD_STATUS :
+	case DISP_CMD_VGA_ON :
+	case DISP_CMD_VGA_OFF :
+		return 1;
+	default :
+		// Screen and layer handle or mode; args[2] is a pointer.
+		return 2;
+	}
+}
+
+static int record_payload_is_output(uint32_t type, uint32_t cmd) {
+	if (type == RECORD_DISP_IOCTL)
+		return cmd == DISP_CMD_LAYER_GET_PARA || cmd == DISP_CMD_LAYER_GET_FB;
+	if (type == RECORD_FB_IOCTL)
+		return cmd == FBIOGET_VSCREENINFO || cmd == FBIOGET_FSCREENINFO || cmd == FBIOGET_LAYER_HDL_0 ||
+			cmd == FBIOGET_LAYER_HDL_1;
+	return 0;
+}
+
+static void record_write(uint32_t type, uint32_t cmd, int fb, const unsigned long *args, int ret, int error,
+double start_time, const void *payload, uint32_t payload_size) {
+	struct record_entry e;
+	if (record_file == NULL)
+		return;
+	memset(&e, 0, sizeof(e));
+	e.type = type;
+	e.cmd = cmd;
+	e.fb = fb;
+	if (args != NULL) {
+		int nu_args = record_nu_args(type, cmd);
+		if (nu_args > 0)
+			e.args[0] = args[0];
+		if (nu_args > 1)
+			e.args[1] = args[1];
+	}
+	e.ret = ret;
+	e.error = ret < 0 ? error : 0;
+	e.duration_us = (record_time_ms() - start_time) * 1000 + 0.5;
+	e.payload_size = payload_size;
+	fwrite(&e, sizeof(e), 1, record_file);
+	if (payload_size > 0)
+		fwrite(payload, payload_size, 1, record_file);
+}
+
+static int record_open_backend(void) {
+	double start_time = record_time_ms();
+	int ret = record_inner->open();
+	record_write(RECORD_OPEN, 0, - 1, NULL, ret, errno, start_time, NULL, 0);
+	return ret;
+}
+
+static void record_close_backend(void) {
+	double start_time = record_time_ms();
+	record_inner->close();
+	record_write(RECORD_CLOSE, 0, - 1, NULL, 0, 0, start_time, NULL, 0);
+}
+
+static int record_disp_ioctl(unsigned int cmd, unsigned long *args) {
+	unsigned long saved_args[4];
+	double start_time;
+	uint32_t payload_size;
+	void *payload;
+	int ret, saved_errno;
+	memcpy(saved_args, args, sizeof(saved_args));
+	start_time = record_time_ms();
+	ret = record_inner->disp_ioctl(cmd, args);
+	saved_errno = errno;
+	payload_size = record_disp_payload(cmd, saved_args, &payload);
+	record_write(RECORD_DISP_IOCTL, cmd, - 1, saved_args, ret, saved_errno, start_time, payload, payload_size);
+	errno = saved_errno;
+	return ret;
+}
+
+static int record_fb_ioctl(int fb, unsigned long cmd, void *arg) {
+	double start_time = record_time_ms();
+	uint32_t payload_size, handle;
+	void *payload;
+	int ret = record_inner->fb_ioctl(fb, cmd, arg);
+	int saved_errno = errno;
+	payload_size = record_fb_payload(cmd, arg, &payload);
+	if (cmd == FBIOGET_LAYER_HDL_0 || cmd == FBIOGET_LAYER_HDL_1) {
+		handle = *(unsigned long *)arg;
+		payload = &handle;
+	}
+	record_write(RECORD_FB_IOCTL, cmd, fb, NULL, ret, saved_errno, start_time, payload, payload_size);
+	errno = saved_errno;
+	return ret;
+}
+
+static int record_fbset(int fb, const char *command, int width, int height, int bytes_per_pixel) {
+	double start_time = record_time_ms();
+	int ret = record_inner->fbset(fb, command, width, height, bytes_per_pixel);
+	record_write(RECORD_FBSET, 0, fb, NULL, ret, 0, start_time, command, strlen(command) + 1);
+	return ret;
+}
+
+static void record_reset(void) {
+	record_inner->reset();
+}
+
+static void *record_fb_mmap(int fb, size_t length) {
+	double start_time = record_time_ms();
+	unsigned long args[2] = { length, 0 };
+	void *address = record_inner->fb_mmap(fb, length);
+	int saved_errno = errno;
+	record_write(RECORD_MMAP, 0, fb, args, address == MAP_FAILED ? - 1 : 0, saved_errno, start_time, NULL, 0);
+	errno = saved_errno;
+	return address;
+}
+
+static void record_fb_munmap(int fb, void *address, size_t length) {
+	double start_time = record_time_ms();
+	unsigned long args[2] = { length, 0 };
+	record_inner->fb_munmap(fb, address, length);
+	record_write(RECORD_MUNMAP, 0, fb, args, 0, 0, start_time, NULL, 0);
+}
+
+int record_open(const char *file) {
+	struct record_file_header header = { RECORD_MAGIC, RECORD_VERSION };
+	record_file = fopen(file, "wb");
+	if (record_file == NULL) {
+		fprintf(stderr, "Error: could not create recording %s: %s\n", file, strerror(errno));
+		return - 1;
+	}
+	fwrite(&header, sizeof(header), 1, record_file);
+	return 0;
+}
+
+struct disp_backend *record_backend(struct disp_backend *backend) {
+	record_inner = backend;
+	record_wrapper.name = backend->name;
+	record_wrapper.open = record_open_backend;
+	record_wrapper.close = record_close_backend;
+	record_wrapper.disp_ioctl = record_disp_ioctl;
+	record_wrapper.fb_ioctl = record_fb_ioctl;
+	record_wrapper.fbset = record_fbset;
+	record_wrapper.reset = backend->reset != NULL ? record_reset : NULL;
+	record_wrapper.fb_mmap = record_fb_mmap;
+	record_wrapper.fb_munmap = record_fb_munmap;
+	return &record_wrapper;
+}
+
+void record_close(void) {
+	if (record_file == NULL)
+		return;
+	fclose(record_file);
+	record_file = NULL;
+}
+
+// Load a recording into memory. Returns -1 on failure.
+
+static int record_load(const char *file, struct recording *r) {
+	struct record_file_header header;
+	FILE *f;
+	long size, offset;
+	int n;
+	f = fopen(file, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "Error: could not open recording %s: %s\n", file, strerror(errno));
+		return - 1;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	r->data = malloc(size > 0 ? size : 1);
+	if (r->data == NULL || fread(r->data, 1, size, f) != size || size < sizeof(header)) {
+		fprintf(stderr, "Error: could not read recording %s.\n", file);
+		fclose(f);
+		return - 1;
+	}
+	fclose(f);
+	memcpy(&header, r->data, sizeof(header));
+	if (header.magic != RECORD_MAGIC || header.version != RECORD_VERSION) {
+		fprintf(stderr, "Error: %s is not a recording of this version of a10disp.\n", file);
+		return - 1;
+	}
+	// Count the entries, then index them.
+	for (n = 0, offset = sizeof(header); offset + (long)sizeof(struct record_entry) <= size; n++) {
+		struct record_entry e;
+		memcpy(&e, r->data + offset, sizeof(e));
+		offset += sizeof(e) + e.payload_size;
+	}
+	if (offset != size) {
+		fprintf(stderr, "Error: recording %s is truncated.\n", file);
+		return - 1;
+	}
+	r->entries = calloc(n > 0 ? n : 1, sizeof(struct replay_entry));
+	if (r->entries == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		return - 1;
+	}
+	r->nu_entries = n;
+	for (n = 0, offset = sizeof(header); n < r->nu_entries; n++) {
+		memcpy(&r->entries[n].e, r->data + offset, sizeof(struct record_entry));
+		r->entries[n].payload = r->data + offset + sizeof(struct record_entry);
+		offset += sizeof(struct record_entry) + r->entries[n].e.payload_size;
+	}
+	return 0;
+}
+
+static const char *record_entry_name(const struct record_entry *e, char *buffer) {
+	switch (e->type) {
+	case RECORD_OPEN :
+		return "open";
+	case RECORD_CLOSE :
+		return "close";
+	case RECORD_DISP_IOCTL :
+		return trace_disp_name(e->cmd, buffer);
+	case RECORD_FB_IOCTL :
+		return trace_fb_name(e->cmd, buffer);
+	case RECORD_FBSET :
+		return "fbset";
+	case RECORD_MMAP :
+		return "mmap";
+	default :
+		return "munmap";
+	}
+}
+
+static void replay_delay(uint32_t duration_us) {
+	struct timespec ts;
+	ts.tv_sec = duration_us / 1000000;
+	ts.tv_nsec = (duration_us % 1000000) * 1000L;
+	nanosleep(&ts, NULL);
+}
+
+static int replay_matches(const struct record_entry *e, uint32_t type, uint32_t cmd, int fb, const unsigned long *args) {
+	int nu_args;
+	if (e->type != type || e->cmd != cmd || e->fb != fb)
+		return 0;
+	if (args == NULL)
+		return 1;
+	nu_args = record_nu_args(type, cmd);
+	if ((nu_args > 0 && e->args[0] != (uint32_t)args[0]) || (nu_args > 1 && e->args[1] != (uint32_t)args[1]))
+		return 0;
+	return 1;
+}
+
+// Find the recorded entry of a call: the next unused matching entry, or else the first matching
+// one. Waits for the recorded duration. Returns NULL if the call isn't in the recording.
+
+static struct replay_entry *replay_find(uint32_t type, uint32_t cmd, int fb, const unsigned long *args) {
+	struct replay_entry *entry = NULL;
+	char name_buffer[32];
+	int i;
+	for (i = replay_cursor; i < replay.nu_entries; i++)
+		if (!replay.entries[i].used && replay_matches(&replay.entries[i].e, type, cmd, fb, args))
+			break;
+	if (i == replay.nu_entries)
+		for (i = 0; i < replay.nu_entries; i++)
+			if (replay_matches(&replay.entries[i].e, type, cmd, fb, args))
+				break;
+	if (i == replay.nu_entries) {
+		struct record_entry e;
+		memset(&e, 0, sizeof(e));
+		e.type = type;
+		e.cmd = cmd;
+		replay_nu_missing++;
+		fprintf(stderr, "Replay: %s", record_entry_name(&e, name_buffer));
+		if (args != NULL && record_nu_args(type, cmd) == 1)
+			fprintf(stderr, " (%lu)", args[0]);
+		else
+		if (args != NULL && record_nu_args(type, cmd) == 2)
+			fprintf(stderr, " (%lu, %lu)", args[0], args[1]);
+		if (fb >= 0)
+			fprintf(stderr, " on /dev/fb%d", fb);
+		fprintf(stderr, " is not in the recording.\n");
+		return NULL;
+	}
+	entry = &replay.entries[i];
+	if (i != replay_cursor || entry->used)
+		replay_nu_out_of_order++;
+	entry->used = 1;
+	replay_cursor = i + 1;
+	replay_nu_served++;
+	replay_delay(entry->e.duration_us);
+	return entry;
+}
+
+// Return the result of a recorded call, copying the returned data to data.
+
+static int replay_result(const struct replay_entry *entry, void *data, uint32_t size) {
+	if (entry == NULL) {
+		errno = EIO;
+		return - 1;
+	}
+	if (entry->e.ret < 0) {
+		errno = entry->e.error;
+		return entry->e.ret;
+	}
+	if (data != NULL && size > 0 && entry->e.payload_size == size &&
+	record_payload_is_output(entry->e.type, entry->e.cmd))
+		memcpy(data, entry->payload, size);
+	return entry->e.ret;
+}
+
+int replay_load(const char *file) {
+	if (record_load(file, &replay) < 0)
+		return - 1;
+	replay_file_name = file;
+	return 0;
+}
+
+static int replay_open(void) {
+	return replay_result(replay_find(RECORD_OPEN, 0, - 1, NULL), NULL, 0);
+}
+
+static void replay_close(void) {
+	int i, nu_unused = 0;
+	replay_find(RECORD_CLOSE, 0, - 1, NULL);
+	for (i = 0; i < replay.nu_entries; i++)
+		nu_unused += !replay.entries[i].used;
+	printf("Replay of %s: %d calls served, %d out of order, %d not in the recording, %d recorded calls "
+		"not made.\n", replay_file_name, replay_nu_served, replay_nu_out_of_order, replay_nu_missing, nu_unused);
+}
+
+static int replay_disp_ioctl(unsigned int cmd, unsigned long *args) {
+	uint32_t size;
+	void *data;
+	size = record_disp_payload(cmd, args, &data);
+	return replay_result(replay_find(RECORD_DISP_IOCTL, cmd, - 1, args), data, size);
+}
+
+static int replay_fb_ioctl(int fb, unsigned long cmd, void *arg) {
+	struct replay_entry *entry = replay_find(RECORD_FB_IOCTL, cmd, fb, NULL);
+	uint32_t size, handle;
+	void *data;
+	int ret;
+	size = record_fb_payload(cmd, arg, &data);
+	if (cmd == FBIOGET_LAYER_HDL_0 || cmd == FBIOGET_LAYER_HDL_1) {
+		ret = replay_result(entry, &handle, size);
+		if (ret >= 0)
+			*(unsigned long *)arg = handle;
+		return ret;
+	}
+	return replay_result(entry, data, size);
+}
+
+static int replay_fbset(int fb, const char *command, int width, int height, int bytes_per_pixel) {
+	struct replay_entry *entry = replay_find(RECORD_FBSET, 0, fb, NULL);
+	return entry == NULL ? 1 : entry->e.ret;
+}
+
+// The framebuffer contents aren't recorded; replay maps anonymous memory of the same size.
+
+static void *replay_fb_mmap(int fb, size_t length) {
+	unsigned long args[2] = { length, 0 };
+	if (replay_result(replay_find(RECORD_MMAP, 0, fb, args), NULL, 0) < 0)
+		return MAP_FAILED;
+	return mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, - 1, 0);
+}
+
+static void replay_fb_munmap(int fb, void *address, size_t length) {
+	unsigned long args[2] = { length, 0 };
+	replay_find(RECORD_MUNMAP, 0, fb, args);
+	munmap(address, length);
+}
+
+struct disp_backend replay_backend = {
+	"replay",
+	replay_open,
+	replay_close,
+	replay_disp_ioctl,
+	replay_fb_ioctl,
+	replay_fbset,
+	NULL,
+	replay_fb_mmap,
+	replay_fb_munmap
+};
+
+// Per-call statistics of a recording.
+
+#define RECORD_MAX_CALLS 64
+
+struct record_call_stats {
+	char name[32];
+	int count[2];
+	double total[2];
+};
+
+static int record_add_stats(struct record_call_stats *stats, int nu_stats, const struct recording *r, int index) {
+	char name_buffer[32];
+	int i, j;
+	for (i = 0; i < r->nu_entries; i++) {
+		const char *name = record_entry_name(&r->entries[i].e, name_buffer);
+		for (j = 0; j < nu_stats; j++)
+			if (strcmp(stats[j].name, name) == 0)
+				break;
+		if (j == nu_stats) {
+			if (nu_stats == RECORD_MAX_CALLS)
+				continue;
+			memset(&stats[j], 0, sizeof(stats[j]));
+			snprintf(stats[j].name, sizeof(stats[j].name), "%s", name);
+			nu_stats++;
+		}
+		stats[j].count[index]++;
+		stats[j].total[index] += r->entries[i].e.duration_us / 1000.0;
+	}
+	return nu_stats;
+}
+
+int record_diff(const char *file1, const char *file2) {
+	struct recording r[2];
+	struct record_call_stats stats[RECORD_MAX_CALLS];
+	int count[2] = { 0, 0 };
+	double total[2] = { 0, 0 };
+	int nu_files = file2 != NULL ? 2 : 1;
+	int nu_stats = 0, i, j;
+	memset(r, 0, sizeof(r));
+	if (record_load(file1, &r[0]) < 0 || (file2 != NULL && record_load(file2, &r[1]) < 0))
+		return 1;
+	for (i = 0; i < nu_files; i++)
+		nu_stats = record_add_stats(stats, nu_stats, &r[i], i);
+	if (nu_files == 1) {
+		printf("%s: %d calls.\n", file1, r[0].nu_entries);
+		printf("%-22s %7s %10s %10s\n", "call", "count", "total ms", "mean ms");
+	}
+	else {
+		printf("A: %s (%d calls)\nB: %s (%d calls)\n", file1, r[0].nu_entries, file2, r[1].nu_entries);
+		printf("%-22s %7s %7s %10s %10s %10s %10s\n", "call", "count A", "count B", "total A", "total B",
+			"mean A", "mean B");
+	}
+	for (i = 0; i < nu_stats; i++) {
+		struct record_call_stats *s = &stats[i];
+		for (j = 0; j < nu_files; j++) {
+			count[j] += s->count[j];
+			total[j] += s->total[j];
+		}
+		if (nu_files == 1) {
+			printf("%-22s %7d %10.3f %10.3f\n", s->name, s->count[0], s->total[0], s->total[0] / s->count[0]);
+			continue;
+		}
+		printf("%-22s %7d %7d %10.3f %10.3f %10.3f %10.3f%s\n", s->name, s->count[0], s->count[1],
+			s->total[0], s->total[1], s->count[0] > 0 ? s->total[0] / s->count[0] : 0,
+			s->count[1] > 0 ? s->total[1] / s->count[1] : 0, s->count[0] != s->count[1] ? "  (count differs)" : "");
+	}
+	if (nu_files == 1)
+		printf("%-22s %7d %10.3f\n", "total", count[0], total[0]);
+	else
+		printf("%-22s %7d %7d %10.3f %10.3f (%+.1f%%)\n", "total", count[0], count[1], total[0], total[1],
+			total[0] > 0 ? (total[1] - total[0]) * 100 / total[0] : 0);
+	for (i = 0; i < nu_files; i++) {
+		free(r[i].data);
+		free(r[i].entries);
+	}
+	return 0;
+}
@@ -0,0 +1,34 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  Recording and replaying of display driver sessions (--record and --replay
+  options, recorddiff command). A recording contains every call made through
+  the backend with its arguments, its result, its duration and the data the
+  driver returned (layer_info, fb_info, screeninfo), so that a run on a board
+  can be replayed with the original responses and timings on any machine.
+*/
+
+#ifndef A10DISP_RECORD_H
+#define A10DISP_RECORD_H
+
+#include "backend.h"
+
+// Open a recording file for writing. Returns -1 on failure.
+int record_open(const char *file);
+
+// Returns a backend that records every call and passes it on to the given backend.
+struct disp_backend *record_backend(struct disp_backend *backend);
+
+// Finish the recording file.
+void record_close(void);
+
+// Load a recording to be served by replay_backend. Returns -1 on failure.
+int replay_load(const char *file);
+
+extern struct disp_backend replay_backend;
+
+// Print the number of calls and the latencies per call of a recording, compared with a second
+// recording if file2 is not NULL. Returns the exit code.
+int record_diff(const char *file1, const char *file2);
+
+#endif
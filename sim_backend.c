@@ -0,0 +1,641 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  Simulated sunxi display driver. Models two screens with their outputs,
+  framebuffer layers, scaler usage, HDMI mode support and framebuffer memory,
+  with a configurable latency for every ioctl, so that a10disp can be run
+  and timed on a machine without Allwinner hardware.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "backend.h"
+
+#define SIM_STATE_MAGIC 0x41313053
+
+struct sim_latency {
+	unsigned long cmd;
+	const char *name;
+	int latency_us;
+};
+
+// Default latencies in microseconds. They are only meant to be in the right order of
+// magnitude (turning outputs on or off and setting modes are slow, queries are fast);
+// use the spec to match a particular board.
+static struct sim_latency sim_disp_latency[] = {
+	{ DISP_CMD_VERSION, "VERSION", 2 },
+	{ DISP_CMD_SCN_GET_WIDTH, "SCN_GET_WIDTH", 2 },
+	{ DISP_CMD_SCN_GET_HEIGHT, "SCN_GET_HEIGHT", 2 },
+	{ DISP_CMD_GET_OUTPUT_TYPE, "GET_OUTPUT_TYPE", 2 },
+	{ DISP_CMD_LAYER_GET_FB, "LAYER_GET_FB", 5 },
+	{ DISP_CMD_LAYER_SET_PARA, "LAYER_SET_PARA", 200 },
+	{ DISP_CMD_LAYER_GET_PARA, "LAYER_GET_PARA", 5 },
+	{ DISP_CMD_LCD_ON, "LCD_ON", 60000 },
+	{ DISP_CMD_LCD_OFF, "LCD_OFF", 20000 },
+	{ DISP_CMD_TV_OFF, "TV_OFF", 20000 },
+	{ DISP_CMD_HDMI_ON, "HDMI_ON", 80000 },
+	{ DISP_CMD_HDMI_OFF, "HDMI_OFF", 20000 },
+	{ DISP_CMD_HDMI_SET_MODE, "HDMI_SET_MODE", 10000 },
+	{ DISP_CMD_HDMI_GET_MODE, "HDMI_GET_MODE", 2 },
+	{ DISP_CMD_HDMI_SUPPORT_MODE, "HDMI_SUPPORT_MODE", 30 },
+	{ DISP_CMD_HDMI_GET_HPD_STATUS, "HDMI_GET_HPD_STATUS", 2 },
+	{ DISP_CMD_VGA_OFF, "VGA_OFF", 20000 },
+	{ 0, NULL, 0 }
+};
+
+static struct sim_latency sim_fb_latency[] = {
+	{ FBIOGET_VSCREENINFO, "FBIOGET_VSCREENINFO", 3 },
+	{ FBIOPUT_VSCREENINFO, "FBIOPUT_VSCREENINFO", 4000 },
+	{ FBIOGET_FSCREENINFO, "FBIOGET_FSCREENINFO", 3 },
+	{ FBIOGET_LAYER_HDL_0, "FBIOGET_LAYER_HDL_0", 2 },
+	{ FBIOGET_LAYER_HDL_1, "FBIOGET_LAYER_HDL_1", 2 },
+	{ FBIOPAN_DISPLAY, "FBIOPAN_DISPLAY", 20 },
+	// Only the call overhead; the wait for the vertical sync itself is simulated.
+	{ FBIO_WAITFORVSYNC, "FBIO_WAITFORVSYNC", 2 },
+	{ 0, NULL, 0 }
+};
+
+// Time taken by running fbset (shell, process startup and the FBIOPUT_VSCREENINFO it does).
+static int sim_fbset_latency_us = 35000;
+
+struct sim_screen {
+	int output_type;
+	int hdmi_mode;
+	// Dimensions of the output that was last enabled.
+	int width, height;
+	int layer_handle;
+	__disp_layer_info_t layer_info;
+	struct fb_var_screeninfo var;
+	struct fb_fix_screeninfo fix;
+};
+
+// Everything in this structure is saved to the state file, if one is used.
+static struct {
+	unsigned int magic;
+	unsigned int size;
+	int version;
+	int lcd_width, lcd_height;
+	int edid_width, edid_height;
+	unsigned long long supported_modes;
+	int hpd;
+	int nu_scalers;
+	struct sim_screen screen[2];
+} sim, sim_initial;
+
+static int sim_configured = 0;
+static char sim_state_file[256];
+// Serializes the changes to the state when both screens are changed by different threads, like
+// the lock of the real driver. The latencies are simulated outside of it.
+static pthread_mutex_t sim_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void sim_delay(int latency_us) {
+	struct timespec start, now, ts;
+	long elapsed_ns;
+	if (latency_us <= 0)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	// Sleep for most of the time and busy-wait for the rest, so that short latencies
+	// are reproducible.
+	if (latency_us > 200) {
+		ts.tv_sec = (latency_us - 100) / 1000000;
+		ts.tv_nsec = ((latency_us - 100) % 1000000) * 1000L;
+		nanosleep(&ts, NULL);
+	}
+	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed_ns = (now.tv_sec - start.tv_sec) * 1000000000L + now.tv_nsec - start.tv_nsec;
+		if (elapsed_ns >= latency_us * 1000L)
+			break;
+	}
+}
+
+static int sim_lookup_latency(struct sim_latency *table, unsigned long cmd) {
+	int i;
+	for (i = 0; table[i].name != NULL; i++)
+		if (table[i].cmd == cmd)
+			return table[i].latency_us;
+	return 0;
+}
+
+static int sim_set_latency(const char *name, int latency_us) {
+	int i;
+	if (strcasecmp(name, "fbset") == 0) {
+		sim_fbset_latency_us = latency_us;
+		return 0;
+	}
+	for (i = 0; sim_disp_latency[i].name != NULL; i++)
+		if (strcasecmp(sim_disp_latency[i].name, name) == 0) {
+			sim_disp_latency[i].latency_us = latency_us;
+			return 0;
+		}
+	for (i = 0; sim_fb_latency[i].name != NULL; i++)
+		if (strcasecmp(sim_fb_latency[i].name, name) == 0) {
+			sim_fb_latency[i].latency_us = latency_us;
+			return 0;
+		}
+	return - 1;
+}
+
+static int sim_mode_dimensions(int mode, int *width, int *height) {
+	if (mode == DISP_TV_MODE_EDID) {
+		*width = sim.edid_width;
+		*height = sim.edid_height;
+		return 0;
+	}
+	if (mode < 0 || mode >= nu_modes || mode_timing[mode].width == 0)
+		return - 1;
+	*width = mode_timing[mode].width;
+	*height = mode_timing[mode].height;
+	return 0;
+}
+
+static void sim_update_layer_from_var(int fb) {
+	struct sim_screen *s = &sim.screen[fb];
+	int bits_per_pixel = s->var.bits_per_pixel;
+	s->layer_info.fb.size.width = s->var.xres_virtual;
+	s->layer_info.fb.size.height = s->var.yres_virtual;
+	if (bits_per_pixel == 16) {
+		s->layer_info.fb.format = DISP_FORMAT_RGB565;
+		s->layer_info.fb.seq = DISP_SEQ_P10;
+	}
+	else {
+		s->layer_info.fb.format = bits_per_pixel == 24 ? DISP_FORMAT_RGB888 : DISP_FORMAT_ARGB8888;
+		s->layer_info.fb.seq = DISP_SEQ_ARGB;
+	}
+	s->layer_info.src_win.x = s->var.xoffset;
+	s->layer_info.src_win.y = s->var.yoffset;
+	s->layer_info.src_win.width = s->var.xres;
+	s->layer_info.src_win.height = s->var.yres;
+	if (s->layer_info.mode != DISP_LAYER_WORK_MODE_SCALER) {
+		s->layer_info.scn_win.width = s->var.xres;
+		s->layer_info.scn_win.height = s->var.yres;
+	}
+	s->fix.line_length = s->var.xres_virtual * ((bits_per_pixel + 7) / 8);
+}
+
+static int sim_set_var(int fb, const struct fb_var_screeninfo *var) {
+	struct sim_screen *s = &sim.screen[fb];
+	if (var->bits_per_pixel != 16 && var->bits_per_pixel != 24 && var->bits_per_pixel != 32)
+		return - EINVAL;
+	if (var->xres == 0 || var->yres == 0 || var->xres_virtual < var->xres || var->yres_virtual < var->yres)
+		return - EINVAL;
+	if ((unsigned long long)var->xres_virtual * var->yres_virtual * (var->bits_per_pixel / 8) >
+	s->fix.smem_len)
+		return - ENOMEM;
+	s->var = *var;
+	s->var.activate = 0;
+	sim_update_layer_from_var(fb);
+	return 0;
+}
+
+static void sim_init_screen(int i, int output_type, int bits_per_pixel, int smem_mb) {
+	struct sim_screen *s = &sim.screen[i];
+	memset(s, 0, sizeof(*s));
+	s->output_type = output_type;
+	s->hdmi_mode = DISP_TV_MOD_720P_60HZ;
+	s->width = sim.lcd_width;
+	s->height = sim.lcd_height;
+	s->layer_handle = 100 + i;
+	s->layer_info.mode = DISP_LAYER_WORK_MODE_NORMAL;
+	s->layer_info.pipe = 0;
+	s->layer_info.prio = 0;
+	s->layer_info.fb.mode = DISP_MOD_INTERLEAVED;
+	strcpy(s->fix.id, "sunxi_fb (sim)");
+	s->fix.smem_len = smem_mb * 1024 * 1024;
+	s->fix.type = FB_TYPE_PACKED_PIXELS;
+	s->fix.visual = FB_VISUAL_TRUECOLOR;
+	s->var.bits_per_pixel = bits_per_pixel;
+}
+
+static void sim_finish_screen(int i) {
+	struct sim_screen *s = &sim.screen[i];
+	if (s->output_type == DISP_OUTPUT_TYPE_HDMI)
+		sim_mode_dimensions(s->hdmi_mode, &s->width, &s->height);
+	s->var.xres = s->var.xres_virtual = s->width;
+	s->var.yres = s->var.yres_virtual = s->height;
+	sim_update_layer_from_var(i);
+}
+
+static int sim_parse_output(const char *value) {
+	if (strcasecmp(value, "lcd") == 0)
+		return DISP_OUTPUT_TYPE_LCD;
+	if (strcasecmp(value, "hdmi") == 0)
+		return DISP_OUTPUT_TYPE_HDMI;
+	if (strcasecmp(value, "none") == 0)
+		return DISP_OUTPUT_TYPE_NONE;
+	return - 1;
+}
+
+// Parse a list of mode numbers and ranges separated by '/', for example "2-10/27".
+
+static int sim_parse_modes(const char *value, unsigned long long *modes) {
+	const char *p = value;
+	*modes = 0;
+	if (strcasecmp(value, "all") == 0) {
+		// Includes custom modes loaded later.
+		*modes = ~0ULL;
+		return 0;
+	}
+	while (*p != '\0') {
+		char *end;
+		int first, last, i;
+		first = last = strtol(p, &end, 10);
+		if (end == p)
+			return - 1;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p)
+				return - 1;
+		}
+		for (i = first; i <= last && i < 64; i++)
+			*modes |= 1ULL << i;
+		p = end;
+		if (*p == '/')
+			p++;
+		else
+		if (*p != '\0')
+			return - 1;
+	}
+	return 0;
+}
+
+// Configure the simulated driver. The spec is a comma-separated list of settings:
+//	output=lcd|hdmi|none, output1=...	Initial output of screen 0 and 1.
+//	mode=n, mode1=n				Initial HDMI mode of screen 0 and 1.
+//	depth=16|24|32, depth1=...		Initial console pixel depth.
+//	fbmem=MB, fbmem1=MB			Framebuffer memory (smem_len) of /dev/fb0 and /dev/fb1.
+//	lcd=WxH					LCD panel size.
+//	edid=WxH				Dimensions used for DISP_TV_MODE_EDID.
+//	modes=list				HDMI modes supported by the display, e.g. "2-10/27" or "all".
+//	hpd=0|1					HDMI hot plug state.
+//	scalers=n				Number of scalers (2 on A10/A20, 1 on A13).
+//	version=major.minor			Reported driver version.
+//	state=file				Load the state from file and save it on exit, so that
+//						a sequence of commands can be simulated.
+//	<ioctl name>=us				Latency of an ioctl, e.g. HDMI_SET_MODE=15000 or
+//						FBIOPUT_VSCREENINFO=3000, or fbset=us for running fbset.
+// "default" uses the default settings.
+
+int sim_configure(const char *spec) {
+	char *copy, *item, *saveptr;
+	int output[2] = { DISP_OUTPUT_TYPE_LCD, DISP_OUTPUT_TYPE_NONE };
+	int mode[2] = { DISP_TV_MOD_720P_60HZ, DISP_TV_MOD_720P_60HZ };
+	int depth[2] = { 32, 32 };
+	int fbmem[2] = { 32, 8 };
+	int i;
+	memset(&sim, 0, sizeof(sim));
+	sim.magic = SIM_STATE_MAGIC;
+	sim.size = sizeof(sim);
+	sim.version = SUNXI_DISP_VERSION;
+	sim.lcd_width = 800;
+	sim.lcd_height = 480;
+	sim.edid_width = 1920;
+	sim.edid_height = 1080;
+	sim_parse_modes("2-10/26-27", &sim.supported_modes);
+	sim.hpd = 1;
+	sim.nu_scalers = 2;
+	sim_state_file[0] = '\0';
+
+	copy = strdup(spec);
+	for (item = strtok_r(copy, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+		char *value = strchr(item, '=');
+		int ok = 1;
+		if (strcasecmp(item, "default") == 0)
+			continue;
+		if (value == NULL) {
+			fprintf(stderr, "Invalid simulation setting \"%s\".\n", item);
+			free(copy);
+			return - 1;
+		}
+		*value++ = '\0';
+		if (strcasecmp(item, "output") == 0 || strcasecmp(item, "output1") == 0) {
+			i = item[6] == '1';
+			output[i] = sim_parse_output(value);
+			ok = output[i] >= 0;
+		}
+		else
+		if (strcasecmp(item, "mode") == 0 || strcasecmp(item, "mode1") == 0)
+			mode[item[4] == '1'] = atoi(value);
+		else
+		if (strcasecmp(item, "depth") == 0 || strcasecmp(item, "depth1") == 0) {
+			i = item[5] == '1';
+			depth[i] = atoi(value);
+			ok = depth[i] == 16 || depth[i] == 24 || depth[i] == 32;
+		}
+		else
+		if (strcasecmp(item, "fbmem") == 0 || strcasecmp(item, "fbmem1") == 0)
+			fbmem[item[5] == '1'] = atoi(value);
+		else
+		if (strcasecmp(item, "lcd") == 0)
+			ok = sscanf(value, "%dx%d", &sim.lcd_width, &sim.lcd_height) == 2;
+		else
+		if (strcasecmp(item, "edid") == 0)
+			ok = sscanf(value, "%dx%d", &sim.edid_width, &sim.edid_height) == 2;
+		else
+		if (strcasecmp(item, "modes") == 0)
+			ok = sim_parse_modes(value, &sim.supported_modes) == 0;
+		else
+		if (strcasecmp(item, "hpd") == 0)
+			sim.hpd = atoi(value);
+		else
+		if (strcasecmp(item, "scalers") == 0)
+			sim.nu_scalers = atoi(value);
+		else
+		if (strcasecmp(item, "version") == 0) {
+			int major, minor;
+			ok = sscanf(value, "%d.%d", &major, &minor) == 2;
+			sim.version = (major << 16) | minor;
+		}
+		else
+		if (strcasecmp(item, "state") == 0) {
+			strncpy(sim_state_file, value, sizeof(sim_state_file) - 1);
+			sim_state_file[sizeof(sim_state_file) - 1] = '\0';
+		}
+		else
+			ok = sim_set_latency(item, atoi(value)) == 0;
+		if (!ok) {
+			fprintf(stderr, "Invalid simulation setting \"%s=%s\".\n", item, value);
+			free(copy);
+			return - 1;
+		}
+	}
+	free(copy);
+
+	for (i = 0; i < 2; i++) {
+		sim_init_screen(i, output[i], depth[i], fbmem[i]);
+		sim.screen[i].hdmi_mode = mode[i];
+		sim_finish_screen(i);
+		if ((unsigned long long)sim.screen[i].var.xres * sim.screen[i].var.yres * depth[i] / 8 >
+		sim.screen[i].fix.smem_len) {
+			fprintf(stderr, "Simulated framebuffer %d is too small for the initial mode.\n", i);
+			return - 1;
+		}
+	}
+	sim_configured = 1;
+	return 0;
+}
+
+static int sim_open(void) {
+	FILE *f;
+	if (!sim_configured && sim_configure("default") < 0) {
+		errno = EINVAL;
+		return - 1;
+	}
+	if (sim_state_file[0] != '\0') {
+		f = fopen(sim_state_file, "rb");
+		if (f != NULL) {
+			unsigned int magic = sim.magic, size = sim.size;
+			if (fread(&sim, sizeof(sim), 1, f) != 1 || sim.magic != magic || sim.size != size) {
+				fprintf(stderr, "Error: Invalid simulation state file %s.\n", sim_state_file);
+				fclose(f);
+				errno = EINVAL;
+				return - 1;
+			}
+			fclose(f);
+		}
+	}
+	sim_initial = sim;
+	printf("Using simulated sunxi display driver.\n");
+	return 0;
+}
+
+static void sim_reset(void) {
+	sim = sim_initial;
+}
+
+static void sim_close(void) {
+	FILE *f;
+	if (sim_state_file[0] == '\0')
+		return;
+	f = fopen(sim_state_file, "wb");
+	if (f == NULL || fwrite(&sim, sizeof(sim), 1, f) != 1)
+		fprintf(stderr, "Error: Could not write simulation state file %s.\n", sim_state_file);
+	if (f != NULL)
+		fclose(f);
+}
+
+static int sim_nu_scalers_in_use(void) {
+	int i, n = 0;
+	for (i = 0; i < 2; i++)
+		if (sim.screen[i].layer_info.mode == DISP_LAYER_WORK_MODE_SCALER)
+			n++;
+	return n;
+}
+
+static int sim_do_disp_ioctl(unsigned int cmd, unsigned long *args) {
+	struct sim_screen *s;
+	if (cmd == DISP_CMD_VERSION)
+		return sim.version;
+	if (args[0] > 1)
+		return - EINVAL;
+	s = &sim.screen[args[0]];
+	switch (cmd) {
+	case DISP_CMD_SCN_GET_WIDTH :
+		return s->width;
+	case DISP_CMD_SCN_GET_HEIGHT :
+		return s->height;
+	case DISP_CMD_GET_OUTPUT_TYPE :
+		return s->output_type;
+	case DISP_CMD_LAYER_GET_PARA :
+	case DISP_CMD_LAYER_SET_PARA :
+	case DISP_CMD_LAYER_GET_FB :
+		if (args[1] != s->layer_handle)
+			return - EINVAL;
+		if (cmd == DISP_CMD_LAYER_GET_FB) {
+			memcpy((void *)args[2], &s->layer_info.fb, sizeof(__disp_fb_t));
+			return 0;
+		}
+		if (cmd == DISP_CMD_LAYER_GET_PARA) {
+			memcpy((void *)args[2], &s->layer_info, sizeof(__disp_layer_info_t));
+			return 0;
+		}
+		if (((__disp_layer_info_t *)args[2])->mode == DISP_LAYER_WORK_MODE_SCALER &&
+		s->layer_info.mode != DISP_LAYER_WORK_MODE_SCALER && sim_nu_scalers_in_use() >= sim.nu_scalers)
+			return - EBUSY;
+		memcpy(&s->layer_info, (void *)args[2], sizeof(__disp_layer_info_t));
+		return 0;
+	case DISP_CMD_LCD_ON :
+		s->output_type = DISP_OUTPUT_TYPE_LCD;
+		s->width = sim.lcd_width;
+		s->height = sim.lcd_height;
+		return 0;
+	case DISP_CMD_HDMI_ON :
+		if (sim_mode_dimensions(s->hdmi_mode, &s->width, &s->height) < 0)
+			return - EINVAL;
+		s->output_type = DISP_OUTPUT_TYPE_HDMI;
+		return 0;
+	case DISP_CMD_LCD_OFF :
+	case DISP_CMD_HDMI_OFF :
+	case DISP_CMD_TV_OFF :
+	case DISP_CMD_VGA_OFF :
+		s->output_type = DISP_OUTPUT_TYPE_NONE;
+		return 0;
+	case DISP_CMD_HDMI_SET_MODE : {
+		int width, height;
+		if (sim_mode_dimensions(args[1], &width, &height) < 0)
+			return - EINVAL;
+		s->hdmi_mode = args[1];
+		return 0;
+		}
+	case DISP_CMD_HDMI_GET_MODE :
+		return s->hdmi_mode;
+	case DISP_CMD_HDMI_SUPPORT_MODE :
+		return sim.hpd && args[1] < 64 && (sim.supported_modes & (1ULL << args[1])) != 0;
+	case DISP_CMD_HDMI_GET_HPD_STATUS :
+		return sim.hpd;
+	default :
+		return - EINVAL;
+	}
+}
+
+static int sim_disp_ioctl(unsigned int cmd, unsigned long *args) {
+	int ret;
+	sim_delay(sim_lookup_latency(sim_disp_latency, cmd));
+	pthread_mutex_lock(&sim_mutex);
+	ret = sim_do_disp_ioctl(cmd, args);
+	pthread_mutex_unlock(&sim_mutex);
+	if (ret < 0) {
+		errno = - ret;
+		return - 1;
+	}
+	return ret;
+}
+
+// Returns the time in microseconds until the next vertical sync of a screen. The vsyncs of the
+// simulated display are at multiples of the refresh period of the current mode (LCDs are assumed
+// to be 60 Hz).
+
+static int sim_time_to_vsync(int fb) {
+	struct sim_screen *s = &sim.screen[fb];
+	struct timespec now;
+	long long period_ns, now_ns;
+	int refresh = 60;
+	if (s->output_type == DISP_OUTPUT_TYPE_HDMI && s->hdmi_mode >= 0 && s->hdmi_mode < nu_modes &&
+	mode_timing[s->hdmi_mode].refresh > 0)
+		refresh = mode_timing[s->hdmi_mode].refresh;
+	period_ns = 1000000000LL / refresh;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	now_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+	return (period_ns - now_ns % period_ns + 999) / 1000;
+}
+
+// Performs a framebuffer ioctl on the state. For FBIO_WAITFORVSYNC, *wait_us is set to the time
+// to wait, which the caller sleeps after releasing the lock.
+
+static int sim_do_fb_ioctl(int fb, unsigned long cmd, void *arg, int *wait_us) {
+	struct sim_screen *s = &sim.screen[fb];
+	switch (cmd) {
+	case FBIOGET_VSCREENINFO :
+		memcpy(arg, &s->var, sizeof(s->var));
+		return 0;
+	case FBIOPUT_VSCREENINFO :
+		return sim_set_var(fb, (struct fb_var_screeninfo *)arg);
+	case FBIOGET_FSCREENINFO :
+		memcpy(arg, &s->fix, sizeof(s->fix));
+		return 0;
+	case FBIOGET_LAYER_HDL_0 :
+	case FBIOGET_LAYER_HDL_1 :
+		if ((cmd == FBIOGET_LAYER_HDL_0) != (fb == 0))
+			return - EINVAL;
+		*(unsigned long *)arg = s->layer_handle;
+		return 0;
+	case FBIOPAN_DISPLAY : {
+		const struct fb_var_screeninfo *var = arg;
+		if (var->xoffset + s->var.xres > s->var.xres_virtual || var->yoffset + s->var.yres > s->var.yres_virtual)
+			return - EINVAL;
+		s->var.xoffset = var->xoffset;
+		s->var.yoffset = var->yoffset;
+		sim_update_layer_from_var(fb);
+		return 0;
+		}
+	case FBIO_WAITFORVSYNC :
+		if (s->output_type == DISP_OUTPUT_TYPE_NONE)
+			return - ENODEV;
+		*wait_us = sim_time_to_vsync(fb);
+		return 0;
+	default :
+		return - EINVAL;
+	}
+}
+
+static int sim_fb_ioctl(int fb, unsigned long cmd, void *arg) {
+	int ret, wait_us = 0;
+	sim_delay(sim_lookup_latency(sim_fb_latency, cmd));
+	pthread_mutex_lock(&sim_mutex);
+	ret = sim_do_fb_ioctl(fb, cmd, arg, &wait_us);
+	pthread_mutex_unlock(&sim_mutex);
+	sim_delay(wait_us);
+	if (ret < 0) {
+		errno = - ret;
+		return - 1;
+	}
+	return ret;
+}
+
+static int sim_fbset(int fb, const char *command, int width, int height, int bytes_per_pixel) {
+	struct fb_var_screeninfo var;
+	const char *vyres = strstr(command, " -vyres ");
+	int ret;
+	sim_delay(sim_fbset_latency_us);
+	pthread_mutex_lock(&sim_mutex);
+	var = sim.screen[fb].var;
+	if (width > 0 && height > 0) {
+		var.xres = var.xres_virtual = width;
+		var.yres = var.yres_virtual = height;
+		var.xoffset = var.yoffset = 0;
+	}
+	if (vyres != NULL) {
+		var.yres_virtual = atoi(vyres + 8);
+		var.yoffset = 0;
+	}
+	if (bytes_per_pixel > 0)
+		var.bits_per_pixel = bytes_per_pixel * 8;
+	// Like fbset, report failure through the exit status.
+	ret = sim_set_var(fb, &var) < 0;
+	pthread_mutex_unlock(&sim_mutex);
+	return ret;
+}
+
+// The framebuffer memory is allocated when it is first mapped and keeps its contents, like the
+// memory reserved by the real driver.
+static void *sim_fb_memory[2];
+
+static void *sim_fb_mmap(int fb, size_t length) {
+	if (length > sim.screen[fb].fix.smem_len) {
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+	if (sim_fb_memory[fb] == NULL) {
+		void *p = mmap(NULL, sim.screen[fb].fix.smem_len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return MAP_FAILED;
+		sim_fb_memory[fb] = p;
+	}
+	return sim_fb_memory[fb];
+}
+
+static void sim_fb_munmap(int fb, void *address, size_t length) {
+}
+
+struct disp_backend sim_backend = {
+	"sim",
+	sim_open,
+	sim_close,
+	sim_disp_ioctl,
+	sim_fb_ioctl,
+	sim_fbset,
+	sim_reset,
+	sim_fb_mmap,
+	sim_fb_munmap
+};
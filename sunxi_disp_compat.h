@@ -0,0 +1,163 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  Minimal declarations of the sunxi display driver interface, used when a10disp
+  is built without the kernel's include/video/sunxi_disp_ioctl.h (make a10disp-sim).
+  Only the types and constants used by a10disp are declared. The structure
+  layouts follow the kernel header, but the ioctl command numbers are only
+  meaningful to the simulated backend, so a binary built with this file can't
+  be used with the real display driver.
+*/
+
+#ifndef A10DISP_SUNXI_DISP_COMPAT_H
+#define A10DISP_SUNXI_DISP_COMPAT_H
+
+#include <linux/types.h>
+
+#define __bool signed char
+
+#define SUNXI_DISP_VERSION_MAJOR 1
+#define SUNXI_DISP_VERSION_MINOR 0
+#define SUNXI_DISP_VERSION ((SUNXI_DISP_VERSION_MAJOR << 16) | SUNXI_DISP_VERSION_MINOR)
+
+typedef struct {
+	__s32 x;
+	__s32 y;
+	__u32 width;
+	__u32 height;
+} __disp_rect_t;
+
+typedef struct {
+	__u32 width;
+	__u32 height;
+} __disp_rectsz_t;
+
+typedef enum {
+	DISP_FORMAT_1BPP = 0x0,
+	DISP_FORMAT_2BPP = 0x1,
+	DISP_FORMAT_4BPP = 0x2,
+	DISP_FORMAT_8BPP = 0x3,
+	DISP_FORMAT_RGB655 = 0x4,
+	DISP_FORMAT_RGB565 = 0x5,
+	DISP_FORMAT_RGB556 = 0x6,
+	DISP_FORMAT_ARGB1555 = 0x7,
+	DISP_FORMAT_RGBA5551 = 0x8,
+	DISP_FORMAT_ARGB888 = 0x9,
+	DISP_FORMAT_ARGB8888 = 0xa,
+	DISP_FORMAT_RGB888 = 0xb,
+	DISP_FORMAT_ARGB4444 = 0xc
+} __disp_pixel_fmt_t;
+
+typedef enum {
+	DISP_MOD_NON_MB_PLANAR = 0x0,
+	DISP_MOD_INTERLEAVED = 0x1
+} __disp_pixel_mod_t;
+
+typedef enum {
+	DISP_SEQ_ARGB = 0x0,
+	DISP_SEQ_BGRA = 0x2,
+	DISP_SEQ_P10 = 0xd
+} __disp_pixel_seq_t;
+
+typedef struct {
+	__u32 addr[3];
+	__disp_rectsz_t size;
+	__disp_pixel_fmt_t format;
+	__disp_pixel_seq_t seq;
+	__disp_pixel_mod_t mode;
+	__bool br_swap;
+	__u32 cs_mode;
+	__bool b_trd_src;
+	__u32 trd_mode;
+	__u32 trd_right_addr[3];
+	__bool pre_multiply;
+} __disp_fb_t;
+
+typedef enum {
+	DISP_LAYER_WORK_MODE_NORMAL = 0,
+	DISP_LAYER_WORK_MODE_PALETTE = 1,
+	DISP_LAYER_WORK_MODE_INTER_BUF = 2,
+	DISP_LAYER_WORK_MODE_GAMMA = 3,
+	DISP_LAYER_WORK_MODE_SCALER = 4
+} __disp_layer_work_mode_t;
+
+typedef struct {
+	__disp_layer_work_mode_t mode;
+	__u8 pipe;
+	__u8 prio;
+	__bool alpha_en;
+	__u16 alpha_val;
+	__bool ck_enable;
+	__disp_rect_t src_win;
+	__disp_rect_t scn_win;
+	__disp_fb_t fb;
+	__bool b_trd_out;
+	__u32 out_trd_mode;
+} __disp_layer_info_t;
+
+typedef enum {
+	DISP_OUTPUT_TYPE_NONE = 0,
+	DISP_OUTPUT_TYPE_LCD = 1,
+	DISP_OUTPUT_TYPE_TV = 2,
+	DISP_OUTPUT_TYPE_HDMI = 4,
+	DISP_OUTPUT_TYPE_VGA = 8
+} __disp_output_type_t;
+
+// Includes the 1680x1050 mode described at the top of a10disp.c.
+typedef enum {
+	DISP_TV_MOD_480I = 0,
+	DISP_TV_MOD_576I = 1,
+	DISP_TV_MOD_480P = 2,
+	DISP_TV_MOD_576P = 3,
+	DISP_TV_MOD_720P_50HZ = 4,
+	DISP_TV_MOD_720P_60HZ = 5,
+	DISP_TV_MOD_1080I_50HZ = 6,
+	DISP_TV_MOD_1080I_60HZ = 7,
+	DISP_TV_MOD_1080P_24HZ = 8,
+	DISP_TV_MOD_1080P_50HZ = 9,
+	DISP_TV_MOD_1080P_60HZ = 0xa,
+	DISP_TV_MOD_PAL = 0xb,
+	DISP_TV_MOD_PAL_SVIDEO = 0xc,
+	DISP_TV_MOD_NTSC = 0xe,
+	DISP_TV_MOD_NTSC_SVIDEO = 0xf,
+	DISP_TV_MOD_PAL_M = 0x11,
+	DISP_TV_MOD_PAL_M_SVIDEO = 0x12,
+	DISP_TV_MOD_PAL_NC = 0x14,
+	DISP_TV_MOD_PAL_NC_SVIDEO = 0x15,
+	DISP_TV_MOD_1080P_24HZ_3D_FP = 0x17,
+	DISP_TV_MOD_720P_50HZ_3D_FP = 0x18,
+	DISP_TV_MOD_720P_60HZ_3D_FP = 0x19,
+	DISP_TV_MOD_1360_768_60HZ = 0x1a,
+	DISP_TV_MOD_1280_1024_60HZ = 0x1b,
+	DISP_TV_MOD_1680_1050_60HZ = 0x1c,
+	DISP_TV_MODE_NUM = 0x1d,
+	DISP_TV_MODE_EDID = 0xff
+} __disp_tv_mode_t;
+
+typedef enum {
+	DISP_CMD_VERSION = 0x00,
+	DISP_CMD_SCN_GET_WIDTH = 0x07,
+	DISP_CMD_SCN_GET_HEIGHT = 0x08,
+	DISP_CMD_GET_OUTPUT_TYPE = 0x09,
+	DISP_CMD_LAYER_SET_FB = 0x44,
+	DISP_CMD_LAYER_GET_FB = 0x45,
+	DISP_CMD_LAYER_SET_PARA = 0x4a,
+	DISP_CMD_LAYER_GET_PARA = 0x4b,
+	DISP_CMD_LCD_ON = 0x140,
+	DISP_CMD_LCD_OFF = 0x141,
+	DISP_CMD_TV_ON = 0x180,
+	DISP_CMD_TV_OFF = 0x181,
+	DISP_CMD_HDMI_ON = 0x1c0,
+	DISP_CMD_HDMI_OFF = 0x1c1,
+	DISP_CMD_HDMI_SET_MODE = 0x1c2,
+	DISP_CMD_HDMI_GET_MODE = 0x1c3,
+	DISP_CMD_HDMI_SUPPORT_MODE = 0x1c4,
+	DISP_CMD_HDMI_GET_HPD_STATUS = 0x1c5,
+	DISP_CMD_VGA_ON = 0x200,
+	DISP_CMD_VGA_OFF = 0x201
+} __disp_cmd_t;
+
+#define FBIOGET_LAYER_HDL_0 0x4700
+#define FBIOGET_LAYER_HDL_1 0x4701
+
+#endif
@@ -0,0 +1,302 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  Tracing of the display driver calls. The trace file contains one complete
+  ("X") event per call, with the arguments and the return value, in the
+  Chrome trace event JSON format.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "trace.h"
+
+struct trace_name {
+	unsigned long cmd;
+	const char *name;
+};
+
+static const struct trace_name trace_disp_names[] = {
+	{ DISP_CMD_VERSION, "VERSION" },
+	{ DISP_CMD_SCN_GET_WIDTH, "SCN_GET_WIDTH" },
+	{ DISP_CMD_SCN_GET_HEIGHT, "SCN_GET_HEIGHT" },
+	{ DISP_CMD_GET_OUTPUT_TYPE, "GET_OUTPUT_TYPE" },
+	{ DISP_CMD_LAYER_GET_FB, "LAYER_GET_FB" },
+	{ DISP_CMD_LAYER_SET_PARA, "LAYER_SET_PARA" },
+	{ DISP_CMD_LAYER_GET_PARA, "LAYER_GET_PARA" },
+	{ DISP_CMD_LCD_ON, "LCD_ON" },
+	{ DISP_CMD_LCD_OFF, "LCD_OFF" },
+	{ DISP_CMD_TV_OFF, "TV_OFF" },
+	{ DISP_CMD_HDMI_ON, "HDMI_ON" },
+	{ DISP_CMD_HDMI_OFF, "HDMI_OFF" },
+	{ DISP_CMD_HDMI_SET_MODE, "HDMI_SET_MODE" },
+	{ DISP_CMD_HDMI_GET_MODE, "HDMI_GET_MODE" },
+	{ DISP_CMD_HDMI_SUPPORT_MODE, "HDMI_SUPPORT_MODE" },
+	{ DISP_CMD_HDMI_GET_HPD_STATUS, "HDMI_GET_HPD_STATUS" },
+	{ DISP_CMD_VGA_OFF, "VGA_OFF" },
+	{ 0, NULL }
+};
+
+static const struct trace_name trace_fb_names[] = {
+	{ FBIOGET_VSCREENINFO, "FBIOGET_VSCREENINFO" },
+	{ FBIOPUT_VSCREENINFO, "FBIOPUT_VSCREENINFO" },
+	{ FBIOGET_FSCREENINFO, "FBIOGET_FSCREENINFO" },
+	{ FBIOGET_LAYER_HDL_0, "FBIOGET_LAYER_HDL_0" },
+	{ FBIOGET_LAYER_HDL_1, "FBIOGET_LAYER_HDL_1" },
+	{ FBIOPAN_DISPLAY, "FBIOPAN_DISPLAY" },
+	{ FBIO_WAITFORVSYNC, "FBIO_WAITFORVSYNC" },
+	{ 0, NULL }
+};
+
+// Calls of the current command, by name.
+#define TRACE_MAX_SUMMARY 64
+
+struct trace_summary_entry {
+	const char *name;
+	int count;
+	double total, max;
+};
+
+static struct trace_summary_entry trace_summary_entries[TRACE_MAX_SUMMARY];
+static int trace_nu_summary_entries;
+static const char *trace_command_name;
+static double trace_command_start_time;
+
+static FILE *trace_file;
+static int trace_nu_events;
+static double trace_start_time;
+static struct disp_backend *trace_inner;
+static struct disp_backend trace_wrapper;
+
+static double trace_time_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static const char *trace_lookup_name(const struct trace_name *table, unsigned long cmd, char *buffer) {
+	int i;
+	for (i = 0; table[i].name != NULL; i++)
+		if (table[i].cmd == cmd)
+			return table[i].name;
+	sprintf(buffer, "0x%lX", cmd);
+	return buffer;
+}
+
+const char *trace_disp_name(unsigned long cmd, char *buffer) {
+	return trace_lookup_name(trace_disp_names, cmd, buffer);
+}
+
+const char *trace_fb_name(unsigned long cmd, char *buffer) {
+	return trace_lookup_name(trace_fb_names, cmd, buffer);
+}
+
+static void trace_add_to_summary(const char *name, double duration) {
+	int i;
+	for (i = 0; i < trace_nu_summary_entries; i++)
+		if (strcmp(trace_summary_entries[i].name, name) == 0)
+			break;
+	if (i == trace_nu_summary_entries) {
+		if (i == TRACE_MAX_SUMMARY)
+			return;
+		trace_summary_entries[i].name = strdup(name);
+		trace_summary_entries[i].count = 0;
+		trace_summary_entries[i].total = trace_summary_entries[i].max = 0;
+		trace_nu_summary_entries++;
+	}
+	trace_summary_entries[i].count++;
+	trace_summary_entries[i].total += duration;
+	if (duration > trace_summary_entries[i].max)
+		trace_summary_entries[i].max = duration;
+}
+
+// Write an event; args is the JSON object with its arguments (without braces), or NULL.
+
+static void trace_write_event(const char *name, const char *category, double start_time, double duration,
+const char *args) {
+	if (trace_file == NULL)
+		return;
+	fprintf(trace_file, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+		"\"pid\":%d,\"tid\":%d", trace_nu_events > 0 ? ",\n" : "", name, category,
+		(start_time - trace_start_time) * 1000, duration * 1000, (int)getpid(),
+		strcmp(category, "command") == 0 || strcmp(category, "phase") == 0 ? 1 : 2);
+	if (args != NULL)
+		fprintf(trace_file, ",\"args\":{%s}", args);
+	fprintf(trace_file, "}");
+	trace_nu_events++;
+}
+
+void trace_event(const char *name, const char *category, double start_time, double duration) {
+	trace_write_event(name, category, start_time, duration, NULL);
+}
+
+static void trace_call(const char *name, const char *category, double start_time, const char *args) {
+	double duration = trace_time_ms() - start_time;
+	trace_write_event(name, category, start_time, duration, args);
+	trace_add_to_summary(name, duration);
+}
+
+static int trace_open_backend(void) {
+	double start_time = trace_time_ms();
+	int ret = trace_inner->open();
+	char args[64];
+	sprintf(args, "\"backend\":\"%s\",\"ret\":%d", trace_inner->name, ret);
+	trace_call("open", "backend", start_time, args);
+	return ret;
+}
+
+static void trace_close_backend(void) {
+	double start_time = trace_time_ms();
+	trace_inner->close();
+	trace_call("close", "backend", start_time, NULL);
+}
+
+static int trace_disp_ioctl(unsigned int cmd, unsigned long *args) {
+	unsigned long saved_args[4];
+	double start_time;
+	char name_buffer[32], event_args[160];
+	int ret, saved_errno;
+	memcpy(saved_args, args, sizeof(saved_args));
+	start_time = trace_time_ms();
+	ret = trace_inner->disp_ioctl(cmd, args);
+	saved_errno = errno;
+	// The arguments that are pointers are recorded as numbers too.
+	sprintf(event_args, "\"args\":[%lu,%lu,%lu,%lu],\"ret\":%d", saved_args[0], saved_args[1], saved_args[2],
+		saved_args[3], ret);
+	if (ret < 0)
+		sprintf(event_args + strlen(event_args), ",\"errno\":%d", saved_errno);
+	trace_call(trace_disp_name(cmd, name_buffer), "disp", start_time, event_args);
+	errno = saved_errno;
+	return ret;
+}
+
+static int trace_fb_ioctl(int fb, unsigned long cmd, void *arg) {
+	double start_time;
+	char name_buffer[32], event_args[160];
+	int ret, saved_errno;
+	start_time = trace_time_ms();
+	ret = trace_inner->fb_ioctl(fb, cmd, arg);
+	saved_errno = errno;
+	sprintf(event_args, "\"fb\":%d,\"ret\":%d", fb, ret);
+	if (ret < 0)
+		sprintf(event_args + strlen(event_args), ",\"errno\":%d", saved_errno);
+	if (cmd == FBIOGET_VSCREENINFO || cmd == FBIOPUT_VSCREENINFO || cmd == FBIOPAN_DISPLAY) {
+		const struct fb_var_screeninfo *var = arg;
+		sprintf(event_args + strlen(event_args), ",\"var\":\"%ux%u virtual %ux%u offset %u,%u %ubpp\"",
+			var->xres, var->yres, var->xres_virtual, var->yres_virtual, var->xoffset, var->yoffset,
+			var->bits_per_pixel);
+	}
+	trace_call(trace_fb_name(cmd, name_buffer), "fb", start_time, event_args);
+	errno = saved_errno;
+	return ret;
+}
+
+static int trace_fbset(int fb, const char *command, int width, int height, int bytes_per_pixel) {
+	double start_time = trace_time_ms();
+	char event_args[256];
+	int ret = trace_inner->fbset(fb, command, width, height, bytes_per_pixel);
+	snprintf(event_args, sizeof(event_args), "\"command\":\"%s\",\"ret\":%d", command, ret);
+	trace_call("fbset", "fb", start_time, event_args);
+	return ret;
+}
+
+static void trace_reset(void) {
+	double start_time = trace_time_ms();
+	trace_inner->reset();
+	trace_call("reset", "backend", start_time, NULL);
+}
+
+static void *trace_fb_mmap(int fb, size_t length) {
+	double start_time = trace_time_ms();
+	char event_args[64];
+	void *address = trace_inner->fb_mmap(fb, length);
+	int saved_errno = errno;
+	sprintf(event_args, "\"fb\":%d,\"length\":%zu", fb, length);
+	trace_call("mmap", "fb", start_time, event_args);
+	errno = saved_errno;
+	return address;
+}
+
+static void trace_fb_munmap(int fb, void *address, size_t length) {
+	double start_time = trace_time_ms();
+	trace_inner->fb_munmap(fb, address, length);
+	trace_call("munmap", "fb", start_time, NULL);
+}
+
+int trace_open(const char *file) {
+	trace_file = fopen(file, "w");
+	if (trace_file == NULL) {
+		fprintf(stderr, "Error: could not create trace file %s: %s\n", file, strerror(errno));
+		return - 1;
+	}
+	fprintf(trace_file, "{\"traceEvents\":[\n");
+	trace_start_time = trace_time_ms();
+	return 0;
+}
+
+struct disp_backend *trace_backend(struct disp_backend *backend) {
+	trace_inner = backend;
+	trace_wrapper.name = backend->name;
+	trace_wrapper.open = trace_open_backend;
+	trace_wrapper.close = trace_close_backend;
+	trace_wrapper.disp_ioctl = trace_disp_ioctl;
+	trace_wrapper.fb_ioctl = trace_fb_ioctl;
+	trace_wrapper.fbset = trace_fbset;
+	trace_wrapper.reset = backend->reset != NULL ? trace_reset : NULL;
+	trace_wrapper.fb_mmap = trace_fb_mmap;
+	trace_wrapper.fb_munmap = trace_fb_munmap;
+	return &trace_wrapper;
+}
+
+void trace_command(const char *name) {
+	trace_command_name = name;
+	trace_command_start_time = trace_time_ms();
+}
+
+static int trace_compare_summary_entries(const void *a, const void *b) {
+	const struct trace_summary_entry *ea = a, *eb = b;
+	if (ea->total != eb->total)
+		return ea->total > eb->total ? - 1 : 1;
+	return strcmp(ea->name, eb->name);
+}
+
+void trace_summary(void) {
+	double total = 0, command_time;
+	int count = 0, i;
+	if (trace_file == NULL || trace_command_name == NULL)
+		return;
+	command_time = trace_time_ms() - trace_command_start_time;
+	trace_event(trace_command_name, "command", trace_command_start_time, command_time);
+	qsort(trace_summary_entries, trace_nu_summary_entries, sizeof(trace_summary_entries[0]),
+		trace_compare_summary_entries);
+	for (i = 0; i < trace_nu_summary_entries; i++) {
+		count += trace_summary_entries[i].count;
+		total += trace_summary_entries[i].total;
+	}
+	printf("Trace of %s: %d driver calls taking %.3f ms of %.3f ms.\n", trace_command_name, count, total,
+		command_time);
+	printf("%-22s %6s %10s %10s %10s\n", "call", "count", "total ms", "mean ms", "max ms");
+	for (i = 0; i < trace_nu_summary_entries; i++) {
+		struct trace_summary_entry *e = &trace_summary_entries[i];
+		printf("%-22s %6d %10.3f %10.3f %10.3f\n", e->name, e->count, e->total, e->total / e->count, e->max);
+		free((char *)e->name);
+	}
+	trace_nu_summary_entries = 0;
+	trace_command_name = NULL;
+	fflush(trace_file);
+}
+
+void trace_close(void) {
+	if (trace_file == NULL)
+		return;
+	trace_summary();
+	fprintf(trace_file, "\n]}\n");
+	fclose(trace_file);
+	trace_file = NULL;
+}
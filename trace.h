@@ -0,0 +1,38 @@
+/*
+  a10disp -- program to change the display mode of Allwinner A10 devices.
+
+  Tracing of the display driver calls (--trace option). Every call through the
+  backend is timed and written as a Chrome trace event (chrome://tracing or
+  Perfetto), and a summary of the calls of each command is printed.
+*/
+
+#ifndef A10DISP_TRACE_H
+#define A10DISP_TRACE_H
+
+#include "backend.h"
+
+// Open the trace file. Returns -1 on failure.
+int trace_open(const char *file);
+
+// Returns a backend that records every call and passes it on to the given backend.
+struct disp_backend *trace_backend(struct disp_backend *backend);
+
+// Start a command; the calls until the next trace_summary() are summarized under its name.
+void trace_command(const char *name);
+
+// Record an event (for example a phase of a command) with times in milliseconds of
+// CLOCK_MONOTONIC. Does nothing when tracing is not enabled.
+void trace_event(const char *name, const char *category, double start_time, double duration);
+
+// Print the number of calls and the time taken per call of the current command, and reset it.
+void trace_summary(void);
+
+// Print the pending summary and finish the trace file.
+void trace_close(void);
+
+// Name of a display driver or framebuffer ioctl; buffer (at least 32 bytes) is used for
+// unknown commands.
+const char *trace_disp_name(unsigned long cmd, char *buffer);
+const char *trace_fb_name(unsigned long cmd, char *buffer);
+
+#endif